@@ -0,0 +1,943 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : barcode.c
+* DESCRIPTION   : Barcode and QR code encoders
+*                 Symbols are encoded as module patterns, rendering them
+*                 into dotlines is left to the caller
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "barcode.h"
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+typedef struct {
+        const char *    name;
+        int             type;
+} barcode_name_t;
+
+static const barcode_name_t barcode_names[] = {
+        {"CODE39",      BARCODE_CODE39},
+        {"CODE128",     BARCODE_CODE128},
+        {"EAN13",       BARCODE_EAN13},
+        {"EAN8",        BARCODE_EAN8},
+        {"UPCA",        BARCODE_UPCA},
+};
+
+#define BARCODE_NAMES_SIZE      (sizeof(barcode_names)/sizeof(barcode_name_t))
+
+/*code 39 characters, element widths (bar first, w=wide)*/
+static const char code39_chars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-. *$/+%";
+
+static const char *code39_patterns[] = {
+        "nnnwwnwnn", "wnnwnnnnw", "nnwwnnnnw", "wnwwnnnnn", "nnnwwnnnw",
+        "wnnwwnnnn", "nnwwwnnnn", "nnnwnnwnw", "wnnwnnwnn", "nnwwnnwnn",
+        "wnnnnwnnw", "nnwnnwnnw", "wnwnnwnnn", "nnnnwwnnw", "wnnnwwnnn",
+        "nnwnwwnnn", "nnnnnwwnw", "wnnnnwwnn", "nnwnnwwnn", "nnnnwwwnn",
+        "wnnnnnnww", "nnwnnnnww", "wnwnnnnwn", "nnnnwnnww", "wnnnwnnwn",
+        "nnwnwnnwn", "nnnnnnwww", "wnnnnnwwn", "nnwnnnwwn", "nnnnwnwwn",
+        "wwnnnnnnw", "nwwnnnnnw", "wwwnnnnnn", "nwnnwnnnw", "wwnnwnnnn",
+        "nwwnwnnnn", "nwnnnnwnw", "wwnnnnwnn", "nwwnnnwnn", "nwnnwnwnn",
+        "nwnwnwnnn", "nwnwnnnwn", "nwnnnwnwn", "nnnwnwnwn",
+};
+
+#define CODE39_WIDE     3       /*modules*/
+
+/*code 128 symbols, element widths (bar first)*/
+static const char *code128_patterns[] = {
+        "212222", "222122", "222221", "121223", "121322", "131222", "122213",
+        "122312", "132212", "221213", "221312", "231212", "112232", "122132",
+        "122231", "113222", "123122", "123221", "223211", "221132", "221231",
+        "213212", "223112", "312131", "311222", "321122", "321221", "312212",
+        "322112", "322211", "212123", "212321", "232121", "111323", "131123",
+        "131321", "112313", "132113", "132311", "211313", "231113", "231311",
+        "112133", "112331", "132131", "113123", "113321", "133121", "313121",
+        "211331", "231131", "213113", "213311", "213131", "311123", "311321",
+        "331121", "312113", "312311", "332111", "314111", "221411", "431111",
+        "111224", "111422", "121124", "121421", "141122", "141221", "112214",
+        "112412", "122114", "122411", "142112", "142211", "241211", "221114",
+        "413111", "241112", "134111", "111242", "121142", "121241", "114212",
+        "124112", "124211", "411212", "421112", "421211", "212141", "214121",
+        "412121", "111143", "111341", "131141", "114113", "114311", "411113",
+        "411311", "113141", "114131", "311141", "411131", "211412", "211214",
+        "211232", "2331112",
+};
+
+#define CODE128_CODE_B  100
+#define CODE128_CODE_C  99
+#define CODE128_START_B 104
+#define CODE128_START_C 105
+#define CODE128_STOP    106
+
+/*EAN/UPC left hand odd parity digits (L code)*/
+static const char *ean_l_patterns[] = {
+        "0001101", "0011001", "0010011", "0111101", "0100011",
+        "0110001", "0101111", "0111011", "0110111", "0001011",
+};
+
+/*EAN-13 parity of left hand digits, selected by first digit*/
+static const char *ean_parities[] = {
+        "LLLLLL", "LLGLGG", "LLGGLG", "LLGGGL", "LGLLGG",
+        "LGGLLG", "LGGGLL", "LGLGLG", "LGLGGL", "LGGLGL",
+};
+
+#define EAN_DIGITS_MAX  13
+
+/*QR code, byte mode, error correction level M*/
+typedef struct {
+        int     codewords;              /*total codewords*/
+        int     ec_codewords;           /*per block*/
+        int     blocks;
+        int     align[3];               /*alignment pattern centers*/
+} qr_version_t;
+
+static const qr_version_t qr_versions[QR_VERSION_MAX] = {
+        { 26, 10, 1, {0}},
+        { 44, 16, 1, {6, 18}},
+        { 70, 26, 1, {6, 22}},
+        {100, 18, 2, {6, 26}},
+        {134, 24, 2, {6, 30}},
+        {172, 16, 4, {6, 34}},
+        {196, 18, 4, {6, 22, 38}},
+        {242, 22, 4, {6, 24, 42}},
+        {292, 22, 5, {6, 26, 46}},
+        {346, 26, 5, {6, 28, 50}},
+};
+
+#define QR_CODEWORDS_MAX        346
+#define QR_EC_CODEWORDS_MAX     30
+
+#define QR_ECL_M                0       /*format bits of level M*/
+
+#define QR_MODULE_DARK          0x01
+#define QR_MODULE_FUNCTION      0x02
+
+typedef struct {
+        int             size;
+        unsigned char   m[QR_SIZE_MAX*QR_SIZE_MAX];
+} qr_t;
+
+#define QR_AT(qr,x,y)   ((qr)->m[(y)*(qr)->size+(x)])
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  put_modules
+Purpose   :  Append modules of given color to module buffer
+Inputs    :  modules : module buffer
+             pos : current position in buffer
+             max : size of module buffer
+             width : number of modules
+             dark : module color
+Outputs   :  Updates module buffer
+Return    :  new position or -1 if buffer is full
+-----------------------------------------------------------------------------*/
+static int put_modules(unsigned char *modules,int pos,int max,int width,int dark)
+{
+        if (pos<0 || pos+width>max)
+                return -1;
+
+        memset(modules+pos,dark,width);
+
+        return pos+width;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  put_widths
+Purpose   :  Append alternating bars and spaces described by a width string
+Inputs    :  modules : module buffer
+             pos : current position in buffer
+             max : size of module buffer
+             widths : element widths in modules, bar first
+Outputs   :  Updates module buffer
+Return    :  new position or -1 if buffer is full
+-----------------------------------------------------------------------------*/
+static int put_widths(unsigned char *modules,int pos,int max,const char *widths)
+{
+        int dark;
+
+        for (dark=1; *widths && pos>=0; widths++, dark = !dark)
+                pos = put_modules(modules,pos,max,*widths-'0',dark);
+
+        return pos;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  put_bits
+Purpose   :  Append modules described by a binary string (1=dark)
+Inputs    :  modules : module buffer
+             pos : current position in buffer
+             max : size of module buffer
+             bits : module string
+             invert : if set, dark and light modules are swapped
+Outputs   :  Updates module buffer
+Return    :  new position or -1 if buffer is full
+-----------------------------------------------------------------------------*/
+static int put_bits(unsigned char *modules,int pos,int max,const char *bits,int invert)
+{
+        for (; *bits && pos>=0; bits++)
+                pos = put_modules(modules,pos,max,1,(*bits=='1')!=invert);
+
+        return pos;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  encode_code39
+Purpose   :  Encode Code 39 symbol (start and stop characters are added)
+Inputs    :  data : data string
+             modules : module buffer
+             max : size of module buffer
+Outputs   :  Fills module buffer
+Return    :  number of modules or -1 on error
+-----------------------------------------------------------------------------*/
+static int encode_code39(const char *data,unsigned char *modules,int max)
+{
+        const char *p;
+        const char *s;
+        int pos = 0;
+        int i;
+
+        for (s = data; *s; s++) {
+                if (*s=='*' || strchr(code39_chars,toupper((unsigned char)*s))==NULL)
+                        return -1;
+        }
+
+        for (i=-1; pos>=0 && i<=(int)strlen(data); i++) {
+                if (i==-1 || i==strlen(data))
+                        p = strchr(code39_chars,'*');
+                else
+                        p = strchr(code39_chars,toupper((unsigned char)data[i]));
+
+                for (s = code39_patterns[p-code39_chars]; *s && pos>=0; s++) {
+                        int dark = ((s-code39_patterns[p-code39_chars])%2)==0;
+
+                        pos = put_modules(modules,pos,max,*s=='w' ? CODE39_WIDE : 1,dark);
+                }
+
+                /*inter-character gap*/
+                if (i<(int)strlen(data))
+                        pos = put_modules(modules,pos,max,1,0);
+        }
+
+        return pos;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  encode_code128
+Purpose   :  Encode Code 128 symbol
+             Code set C is used for even length numeric data, code set B
+             otherwise
+Inputs    :  data : data string
+             modules : module buffer
+             max : size of module buffer
+Outputs   :  Fills module buffer
+Return    :  number of modules or -1 on error
+-----------------------------------------------------------------------------*/
+static int encode_code128(const char *data,unsigned char *modules,int max)
+{
+        int len = strlen(data);
+        int numeric = (len>0 && len%2==0);
+        int checksum;
+        int weight;
+        int value;
+        int pos;
+        int i;
+
+        if (len==0)
+                return -1;
+
+        for (i=0; i<len; i++) {
+                if ((unsigned char)data[i]<32 || (unsigned char)data[i]>126)
+                        return -1;
+                if (!isdigit((unsigned char)data[i]))
+                        numeric = 0;
+        }
+
+        value = numeric ? CODE128_START_C : CODE128_START_B;
+        pos = put_widths(modules,0,max,code128_patterns[value]);
+        checksum = value;
+        weight = 1;
+
+        for (i=0; i<len && pos>=0; weight++) {
+                if (numeric) {
+                        value = (data[i]-'0')*10 + data[i+1]-'0';
+                        i += 2;
+                }
+                else {
+                        value = data[i]-32;
+                        i++;
+                }
+
+                pos = put_widths(modules,pos,max,code128_patterns[value]);
+                checksum += value*weight;
+        }
+
+        pos = put_widths(modules,pos,max,code128_patterns[checksum%103]);
+        pos = put_widths(modules,pos,max,code128_patterns[CODE128_STOP]);
+
+        return pos;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  ean_check_digit
+Purpose   :  Compute EAN/UPC check digit
+Inputs    :  digits : digit values (without check digit)
+             n : number of digits
+Outputs   :  <>
+Return    :  check digit value
+-----------------------------------------------------------------------------*/
+static int ean_check_digit(const int *digits,int n)
+{
+        int sum = 0;
+        int i;
+
+        /*weight 3 for the digit next to the check digit, then alternate*/
+        for (i=0; i<n; i++)
+                sum += digits[n-1-i] * ((i%2==0) ? 3 : 1);
+
+        return (10 - sum%10) % 10;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  encode_ean
+Purpose   :  Encode EAN-13, EAN-8 or UPC-A symbol
+             Check digit is computed if missing, and verified otherwise
+Inputs    :  type : symbology
+             data : data string
+             modules : module buffer
+             max : size of module buffer
+Outputs   :  Fills module buffer
+Return    :  number of modules or -1 on error
+-----------------------------------------------------------------------------*/
+static int encode_ean(int type,const char *data,unsigned char *modules,int max)
+{
+        int digits[EAN_DIGITS_MAX];
+        const char *parity;
+        int len = strlen(data);
+        int n;
+        int half;
+        int pos;
+        int i;
+
+        n = (type==BARCODE_EAN8) ? 8 : 13;
+
+        /*UPC-A is EAN-13 with a leading zero*/
+        if (type==BARCODE_UPCA) {
+                if (len!=11 && len!=12)
+                        return -1;
+                digits[0] = 0;
+                i = 1;
+        }
+        else {
+                if (len!=n-1 && len!=n)
+                        return -1;
+                i = 0;
+        }
+
+        for (; *data; data++, i++) {
+                if (!isdigit((unsigned char)*data))
+                        return -1;
+                digits[i] = *data-'0';
+        }
+
+        if (i==n-1)
+                digits[n-1] = ean_check_digit(digits,n-1);
+        else if (digits[n-1]!=ean_check_digit(digits,n-1))
+                return -1;
+
+        /*EAN-13 first digit is encoded in parity of left hand digits*/
+        if (n==13) {
+                parity = ean_parities[digits[0]];
+                i = 1;
+        }
+        else {
+                parity = "LLLL";
+                i = 0;
+        }
+
+        half = (n==13) ? 7 : 4;
+
+        pos = put_bits(modules,0,max,"101",0);
+
+        for (; i<half && pos>=0; i++) {
+                if (parity[i-(n==13)]=='L') {
+                        pos = put_bits(modules,pos,max,ean_l_patterns[digits[i]],0);
+                }
+                else {
+                        /*G code is R code reversed*/
+                        char g[8];
+                        int k;
+
+                        for (k=0; k<7; k++)
+                                g[k] = ean_l_patterns[digits[i]][6-k];
+                        g[7] = 0;
+
+                        pos = put_bits(modules,pos,max,g,1);
+                }
+        }
+
+        pos = put_bits(modules,pos,max,"01010",0);
+
+        /*R code is L code inverted*/
+        for (; i<n && pos>=0; i++)
+                pos = put_bits(modules,pos,max,ean_l_patterns[digits[i]],1);
+
+        pos = put_bits(modules,pos,max,"101",0);
+
+        return pos;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  gf_multiply
+Purpose   :  Multiply two elements of GF(256) (QR code field, x^8+x^4+x^3+x^2+1)
+Inputs    :  x, y : field elements
+Outputs   :  <>
+Return    :  product
+-----------------------------------------------------------------------------*/
+static int gf_multiply(int x,int y)
+{
+        int z = 0;
+        int i;
+
+        for (i=7; i>=0; i--) {
+                z = (z<<1) ^ ((z>>7)*0x11d);
+                z ^= ((y>>i)&1)*x;
+        }
+
+        return z;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  rs_encode
+Purpose   :  Compute Reed-Solomon error correction codewords
+Inputs    :  data : data codewords
+             len : number of data codewords
+             ec : number of error correction codewords
+Outputs   :  out : error correction codewords
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void rs_encode(const unsigned char *data,int len,int ec,unsigned char *out)
+{
+        unsigned char divisor[QR_EC_CODEWORDS_MAX];
+        int root = 1;
+        int i,j;
+
+        /*generator polynomial (x-r^0)(x-r^1)...(x-r^(ec-1)), leading term dropped*/
+        memset(divisor,0,ec);
+        divisor[ec-1] = 1;
+
+        for (i=0; i<ec; i++) {
+                for (j=0; j<ec; j++) {
+                        divisor[j] = gf_multiply(divisor[j],root);
+                        if (j+1<ec)
+                                divisor[j] ^= divisor[j+1];
+                }
+                root = gf_multiply(root,0x02);
+        }
+
+        /*polynomial division remainder*/
+        memset(out,0,ec);
+
+        for (i=0; i<len; i++) {
+                int factor = data[i] ^ out[0];
+
+                memmove(out,out+1,ec-1);
+                out[ec-1] = 0;
+
+                for (j=0; j<ec; j++)
+                        out[j] ^= gf_multiply(divisor[j],factor);
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  qr_set_function
+Purpose   :  Set function module (never masked nor used by data)
+Inputs    :  qr : QR symbol
+             x, y : module coordinates
+             dark : module color
+Outputs   :  Updates QR symbol
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void qr_set_function(qr_t *qr,int x,int y,int dark)
+{
+        QR_AT(qr,x,y) = QR_MODULE_FUNCTION | (dark ? QR_MODULE_DARK : 0);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  qr_draw_format
+Purpose   :  Draw both copies of format information
+Inputs    :  qr : QR symbol
+             mask : mask pattern
+Outputs   :  Updates QR symbol
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void qr_draw_format(qr_t *qr,int mask)
+{
+        int data = QR_ECL_M<<3 | mask;
+        int rem = data;
+        int bits;
+        int size = qr->size;
+        int i;
+
+        for (i=0; i<10; i++)
+                rem = (rem<<1) ^ ((rem>>9)*0x537);
+        bits = (data<<10 | rem) ^ 0x5412;
+
+        for (i=0; i<=5; i++)
+                qr_set_function(qr,8,i,(bits>>i)&1);
+        qr_set_function(qr,8,7,(bits>>6)&1);
+        qr_set_function(qr,8,8,(bits>>7)&1);
+        qr_set_function(qr,7,8,(bits>>8)&1);
+        for (i=9; i<15; i++)
+                qr_set_function(qr,14-i,8,(bits>>i)&1);
+
+        for (i=0; i<8; i++)
+                qr_set_function(qr,size-1-i,8,(bits>>i)&1);
+        for (i=8; i<15; i++)
+                qr_set_function(qr,8,size-15+i,(bits>>i)&1);
+
+        /*dark module*/
+        qr_set_function(qr,8,size-8,1);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  qr_draw_functions
+Purpose   :  Draw finder, timing and alignment patterns, reserve format area
+             and draw version information
+Inputs    :  qr : QR symbol
+             version : symbol version (1 to QR_VERSION_MAX)
+Outputs   :  Updates QR symbol
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void qr_draw_functions(qr_t *qr,int version)
+{
+        const qr_version_t *v = &qr_versions[version-1];
+        int size = qr->size;
+        int centers[3][2];
+        int nalign;
+        int i,j,dx,dy;
+
+        /*timing patterns*/
+        for (i=0; i<size; i++) {
+                qr_set_function(qr,6,i,i%2==0);
+                qr_set_function(qr,i,6,i%2==0);
+        }
+
+        /*finder patterns and separators*/
+        centers[0][0] = 3;      centers[0][1] = 3;
+        centers[1][0] = size-4; centers[1][1] = 3;
+        centers[2][0] = 3;      centers[2][1] = size-4;
+
+        for (i=0; i<3; i++) {
+                for (dy=-4; dy<=4; dy++) {
+                        for (dx=-4; dx<=4; dx++) {
+                                int x = centers[i][0]+dx;
+                                int y = centers[i][1]+dy;
+                                int dist = abs(dx)>abs(dy) ? abs(dx) : abs(dy);
+
+                                if (x>=0 && x<size && y>=0 && y<size)
+                                        qr_set_function(qr,x,y,dist!=2 && dist!=4);
+                        }
+                }
+        }
+
+        /*alignment patterns, except on finder patterns*/
+        for (nalign=0; nalign<3 && v->align[nalign]!=0; nalign++)
+                ;
+
+        for (i=0; i<nalign; i++) {
+                for (j=0; j<nalign; j++) {
+                        if ((i==0 && j==0) || (i==0 && j==nalign-1) || (i==nalign-1 && j==0))
+                                continue;
+
+                        for (dy=-2; dy<=2; dy++) {
+                                for (dx=-2; dx<=2; dx++) {
+                                        int dist = abs(dx)>abs(dy) ? abs(dx) : abs(dy);
+
+                                        qr_set_function(qr,v->align[i]+dx,v->align[j]+dy,dist!=1);
+                                }
+                        }
+                }
+        }
+
+        /*format information area (final bits are drawn after masking)*/
+        qr_draw_format(qr,0);
+
+        /*version information*/
+        if (version>=7) {
+                int rem = version;
+                long bits;
+
+                for (i=0; i<12; i++)
+                        rem = (rem<<1) ^ ((rem>>11)*0x1f25);
+                bits = (long)version<<12 | rem;
+
+                for (i=0; i<18; i++) {
+                        int a = size-11+i%3;
+                        int b = i/3;
+
+                        qr_set_function(qr,a,b,(bits>>i)&1);
+                        qr_set_function(qr,b,a,(bits>>i)&1);
+                }
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  qr_draw_codewords
+Purpose   :  Place codewords in zigzag order on non-function modules
+Inputs    :  qr : QR symbol
+             codewords : interleaved codewords
+             len : number of codewords
+Outputs   :  Updates QR symbol
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void qr_draw_codewords(qr_t *qr,const unsigned char *codewords,int len)
+{
+        int size = qr->size;
+        int right,vert,j;
+        int i = 0;
+
+        for (right=size-1; right>=1; right-=2) {
+                if (right==6)
+                        right = 5;
+
+                for (vert=0; vert<size; vert++) {
+                        for (j=0; j<2; j++) {
+                                int x = right-j;
+                                int upward = ((right+1)&2)==0;
+                                int y = upward ? size-1-vert : vert;
+
+                                if (!(QR_AT(qr,x,y) & QR_MODULE_FUNCTION) && i<len*8) {
+                                        if ((codewords[i>>3]>>(7-(i&7)))&1)
+                                                QR_AT(qr,x,y) = QR_MODULE_DARK;
+                                        i++;
+                                }
+                        }
+                }
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  qr_apply_mask
+Purpose   :  XOR mask pattern on data modules (applying it twice undoes it)
+Inputs    :  qr : QR symbol
+             mask : mask pattern (0 to 7)
+Outputs   :  Updates QR symbol
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void qr_apply_mask(qr_t *qr,int mask)
+{
+        int size = qr->size;
+        int x,y;
+
+        for (y=0; y<size; y++) {
+                for (x=0; x<size; x++) {
+                        int invert;
+
+                        if (QR_AT(qr,x,y) & QR_MODULE_FUNCTION)
+                                continue;
+
+                        switch (mask) {
+                        case 0:  invert = (x+y)%2==0;                   break;
+                        case 1:  invert = y%2==0;                       break;
+                        case 2:  invert = x%3==0;                       break;
+                        case 3:  invert = (x+y)%3==0;                   break;
+                        case 4:  invert = (x/3+y/2)%2==0;               break;
+                        case 5:  invert = x*y%2+x*y%3==0;               break;
+                        case 6:  invert = (x*y%2+x*y%3)%2==0;           break;
+                        default: invert = ((x+y)%2+x*y%3)%2==0;         break;
+                        }
+
+                        if (invert)
+                                QR_AT(qr,x,y) ^= QR_MODULE_DARK;
+                }
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  qr_dark
+Purpose   :  Get module color, modules outside of symbol are light
+Inputs    :  qr : QR symbol
+             x, y : module coordinates
+Outputs   :  <>
+Return    :  1 if module is dark, 0 otherwise
+-----------------------------------------------------------------------------*/
+static int qr_dark(const qr_t *qr,int x,int y)
+{
+        if (x<0 || y<0 || x>=qr->size || y>=qr->size)
+                return 0;
+
+        return QR_AT(qr,x,y) & QR_MODULE_DARK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  qr_penalty
+Purpose   :  Compute mask penalty score of symbol
+Inputs    :  qr : QR symbol
+Outputs   :  <>
+Return    :  penalty score (lower is better)
+-----------------------------------------------------------------------------*/
+static int qr_penalty(const qr_t *qr)
+{
+        static const int finder[11] = {1,0,1,1,1,0,1,0,0,0,0};
+        int size = qr->size;
+        int penalty = 0;
+        int dark = 0;
+        int total = size*size;
+        int i,j,k,dir;
+
+        for (dir=0; dir<2; dir++) {
+                for (i=0; i<size; i++) {
+                        int run = 0;
+                        int color = -1;
+
+                        for (j=0; j<size; j++) {
+                                int c = dir ? qr_dark(qr,i,j) : qr_dark(qr,j,i);
+
+                                /*runs of five or more modules of same color*/
+                                if (c==color) {
+                                        run++;
+                                        if (run==5)
+                                                penalty += 3;
+                                        else if (run>5)
+                                                penalty++;
+                                }
+                                else {
+                                        color = c;
+                                        run = 1;
+                                }
+
+                                /*finder-like 1:1:3:1:1 patterns with light area*/
+                                for (k=0; k<11; k++) {
+                                        int f = dir ? qr_dark(qr,i,j+k) : qr_dark(qr,j+k,i);
+                                        if (f!=finder[k])
+                                                break;
+                                }
+                                if (k==11)
+                                        penalty += 40;
+
+                                for (k=0; k<11; k++) {
+                                        int f = dir ? qr_dark(qr,i,j+k-4) : qr_dark(qr,j+k-4,i);
+                                        if (f!=finder[10-k])
+                                                break;
+                                }
+                                if (k==11)
+                                        penalty += 40;
+                        }
+                }
+        }
+
+        /*2x2 blocks of same color*/
+        for (i=0; i<size-1; i++) {
+                for (j=0; j<size-1; j++) {
+                        int c = qr_dark(qr,j,i);
+
+                        if (c==qr_dark(qr,j+1,i) && c==qr_dark(qr,j,i+1) && c==qr_dark(qr,j+1,i+1))
+                                penalty += 3;
+                }
+        }
+
+        /*balance of dark and light modules*/
+        for (i=0; i<size; i++)
+                for (j=0; j<size; j++)
+                        dark += qr_dark(qr,j,i);
+
+        k = (abs(dark*20 - total*10) + total - 1)/total - 1;
+        penalty += k*10;
+
+        return penalty;
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  barcode_get_type
+Purpose   :  Convert symbology name to barcode type
+Inputs    :  name : symbology name (case insensitive)
+Outputs   :  <>
+Return    :  barcode type (barcode_type_t) or BARCODE_INVALID
+-----------------------------------------------------------------------------*/
+int barcode_get_type(const char *name)
+{
+        int i;
+
+        for (i=0; i<BARCODE_NAMES_SIZE; i++)
+                if (strcasecmp(barcode_names[i].name,name)==0)
+                        return barcode_names[i].type;
+
+        return BARCODE_INVALID;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  barcode_encode
+Purpose   :  Encode linear barcode as a module pattern (quiet zones excluded)
+Inputs    :  type : barcode type
+             data : data string
+             modules : module buffer
+             max : size of module buffer
+Outputs   :  Fills module buffer (1=bar, 0=space)
+Return    :  number of modules or -1 on error
+-----------------------------------------------------------------------------*/
+int barcode_encode(int type,const char *data,unsigned char *modules,int max)
+{
+        switch (type) {
+        case BARCODE_CODE39:
+                return encode_code39(data,modules,max);
+        case BARCODE_CODE128:
+                return encode_code128(data,modules,max);
+        case BARCODE_EAN13:
+        case BARCODE_EAN8:
+        case BARCODE_UPCA:
+                return encode_ean(type,data,modules,max);
+        default:
+                return -1;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  qr_encode
+Purpose   :  Encode data as QR code symbol (byte mode, error correction
+             level M). Smallest version holding the data is used
+Inputs    :  data : data buffer
+             len : data size in bytes
+             matrix : symbol buffer (at least QR_SIZE_MAX*QR_SIZE_MAX bytes)
+Outputs   :  Fills symbol buffer, one byte per module (1=dark), row by row
+Return    :  symbol size in modules or -1 if data does not fit
+-----------------------------------------------------------------------------*/
+int qr_encode(const unsigned char *data,int len,unsigned char *matrix)
+{
+        static qr_t qr;
+        const qr_version_t *v;
+        unsigned char buf[QR_CODEWORDS_MAX];
+        unsigned char codewords[QR_CODEWORDS_MAX];
+        unsigned char ec[QR_EC_CODEWORDS_MAX];
+        int version;
+        int data_codewords;
+        int count_bits;
+        int bitpos;
+        int short_len,nshort;
+        int mask,best_mask,best_penalty;
+        int i,j,n;
+
+        /*select version*/
+        for (version=1; version<=QR_VERSION_MAX; version++) {
+                v = &qr_versions[version-1];
+                data_codewords = v->codewords - v->ec_codewords*v->blocks;
+                count_bits = (version<10) ? 8 : 16;
+
+                if (4+count_bits+8*len <= 8*data_codewords)
+                        break;
+        }
+
+        if (version>QR_VERSION_MAX)
+                return -1;
+
+        /*build data bit stream: mode, count, data, terminator, padding*/
+        memset(buf,0,sizeof(buf));
+        bitpos = 0;
+
+#define PUT_BITS(value,nbits) \
+        for (n=(nbits)-1; n>=0; n--, bitpos++) \
+                if (((value)>>n)&1) buf[bitpos>>3] |= 0x80>>(bitpos&7)
+
+        PUT_BITS(0x4,4);
+        PUT_BITS(len,count_bits);
+        for (i=0; i<len; i++) {
+                PUT_BITS(data[i],8);
+        }
+#undef PUT_BITS
+
+        bitpos += 4;    /*terminator*/
+        bitpos = (bitpos+7)&~7;
+
+        for (i=bitpos/8; i<data_codewords; i++)
+                buf[i] = ((i-bitpos/8)%2==0) ? 0xec : 0x11;
+
+        /*split in blocks, interleave data and error correction codewords*/
+        nshort = v->blocks - data_codewords%v->blocks;
+        short_len = data_codewords/v->blocks;
+
+        n = 0;
+        for (i=0; i<=short_len; i++) {
+                int offset = 0;
+
+                for (j=0; j<v->blocks; j++) {
+                        int blen = short_len + (j>=nshort);
+
+                        if (i<blen)
+                                codewords[n++] = buf[offset+i];
+                        offset += blen;
+                }
+        }
+
+        for (i=0, j=0; j<v->blocks; j++) {
+                int blen = short_len + (j>=nshort);
+
+                rs_encode(buf+i,blen,v->ec_codewords,ec);
+                for (n=0; n<v->ec_codewords; n++)
+                        codewords[data_codewords + n*v->blocks + j] = ec[n];
+                i += blen;
+        }
+
+        /*draw symbol*/
+        memset(&qr,0,sizeof(qr));
+        qr.size = 17+4*version;
+
+        qr_draw_functions(&qr,version);
+        qr_draw_codewords(&qr,codewords,v->codewords);
+
+        /*select mask with lowest penalty*/
+        best_mask = 0;
+        best_penalty = -1;
+
+        for (mask=0; mask<8; mask++) {
+                int penalty;
+
+                qr_apply_mask(&qr,mask);
+                qr_draw_format(&qr,mask);
+                penalty = qr_penalty(&qr);
+                qr_apply_mask(&qr,mask);
+
+                if (best_penalty<0 || penalty<best_penalty) {
+                        best_penalty = penalty;
+                        best_mask = mask;
+                }
+        }
+
+        qr_apply_mask(&qr,best_mask);
+        qr_draw_format(&qr,best_mask);
+
+        for (i=0; i<qr.size*qr.size; i++)
+                matrix[i] = qr.m[i] & QR_MODULE_DARK;
+
+        return qr.size;
+}
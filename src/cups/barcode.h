@@ -0,0 +1,54 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : barcode.h
+* DESCRIPTION   : Barcode and QR code encoders
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#ifndef _BARCODE_H
+#define _BARCODE_H
+
+/*linear symbologies*/
+typedef enum {
+        BARCODE_INVALID         = -1,
+        BARCODE_CODE39          = 0,
+        BARCODE_CODE128         = 1,
+        BARCODE_EAN13           = 2,
+        BARCODE_EAN8            = 3,
+        BARCODE_UPCA            = 4
+} barcode_type_t;
+
+#define BARCODE_MODULES_MAX     2048    /*modules*/
+
+#define QR_VERSION_MAX          10
+#define QR_SIZE_MAX             (17+4*QR_VERSION_MAX)   /*modules*/
+
+int     barcode_get_type(const char *name);
+int     barcode_encode(int type,const char *data,unsigned char *modules,int max);
+
+int     qr_encode(const unsigned char *data,int len,unsigned char *matrix);
+
+#endif /*_BARCODE_H*/
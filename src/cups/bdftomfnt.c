@@ -0,0 +1,295 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : bdftomfnt.c
+*
+* DESCRIPTION   : Convert BDF bitmap font into host font file used by
+*                 texttomartel (hostfont option)
+*                 BDF encodings are taken as unicode code points, so the
+*                 source font should be an ISO10646 one
+*
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bmfont.h"
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+#define LINE_MAX_SIZE   512             /*bytes*/
+#define GLYPH_WIDTH_MAX 1024            /*dots*/
+
+typedef struct {
+        uint32_t        code;
+        int             width;          /*dots*/
+        int             advance;        /*dots*/
+        unsigned char * strip;
+} glyph_t;
+
+static glyph_t *        glyphs;
+static int              num_glyphs;
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  compare_glyphs
+Purpose   :  qsort() callback ordering glyphs by code point
+Inputs    :  a, b : glyphs
+Outputs   :  <>
+Return    :  <0, 0 or >0
+-----------------------------------------------------------------------------*/
+static int compare_glyphs(const void *a,const void *b)
+{
+        const glyph_t *ga = a;
+        const glyph_t *gb = b;
+
+        return (ga->code>gb->code) - (ga->code<gb->code);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  put_le16 / put_le32
+Purpose   :  Write little endian value
+Inputs    :  f : output file
+             v : value
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void put_le16(FILE *f,uint32_t v)
+{
+        putc(v&0xff,f);
+        putc((v>>8)&0xff,f);
+}
+
+static void put_le32(FILE *f,uint32_t v)
+{
+        put_le16(f,v&0xffff);
+        put_le16(f,v>>16);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  read_bdf
+Purpose   :  Read BDF font and render glyphs into font height strips
+Inputs    :  f : BDF file
+             height : font height in dotlines (output)
+Outputs   :  Fills glyph array
+Return    :  0 if successful, -1 on error
+-----------------------------------------------------------------------------*/
+static int read_bdf(FILE *f,int *height)
+{
+        char line[LINE_MAX_SIZE];
+        int fbb_h = 0, fbb_yoff = 0, ascent = 0;
+        int fbb_w;
+        long code = -1;
+        int advance = 0;
+        int bbx_w = 0, bbx_h = 0, bbx_x = 0, bbx_y = 0;
+        int row = -1;
+        glyph_t *g = NULL;
+        int allocated = 0;
+
+        while (fgets(line,sizeof(line),f)!=NULL) {
+                if (sscanf(line,"FONTBOUNDINGBOX %d %d %*d %d",&fbb_w,&fbb_h,&fbb_yoff)==3) {
+                        ascent = fbb_h+fbb_yoff;
+                }
+                else if (strncmp(line,"STARTCHAR",9)==0) {
+                        code = -1;
+                        advance = 0;
+                        bbx_w = bbx_h = bbx_x = bbx_y = 0;
+                }
+                else if (sscanf(line,"ENCODING %ld",&code)==1) {
+                }
+                else if (sscanf(line,"DWIDTH %d",&advance)==1) {
+                }
+                else if (sscanf(line,"BBX %d %d %d %d",&bbx_w,&bbx_h,&bbx_x,&bbx_y)==4) {
+                }
+                else if (strncmp(line,"BITMAP",6)==0) {
+                        int width;
+
+                        if (fbb_h<=0)
+                                return -1;
+
+                        /*glyphs without code point are skipped*/
+                        if (code<0) {
+                                g = NULL;
+                                row = 0;
+                                continue;
+                        }
+
+                        if (bbx_x<0)
+                                bbx_x = 0;
+                        width = bbx_x+bbx_w;
+                        if (width>GLYPH_WIDTH_MAX)
+                                return -1;
+
+                        if (num_glyphs==allocated) {
+                                allocated = allocated ? 2*allocated : 256;
+                                glyphs = realloc(glyphs,allocated*sizeof(glyph_t));
+                                if (glyphs==NULL)
+                                        return -1;
+                        }
+
+                        g = &glyphs[num_glyphs++];
+                        g->code = code;
+                        g->width = width;
+                        g->advance = advance;
+                        g->strip = calloc(fbb_h,(width+7)/8 ? (width+7)/8 : 1);
+                        if (g->strip==NULL)
+                                return -1;
+
+                        row = 0;
+                }
+                else if (strncmp(line,"ENDCHAR",7)==0) {
+                        g = NULL;
+                        row = -1;
+                }
+                else if (row>=0 && g!=NULL) {
+                        /*BITMAP row, top row of glyph box is first*/
+                        int y = ascent-(bbx_y+bbx_h)+row;
+                        int row_bytes = (g->width+7)/8;
+                        int x;
+
+                        row++;
+
+                        if (y<0 || y>=fbb_h)
+                                continue;
+
+                        for (x=0; x<bbx_w; x++) {
+                                int nibble;
+                                char c = line[x/4];
+
+                                if (c>='0' && c<='9')
+                                        nibble = c-'0';
+                                else if (c>='A' && c<='F')
+                                        nibble = c-'A'+10;
+                                else if (c>='a' && c<='f')
+                                        nibble = c-'a'+10;
+                                else
+                                        break;
+
+                                if (nibble & (8>>(x%4))) {
+                                        int dx = bbx_x+x;
+                                        g->strip[y*row_bytes+dx/8] |= 0x80>>(dx%8);
+                                }
+                        }
+                }
+        }
+
+        *height = fbb_h;
+
+        return (fbb_h>0 && num_glyphs>0) ? 0 : -1;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  write_mfnt
+Purpose   :  Write host font file
+Inputs    :  f : output file
+             height : font height in dotlines
+Outputs   :  <>
+Return    :  0 if successful, -1 on error
+-----------------------------------------------------------------------------*/
+static int write_mfnt(FILE *f,int height)
+{
+        uint32_t offset;
+        int i,j;
+
+        qsort(glyphs,num_glyphs,sizeof(glyph_t),compare_glyphs);
+
+        /*keep first glyph of duplicated code points*/
+        for (i=1, j=1; i<num_glyphs; i++)
+                if (glyphs[i].code!=glyphs[j-1].code)
+                        glyphs[j++] = glyphs[i];
+        num_glyphs = j;
+
+        fwrite(MFNT_MAGIC,4,1,f);
+        put_le16(f,MFNT_VERSION);
+        put_le16(f,height);
+        put_le32(f,num_glyphs);
+        put_le32(f,0);
+
+        offset = sizeof(mfnt_header_t) + num_glyphs*sizeof(mfnt_glyph_t);
+
+        for (i=0; i<num_glyphs; i++) {
+                put_le32(f,glyphs[i].code);
+                put_le16(f,glyphs[i].width);
+                put_le16(f,glyphs[i].advance);
+                put_le32(f,offset);
+
+                offset += height*((glyphs[i].width+7)/8);
+        }
+
+        for (i=0; i<num_glyphs; i++)
+                fwrite(glyphs[i].strip,height*((glyphs[i].width+7)/8),1,f);
+
+        return ferror(f) ? -1 : 0;
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  main
+Purpose   :  Program main function
+Inputs    :  argc : number of command-line arguments (including program name)
+             argv : array of command-line arguments
+Outputs   :  <>
+Return    :  0 if successful, 1 if program failed
+-----------------------------------------------------------------------------*/
+int main(int argc,char **argv)
+{
+        FILE *in;
+        FILE *out;
+        int height;
+
+        if (argc!=3) {
+                fputs("usage: bdftomfnt font.bdf font.mfnt\n",stderr);
+                return 1;
+        }
+
+        if ((in = fopen(argv[1],"r"))==NULL) {
+                perror(argv[1]);
+                return 1;
+        }
+
+        if (read_bdf(in,&height)<0) {
+                fprintf(stderr,"%s: invalid BDF font\n",argv[1]);
+                return 1;
+        }
+
+        fclose(in);
+
+        if ((out = fopen(argv[2],"wb"))==NULL) {
+                perror(argv[2]);
+                return 1;
+        }
+
+        if (write_mfnt(out,height)<0 || fclose(out)!=0) {
+                perror(argv[2]);
+                return 1;
+        }
+
+        return 0;
+}
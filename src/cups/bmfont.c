@@ -0,0 +1,325 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : bmfont.c
+* DESCRIPTION   : Host bitmap font renderer
+*                 Fonts are memory mapped, text lines are rendered directly
+*                 into dotlines sent as graphics bands
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "bmfont.h"
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+#define REPLACEMENT_CHAR        0xfffd
+#define TAB_STOP                8               /*spaces*/
+
+/*glyph placed on current line*/
+typedef struct {
+        const mfnt_glyph_t *    glyph;
+        int                     x;              /*dots*/
+} placed_glyph_t;
+
+#define LINE_GLYPHS_MAX         (DOTLINE_BYTES_MAX*8)
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  utf8_decode
+Purpose   :  Decode next UTF-8 character
+             Malformed sequences decode as one replacement character per byte
+Inputs    :  text : text pointer
+             end : end of text
+Outputs   :  text pointer is moved past decoded character
+Return    :  code point
+-----------------------------------------------------------------------------*/
+static uint32_t utf8_decode(const unsigned char **text,const unsigned char *end)
+{
+        const unsigned char *p = *text;
+        uint32_t code;
+        int n,i;
+
+        if (p[0]<0x80) {
+                *text = p+1;
+                return p[0];
+        }
+        else if ((p[0]&0xe0)==0xc0) {
+                code = p[0]&0x1f;
+                n = 1;
+        }
+        else if ((p[0]&0xf0)==0xe0) {
+                code = p[0]&0x0f;
+                n = 2;
+        }
+        else if ((p[0]&0xf8)==0xf0) {
+                code = p[0]&0x07;
+                n = 3;
+        }
+        else {
+                *text = p+1;
+                return REPLACEMENT_CHAR;
+        }
+
+        if (end-p<=n) {
+                *text = p+1;
+                return REPLACEMENT_CHAR;
+        }
+
+        for (i=1; i<=n; i++) {
+                if ((p[i]&0xc0)!=0x80) {
+                        *text = p+1;
+                        return REPLACEMENT_CHAR;
+                }
+                code = code<<6 | (p[i]&0x3f);
+        }
+
+        *text = p+n+1;
+
+        return code;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  render_line
+Purpose   :  Render placed glyphs as font height dotlines
+Inputs    :  font : font structure
+             line : placed glyphs
+             n : number of placed glyphs
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void render_line(const bmfont_t *font,const placed_glyph_t *line,int n)
+{
+        const unsigned char *base = font->map;
+        unsigned char dotline[DOTLINE_BYTES_MAX+1];
+        int height = font->header->height;
+        int row,i,j;
+
+        for (row=0; row<height; row++) {
+                memset(dotline,0,sizeof(dotline));
+
+                for (i=0; i<n; i++) {
+                        const mfnt_glyph_t *g = line[i].glyph;
+                        int row_bytes = (g->width+7)/8;
+                        const unsigned char *strip = base + g->offset + row*row_bytes;
+                        int byte = line[i].x/8;
+                        int shift = line[i].x%8;
+
+                        /*glyphs are placed inside printer width, so one
+                         *spare byte is enough for the shifted tail*/
+                        for (j=0; j<row_bytes; j++) {
+                                dotline[byte+j] |= strip[j]>>shift;
+                                if (shift)
+                                        dotline[byte+j+1] |= strip[j]<<(8-shift);
+                        }
+                }
+
+                write_dotline(dotline,printer_width);
+        }
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  bmfont_open
+Purpose   :  Map font file in memory and check its layout
+Inputs    :  path : font file name
+Outputs   :  <>
+Return    :  font structure or NULL on error
+-----------------------------------------------------------------------------*/
+bmfont_t *bmfont_open(const char *path)
+{
+        bmfont_t *font;
+        const mfnt_header_t *h;
+        struct stat st;
+        void *map;
+        size_t table_end;
+        int fd;
+        int i;
+
+        if ((fd = open(path,O_RDONLY))<0)
+                return NULL;
+
+        if (fstat(fd,&st)<0 || st.st_size<sizeof(mfnt_header_t)) {
+                close(fd);
+                return NULL;
+        }
+
+        map = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+        close(fd);
+
+        if (map==MAP_FAILED)
+                return NULL;
+
+        if ((font = malloc(sizeof(bmfont_t)))==NULL) {
+                munmap(map,st.st_size);
+                return NULL;
+        }
+
+        font->map = map;
+        font->size = st.st_size;
+        font->header = h = map;
+        font->glyphs = (const mfnt_glyph_t *)(h+1);
+
+        /*check header and glyph table once, rendering trusts them*/
+        table_end = sizeof(mfnt_header_t) + (size_t)h->num_glyphs*sizeof(mfnt_glyph_t);
+
+        if (memcmp(h->magic,MFNT_MAGIC,4)!=0 || h->version!=MFNT_VERSION
+                        || h->height==0 || table_end>font->size) {
+                bmfont_close(font);
+                return NULL;
+        }
+
+        for (i=0; i<h->num_glyphs; i++) {
+                const mfnt_glyph_t *g = &font->glyphs[i];
+                size_t strip_size = (size_t)h->height*((g->width+7)/8);
+
+                if (g->offset<table_end || g->offset+strip_size>font->size
+                                || g->width>DOTLINE_BYTES_MAX*8
+                                || (i>0 && g->code<=font->glyphs[i-1].code)) {
+                        bmfont_close(font);
+                        return NULL;
+                }
+        }
+
+        madvise(map,st.st_size,MADV_WILLNEED);
+
+        return font;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  bmfont_close
+Purpose   :  Unmap font file
+Inputs    :  font : font structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void bmfont_close(bmfont_t *font)
+{
+        munmap(font->map,font->size);
+        free(font);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  bmfont_find_glyph
+Purpose   :  Find glyph of given code point (binary search in glyph table)
+Inputs    :  font : font structure
+             code : unicode code point
+Outputs   :  <>
+Return    :  glyph or NULL if font has no glyph for this code point
+-----------------------------------------------------------------------------*/
+const mfnt_glyph_t *bmfont_find_glyph(const bmfont_t *font,uint32_t code)
+{
+        int lo = 0;
+        int hi = font->header->num_glyphs-1;
+
+        while (lo<=hi) {
+                int mid = (lo+hi)/2;
+
+                if (font->glyphs[mid].code==code)
+                        return &font->glyphs[mid];
+                else if (font->glyphs[mid].code<code)
+                        lo = mid+1;
+                else
+                        hi = mid-1;
+        }
+
+        return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  bmfont_write_line
+Purpose   :  Render one UTF-8 text line and write it as dotlines
+             Text wraps at printer width. Characters missing from the font
+             are replaced by U+FFFD or '?', and skipped if neither exists.
+             Graphics band is left open so that consecutive lines share
+             bands, caller uses flush_dotlines() when done.
+Inputs    :  font : font structure
+             text : UTF-8 text (without line terminator)
+             len : text size in bytes
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void bmfont_write_line(const bmfont_t *font,const char *text,int len)
+{
+        placed_glyph_t line[LINE_GLYPHS_MAX];
+        const unsigned char *p = (const unsigned char *)text;
+        const unsigned char *end = p+len;
+        const mfnt_glyph_t *space;
+        int width = printer_width*8;
+        int n = 0;
+        int x = 0;
+
+        space = bmfont_find_glyph(font,' ');
+
+        while (p<end) {
+                const mfnt_glyph_t *g;
+                uint32_t code = utf8_decode(&p,end);
+
+                if (code=='\r')
+                        continue;
+
+                if (code=='\t') {
+                        if (space!=NULL && space->advance!=0) {
+                                int stop = TAB_STOP*space->advance;
+                                x = (x/stop+1)*stop;
+                        }
+                        continue;
+                }
+
+                if ((g = bmfont_find_glyph(font,code))==NULL
+                                && (g = bmfont_find_glyph(font,REPLACEMENT_CHAR))==NULL
+                                && (g = bmfont_find_glyph(font,'?'))==NULL)
+                        continue;
+
+                /*wrap when glyph does not fit*/
+                if (x+g->width>width || n==LINE_GLYPHS_MAX) {
+                        render_line(font,line,n);
+                        n = 0;
+                        x = 0;
+
+                        if (g->width>width)
+                                continue;
+                }
+
+                line[n].glyph = g;
+                line[n].x = x;
+                n++;
+
+                x += g->advance;
+        }
+
+        render_line(font,line,n);
+}
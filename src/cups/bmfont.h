@@ -0,0 +1,74 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : bmfont.h
+* DESCRIPTION   : Host bitmap font renderer
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#ifndef _BMFONT_H
+#define _BMFONT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*font file layout (all values little endian)
+ *
+ *      header          mfnt_header_t
+ *      glyph table     num_glyphs x mfnt_glyph_t, sorted by code point
+ *      glyph strips    height rows of (width+7)/8 bytes each, leftmost
+ *                      dot in most significant bit, same as a dotline
+ */
+#define MFNT_MAGIC              "MFNT"
+#define MFNT_VERSION            1
+
+typedef struct {
+        char            magic[4];
+        uint16_t        version;
+        uint16_t        height;         /*dotlines*/
+        uint32_t        num_glyphs;
+        uint32_t        reserved;
+} mfnt_header_t;
+
+typedef struct {
+        uint32_t        code;           /*unicode code point*/
+        uint16_t        width;          /*dots*/
+        uint16_t        advance;        /*dots*/
+        uint32_t        offset;         /*strip offset from start of file*/
+} mfnt_glyph_t;
+
+typedef struct {
+        void *                  map;
+        size_t                  size;
+        const mfnt_header_t *   header;
+        const mfnt_glyph_t *    glyphs;
+} bmfont_t;
+
+bmfont_t *              bmfont_open(const char *path);
+void                    bmfont_close(bmfont_t *font);
+const mfnt_glyph_t *    bmfont_find_glyph(const bmfont_t *font,uint32_t code);
+void                    bmfont_write_line(const bmfont_t *font,const char *text,int len);
+
+#endif /*_BMFONT_H*/
@@ -30,9 +30,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <strings.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <cups/cups.h>
 #include <cups/raster.h>
@@ -55,6 +61,7 @@ int     prbaudrate;
 int     prhandshake;
 int     parmode;
 int     prtimeout;
+int     fastdrain;
 int     dynadiv;                /*black bytes*/
 int     maxspeed;               /*mm/s*/
 int     intensity;              /*%*/
@@ -63,9 +70,194 @@ int     process;
 int     finalcut;
 int     fwdfeed;                /*dotlines*/
 int     backfeed;               /*dotlines*/
+char *  hostfont;               /*host font file or NULL*/
+int     optimize;
+int     direct;
+
+/*direct mode: commands are written to printer port a band at a time, so
+ *that encoding waits while the port is flow controlled*/
+void *  direct_port;
+
+#define DIRECT_BUFSIZE  (2+BAND_HEIGHT*DOTLINE_ENCODED_MAX+1)
+
+static unsigned char    direct_buf[DIRECT_BUFSIZE];
+static int              direct_len;
+
+/*PPD options read by get_options()*/
+typedef enum {
+        OPT_INT,
+        OPT_BOOL
+} opt_type_t;
+
+static const struct {
+        const char *    keyword;
+        int *           value;
+        opt_type_t      type;
+} ppd_options[] = {
+        {"prbaudrate",  &prbaudrate,    OPT_INT},
+        {"prhandshake", &prhandshake,   OPT_INT},
+        {"prtimeout",   &prtimeout,     OPT_INT},
+        {"fastdrain",   &fastdrain,     OPT_BOOL},
+        {"dynadiv",     &dynadiv,       OPT_INT},
+        {"maxspeed",    &maxspeed,      OPT_INT},
+        {"intensity",   &intensity,     OPT_INT},
+        {"font",        &font,          OPT_INT},
+        {"process",     &process,       OPT_BOOL},
+        {"fwdfeed",     &fwdfeed,       OPT_INT},
+        {"backfeed",    &backfeed,      OPT_INT},
+        {"optimize",    &optimize,      OPT_BOOL},
+        {"direct",      &direct,        OPT_BOOL}
+};
+
+#define NUM_PPD_OPTIONS (sizeof(ppd_options)/sizeof(ppd_options[0]))
+
+/*options cache: resolved option values for a PPD file and the job options
+ *overriding PPD options, so that filters do not parse the PPD file for
+ *every job*/
+#define OPTIONS_CACHE_DIR       "/var/cache/cups"
+#define OPTIONS_CACHE_PREFIX    "martel-options-"
+#define OPTIONS_CACHE_MAGIC     0x4d4f5054      /*MOPT*/
+#define OPTIONS_CACHE_VERSION   2
+#define OPTIONS_KEY_MAX         (PATH_MAX+1024)
+
+typedef struct {
+        unsigned int    magic;
+        unsigned int    version;
+        unsigned int    num_options;
+        /*PPD file identity*/
+        dev_t           dev;
+        ino_t           ino;
+        off_t           size;
+        time_t          mtime;
+        long            mtime_nsec;
+        /*printer configuration and option values*/
+        int             model;
+        int             type;
+        int             width;
+        int             values[NUM_PPD_OPTIONS];
+        /*key (PPD path and job options) follows, including trailing zero*/
+        int             key_len;
+} options_cache_t;
+
+/*graphics band currently written*/
+static int      band_line;              /*dotlines already in band*/
+
+#define BLACK   1
+#define WHITE   0
+
+static unsigned char bit_no[8] =
+                {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
 
 /* PRIVATE FUNCTIONS --------------------------------------------------------*/
 
+/*-----------------------------------------------------------------------------
+Name      :  consecutive_bits
+Purpose   :  count no of consecutive bit the same colour
+Inputs    :  bitmap : dotline buffer
+             bit_ptr : first bit to look at
+             max_bytes : width of dotline in bytes
+Outputs   :  <>
+Return    :  count of pixels or bit image
+-----------------------------------------------------------------------------*/
+static unsigned char consecutive_bits(const unsigned char *bitmap, int bit_ptr, int max_bytes)
+{
+        int i, j = bit_ptr;
+        int bit_clr;
+        unsigned char bits;
+
+        if ( bitmap[j / 8] & bit_no[j & 7])
+                bit_clr = BLACK;
+        else
+                bit_clr = WHITE;
+        for ( i = 0; (j < (max_bytes * 8)) && (i < 63); j++, i++ )
+        {
+                if ((( bitmap[j / 8] & bit_no[j & 7]) && (bit_clr == WHITE))
+                || (!( bitmap[j / 8] & bit_no[j & 7]) && (bit_clr == BLACK)))
+                        break; /* consecutive bits no longer the same */
+        }
+        if (i > 7)
+        {
+                switch (bit_clr)
+                {
+                        case BLACK:
+                                bits = 0x40 | i;
+                                break;
+                        default:
+                                bits = 0x00 | i;
+                                break;
+                }
+        }
+        else /* 7 bit bit map */
+        {
+                unsigned char bit_mask = 0x40;
+
+                bits = 0x80;
+                for (i = 0; i < 7; i++)
+                {
+                        if ((bit_ptr + i) < (max_bytes * 8)
+                        && ( bitmap[(bit_ptr + i) / 8] & bit_no[(bit_ptr + i) & 7]))
+                        {
+                                bits  |= bit_mask;
+                        }
+                        bit_mask >>= 1;
+                }
+        }
+        return(bits);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  convert_to_rle
+Purpose   :  Converts a dotline bit map to Martel Run Length Encoded bit
+             image gaphics
+             d7 d6 d5 d4 d3 d2 d1 d0
+             0  0  x  x  x  x  x  x RLE white pixels (0 to 63)
+             0  1  x  x  x  x  x  x RLE black pixels (0 to 63)
+             1  x  x  x  x  x  x  x Seven bit image pixels (0=white, 1=black)
+Inputs    :  bmp_in : dotline buffer
+             bytes_in : width of dotline in bytes
+Outputs   :  rle_out : converted line (at least 2*bytes_in bytes)
+Return    :  width of converted line in bytes
+-----------------------------------------------------------------------------*/
+static int convert_to_rle(const unsigned char *bmp_in, int bytes_in, unsigned char *rle_out)
+{
+        int bit_ptr;            /* start at bit zero (MSB), byte zero */
+        unsigned char bits;
+        int bytes_out;
+        int i, j;
+
+        bytes_out = 0;
+
+        /* check for blank line */
+        for (i = 0, j = 0; i < bytes_in; i++)
+        {
+                if (bmp_in[i])
+                {
+                        j = 1;
+                        break;
+                }
+        }
+        if (!j) /* no dots found so exit early */
+        {
+                rle_out[0] = 0;
+                return(1);
+        }
+
+        for (bit_ptr = 0; bit_ptr < (bytes_in * 8); )
+        {
+                bits = consecutive_bits(bmp_in, bit_ptr, bytes_in);
+                if (bits & 0x80) /* 7 bit image byte */
+                {
+                        bit_ptr += 7;
+                }
+                else /* RLE byte */
+                {
+                        bit_ptr += (bits & 0x3f);
+                }
+                rle_out[bytes_out++] = bits;
+        }
+        return(bytes_out);
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  get_opt_int
 Purpose   :  Retrieve option value as an integer
@@ -109,7 +301,182 @@ static int get_opt_bool(ppd_file_t *ppd,const char *keyword)
         else
                 return -1;
 }
- 
+
+/*-----------------------------------------------------------------------------
+Name      :  options_key
+Purpose   :  Build options cache key from PPD path and job options which
+             override PPD options, other job options do not change the
+             resolved values
+Inputs    :  ppd_path : PPD file path
+             num_options : number of job options
+             options : job options
+             key : key buffer
+             size : key buffer size (includes trailing zero)
+Outputs   :  Fills key buffer
+Return    :  key length or -1 if key does not fit in buffer
+-----------------------------------------------------------------------------*/
+static int options_key(const char *ppd_path,int num_options,cups_option_t *options,
+                       char *key,int size)
+{
+        int len;
+        int i,j;
+
+        len = snprintf(key,size,"%s\n",ppd_path);
+        if (len>=size)
+                return -1;
+
+        for (i=0; i<NUM_PPD_OPTIONS; i++) {
+                for (j=0; j<num_options; j++) {
+                        if (strcasecmp(options[j].name,ppd_options[i].keyword)!=0)
+                                continue;
+                        len += snprintf(key+len,size-len,"%s=%s\n",
+                                        ppd_options[i].keyword,options[j].value);
+                        if (len>=size)
+                                return -1;
+                }
+        }
+
+        return len;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  options_cache_path
+Purpose   :  Build path of options cache file for key
+Inputs    :  key : options cache key
+             path : path buffer
+             size : path buffer size (includes trailing zero)
+Outputs   :  Fills path buffer
+Return    :  0 if successful, -1 on error
+-----------------------------------------------------------------------------*/
+static int options_cache_path(const char *key,char *path,int size)
+{
+        unsigned int hash = 2166136261u;
+        const char *dir;
+        const char *c;
+
+        /*FNV-1a*/
+        for (c=key; *c; c++) {
+                hash ^= (unsigned char)*c;
+                hash *= 16777619u;
+        }
+
+        if ((dir = getenv("CUPS_CACHEDIR"))==NULL)
+                dir = OPTIONS_CACHE_DIR;
+
+        if (snprintf(path,size,"%s/" OPTIONS_CACHE_PREFIX "%08x",dir,hash)>=size)
+                return -1;
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  load_options_cache
+Purpose   :  Retrieve printer configuration and options from cache file
+Inputs    :  path : cache file path
+             st : PPD file status
+             key : options cache key
+             key_len : key length
+Outputs   :  Sets printer configuration and options
+Return    :  0 if cache is valid, -1 otherwise
+-----------------------------------------------------------------------------*/
+static int load_options_cache(const char *path,const struct stat *st,
+                              const char *key,int key_len)
+{
+        const options_cache_t *cache;
+        struct stat cst;
+        void *map;
+        int valid;
+        int fd;
+        int i;
+
+        if ((fd = open(path,O_RDONLY))<0)
+                return -1;
+
+        if (fstat(fd,&cst)<0 || cst.st_size!=sizeof(options_cache_t)+key_len+1) {
+                close(fd);
+                return -1;
+        }
+
+        map = mmap(NULL,cst.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+        close(fd);
+        if (map==MAP_FAILED)
+                return -1;
+
+        cache = map;
+        valid = cache->magic==OPTIONS_CACHE_MAGIC
+                && cache->version==OPTIONS_CACHE_VERSION
+                && cache->num_options==NUM_PPD_OPTIONS
+                && cache->dev==st->st_dev
+                && cache->ino==st->st_ino
+                && cache->size==st->st_size
+                && cache->mtime==st->st_mtim.tv_sec
+                && cache->mtime_nsec==st->st_mtim.tv_nsec
+                && cache->key_len==key_len
+                && memcmp(cache+1,key,key_len+1)==0;
+
+        if (valid) {
+                printer_model = cache->model;
+                printer_type = cache->type;
+                printer_width = cache->width;
+                for (i=0; i<NUM_PPD_OPTIONS; i++)
+                        *ppd_options[i].value = cache->values[i];
+        }
+
+        munmap(map,cst.st_size);
+
+        return valid ? 0 : -1;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  save_options_cache
+Purpose   :  Store printer configuration and options in cache file
+             File is written under a temporary name and renamed, so that
+             concurrent filters never see a partial file
+Inputs    :  path : cache file path
+             st : PPD file status
+             key : options cache key
+             key_len : key length
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void save_options_cache(const char *path,const struct stat *st,
+                               const char *key,int key_len)
+{
+        options_cache_t cache;
+        char tmp[PATH_MAX];
+        int ok;
+        int fd;
+        int i;
+
+        if (snprintf(tmp,sizeof(tmp),"%s.%d",path,(int)getpid())>=sizeof(tmp))
+                return;
+
+        memset(&cache,0,sizeof(cache));
+        cache.magic = OPTIONS_CACHE_MAGIC;
+        cache.version = OPTIONS_CACHE_VERSION;
+        cache.num_options = NUM_PPD_OPTIONS;
+        cache.dev = st->st_dev;
+        cache.ino = st->st_ino;
+        cache.size = st->st_size;
+        cache.mtime = st->st_mtim.tv_sec;
+        cache.mtime_nsec = st->st_mtim.tv_nsec;
+        cache.model = printer_model;
+        cache.type = printer_type;
+        cache.width = printer_width;
+        for (i=0; i<NUM_PPD_OPTIONS; i++)
+                cache.values[i] = *ppd_options[i].value;
+        cache.key_len = key_len;
+
+        if ((fd = open(tmp,O_WRONLY|O_CREAT|O_EXCL,0644))<0)
+                return;
+
+        ok = write(fd,&cache,sizeof(cache))==sizeof(cache)
+             && write(fd,key,key_len+1)==key_len+1;
+
+        if (close(fd)<0 || !ok || rename(tmp,path)<0)
+                unlink(tmp);
+}
+
 /* PUBLIC FUNCTIONS ---------------------------------------------------------*/
 
 /*-----------------------------------------------------------------------------
@@ -126,12 +493,28 @@ void error(const char *s)
         exit(1);
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  check
+Purpose   :  Check return code of MARTEL library function and exit on error
+Inputs    :  errnum : function return code
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void check(int errnum)
+{
+        if (errnum<0) {
+                error(martel_strerror(errnum));
+        }
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  get_options
 
 Purpose   :  Retrieve current printing options
              Retrieve marked options from PPD file
              Override options with command-line string
+             Values are kept in an options cache file and reused until
+             PPD file or overriding job options change
 
 Inputs    :  opt : command-line options
              
@@ -140,26 +523,55 @@ Return    :  <>
 -----------------------------------------------------------------------------*/
 void get_options(const char *opt)
 {
+        const char *ppd_path;
         ppd_file_t *ppd;
         int num_options;
         cups_option_t *options;
+        char key[OPTIONS_KEY_MAX];
+        char path[PATH_MAX];
+        struct stat st;
+        int key_len;
         int errnum;
+        int i;
 
-        /*open printer PPD file and mark options*/
-        ppd = ppdOpenFile(getenv("PPD"));
-        if (ppd==NULL)
-                error("ppdOpenFile failed");
-
-        ppdMarkDefaults(ppd);
+        ppd_path = getenv("PPD");
 
         options = NULL;
         num_options = cupsParseOptions(opt,0,&options);
 
+        /*job options which are not PPD options*/
         if (options!=NULL && num_options!=0) {
-                cupsMarkOptions(ppd,num_options,options);
+                const char *value;
+
+                value = cupsGetOption("hostfont",num_options,options);
+                if (value!=NULL && *value!=0)
+                        hostfont = strdup(value);
+        }
+
+        /*use cached values while PPD file is unchanged*/
+        key_len = -1;
+        if (ppd_path!=NULL && stat(ppd_path,&st)==0)
+                key_len = options_key(ppd_path,num_options,options,key,sizeof(key));
+        if (key_len>=0 && options_cache_path(key,path,sizeof(path))<0)
+                key_len = -1;
+
+        if (key_len>=0 && load_options_cache(path,&st,key,key_len)==0) {
                 cupsFreeOptions(num_options,options);
+                return;
         }
 
+        /*open printer PPD file and mark options*/
+        ppd = ppdOpenFile(ppd_path);
+        if (ppd==NULL)
+                error("ppdOpenFile failed");
+
+        ppdMarkDefaults(ppd);
+
+        if (options!=NULL && num_options!=0)
+                cupsMarkOptions(ppd,num_options,options);
+
+        cupsFreeOptions(num_options,options);
+
         /*retrieve printer configuration*/
         printer_model = ppd->model_number;
         
@@ -176,22 +588,78 @@ void get_options(const char *opt)
                 printer_width = errnum/8;
         
         /*retrieve common options*/
-        prbaudrate      = get_opt_int(ppd,"prbaudrate");
-        prhandshake     = get_opt_int(ppd,"prhandshake");
-        prtimeout       = get_opt_int(ppd,"prtimeout");
-        dynadiv         = get_opt_int(ppd,"dynadiv");
-        maxspeed        = get_opt_int(ppd,"maxspeed");
-        intensity       = get_opt_int(ppd,"intensity");
-        font            = get_opt_int(ppd,"font");
-        process         = get_opt_bool(ppd,"process");
-        fwdfeed         = get_opt_int(ppd,"fwdfeed");
-        backfeed        = get_opt_int(ppd,"backfeed");
+        for (i=0; i<NUM_PPD_OPTIONS; i++) {
+                if (ppd_options[i].type==OPT_BOOL)
+                        *ppd_options[i].value = get_opt_bool(ppd,ppd_options[i].keyword);
+                else
+                        *ppd_options[i].value = get_opt_int(ppd,ppd_options[i].keyword);
+        }
         
         /*retrieve printer-specific options*/
         /*TODO: not implemented!*/
         
         ppdClose(ppd);
 
+        if (key_len>=0)
+                save_options_cache(path,&st,key,key_len);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  write_data
+Purpose   :  Write printer commands to standard output, or to direct mode
+             port buffer
+Inputs    :  buf : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void write_data(const void *buf,int size)
+{
+        if (direct_port==NULL) {
+                fwrite(buf,size,1,stdout);
+                return;
+        }
+
+        if (size>sizeof(direct_buf)) {
+                /*pending commands and large block go out together*/
+                struct iovec iov[2];
+
+                iov[0].iov_base = direct_buf;
+                iov[0].iov_len = direct_len;
+                iov[1].iov_base = (void *)buf;
+                iov[1].iov_len = size;
+
+                check(martel_writev(direct_port,iov,2));
+                direct_len = 0;
+        }
+        else {
+                if (direct_len+size>sizeof(direct_buf))
+                        flush_data();
+
+                memcpy(direct_buf+direct_len,buf,size);
+                direct_len += size;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  flush_data
+Purpose   :  Flush printer commands written so far
+             In direct mode, this blocks until port takes them
+Inputs    :  <>
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void flush_data(void)
+{
+        if (direct_port==NULL) {
+                fflush(stdout);
+                return;
+        }
+
+        if (direct_len) {
+                check(martel_write(direct_port,direct_buf,direct_len));
+                direct_len = 0;
+        }
 }
 
 /*-----------------------------------------------------------------------------
@@ -208,7 +676,7 @@ void write_prolog(void)
         case MARTEL_MCP:
                 if (font!=-1) {
                         unsigned char cmd[3] = {ESC,'!',font % 3};
-                        fwrite(cmd,sizeof(cmd),1,stdout);
+                        write_data(cmd,sizeof(cmd));
                 }
 
                 break;
@@ -216,7 +684,7 @@ void write_prolog(void)
                 break;
         }
 
-        fflush(stdout);
+        flush_data();
 }
 
 /*-----------------------------------------------------------------------------
@@ -233,11 +701,11 @@ void write_epilog(void)
         case MARTEL_MCP:
                 if (fwdfeed!=0) {
                         unsigned char cmd[3] = {ESC,'J',fwdfeed};
-                        fwrite(cmd,sizeof(cmd),1,stdout);
+                        write_data(cmd,sizeof(cmd));
                 }
                 if (backfeed!=0) {
                         unsigned char cmd[3] = {ESC,'j',backfeed};
-                        fwrite(cmd,sizeof(cmd),1,stdout);
+                        write_data(cmd,sizeof(cmd));
                 }
                 break;
         default:
@@ -245,6 +713,95 @@ void write_epilog(void)
                 break;
         }
 
-        fflush(stdout);
+        flush_data();
+}
+
+
+/*-----------------------------------------------------------------------------
+Name      :  encode_dotline
+Purpose   :  Encode one dotline as it is sent inside a graphics band
+             (byte count followed by run length encoded pixels)
+Inputs    :  dotline : dotline buffer
+             num_bytes : width of dotline in bytes
+Outputs   :  buf : encoded dotline (at least DOTLINE_ENCODED_MAX bytes)
+Return    :  size of encoded dotline in bytes
+-----------------------------------------------------------------------------*/
+int encode_dotline(const unsigned char *dotline,int num_bytes,unsigned char *buf)
+{
+        if (num_bytes>printer_width)
+                num_bytes = printer_width;
+
+        buf[0] = convert_to_rle(dotline,num_bytes,buf+1);
+
+        return buf[0]+1;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  write_encoded_dotline
+Purpose   :  Write MARTEL commands to print an encoded dotline
+             Dotlines are grouped in bands of BAND_HEIGHT dotlines. Band
+             header is sent before the first dotline, and band is printed
+             after the last one.
+Inputs    :  buf : encoded dotline (see encode_dotline)
+             size : size of encoded dotline in bytes
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void write_encoded_dotline(const unsigned char *buf,int size)
+{
+        switch (printer_type) {
+        case MARTEL_MPP:
+        case MARTEL_MCP:
+                {
+                        unsigned char cmd[2] = { ESC,'Z' };
+
+                        if (band_line == 0)
+                                write_data(cmd,sizeof(cmd));
+                        write_data(buf,size);
+                        if (++band_line == BAND_HEIGHT) {
+                                write_data("\n",1);
+                                band_line = 0;
+
+                                /*band is complete*/
+                                if (direct_port!=NULL)
+                                        flush_data();
+                        }
+                }
+                break;
+        default:
+                error("unknown model type");
+                break;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  write_dotline
+Purpose   :  Write MARTEL commands to print given dotline
+Inputs    :  dotline : dotline buffer
+             num_bytes : width of dotline in bytes
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void write_dotline(const unsigned char *dotline,int num_bytes)
+{
+        unsigned char buf[DOTLINE_ENCODED_MAX];
+
+        write_encoded_dotline(buf,encode_dotline(dotline,num_bytes,buf));
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  flush_dotlines
+Purpose   :  Complete current graphics band with blank dotlines
+Inputs    :  <>
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void flush_dotlines(void)
+{
+        static const unsigned char blank[2] = { 1, 0 };
+
+        while (band_line != 0)
+                write_encoded_dotline(blank,sizeof(blank));
+
+        flush_data();
+}
@@ -74,16 +74,25 @@ typedef enum {
         FINALCUT_FULL           = 2
 } finalcut_t;
 
+/*prbaudrate option value: detect printer baudrate*/
+#define PRBAUDRATE_AUTO         -2
+
+/*graphics bands*/
+#define BAND_HEIGHT             24              /*dotlines*/
+#define DOTLINE_BYTES_MAX       128             /*bytes*/
+#define DOTLINE_ENCODED_MAX     (2*DOTLINE_BYTES_MAX+1)
+
 /*printer configuration*/
 extern int      printer_model;
 extern int      printer_type;
-extern int      printer_width;          /*dots*/
+extern int      printer_width;          /*bytes*/
 
 /*common options*/
 extern int      prbaudrate;
 extern int      prhandshake;
 extern int      parmode;
 extern int      prtimeout;
+extern int      fastdrain;
 extern int      dynadiv;                /*black bytes*/
 extern int      maxspeed;               /*mm/s*/
 extern int      intensity;              /*%*/
@@ -92,11 +101,25 @@ extern int      process;
 extern int      finalcut;
 extern int      fwdfeed;                /*dotlines*/
 extern int      backfeed;               /*dotlines*/
+extern char *   hostfont;               /*host font file or NULL*/
+extern int      optimize;
+extern int      direct;
+
+/*printer port written by filter in direct mode, NULL if output is stdout*/
+extern void *   direct_port;
 
 void    error(const char *s);
+void    check(int errnum);
 void    get_options(const char *opt);
+void    write_data(const void *buf,int size);
+void    flush_data(void);
 void    write_prolog(void);
 void    write_epilog(void);
 
+int     encode_dotline(const unsigned char *dotline,int num_bytes,unsigned char *buf);
+void    write_encoded_dotline(const unsigned char *buf,int size);
+void    write_dotline(const unsigned char *dotline,int num_bytes);
+void    flush_dotlines(void);
+
 #endif /*_COMMON_H*/
 
@@ -0,0 +1,290 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : history.c
+* DESCRIPTION   : Data written to printer and its safe resume points
+*                 Written data is parsed at command level to find where
+*                 printing can resume after the printer was reset
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <martel/martel.h>
+
+#include "common.h"
+#include "history.h"
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  add_boundary
+Purpose   :  Record resume point, oldest one is dropped when table is full
+Inputs    :  h : history structure
+             pos : stream offset following a command
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void add_boundary(history_t *h,long long pos)
+{
+        boundary_t *b;
+
+        h->last_boundary = (h->last_boundary+1)%HISTORY_BOUNDARIES;
+
+        b = &h->boundaries[h->last_boundary];
+        b->pos = pos;
+        b->font = h->font;
+
+        if (h->num_boundaries<HISTORY_BOUNDARIES)
+                h->num_boundaries++;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  end_band_line
+Purpose   :  Go to next dotline of graphics band
+Inputs    :  h : history structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void end_band_line(history_t *h)
+{
+        h->line++;
+        h->state = (h->line==BAND_HEIGHT) ? PARSE_BAND_END : PARSE_BAND_COUNT;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  parse
+Purpose   :  Parse one byte of stream
+             Command set is the one written by filters. Any other command
+             stops parsing, no resume point is recorded after it.
+Inputs    :  h : history structure
+             c : byte
+             pos : stream offset of byte
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void parse(history_t *h,int c,long long pos)
+{
+        switch (h->state) {
+        case PARSE_TEXT:
+                if (c==ESC) {
+                        h->state = PARSE_ESC;
+                }
+                else if (c==GS || c==FS || c==DLE) {
+                        h->state = PARSE_UNKNOWN;
+                }
+                else if (c==LF) {
+                        h->line_empty = 1;
+                        add_boundary(h,pos+1);
+                }
+                else if (c!=CR) {
+                        h->line_empty = 0;
+                }
+                break;
+
+        case PARSE_ESC:
+                h->cmd = c;
+
+                switch (c) {
+                case '!':
+                case 'J':
+                case 'j':
+                        h->state = PARSE_PARAM;
+                        break;
+                case 'Z':
+                        h->line = 0;
+                        h->state = PARSE_BAND_COUNT;
+                        break;
+                case '@':
+                        h->font = -1;
+                        h->line_empty = 1;
+                        h->state = PARSE_TEXT;
+                        add_boundary(h,pos+1);
+                        break;
+                default:
+                        h->state = PARSE_UNKNOWN;
+                        break;
+                }
+                break;
+
+        case PARSE_PARAM:
+                /*feeds print line buffer*/
+                if (h->cmd=='!')
+                        h->font = c;
+                else
+                        h->line_empty = 1;
+
+                if (h->line_empty)
+                        add_boundary(h,pos+1);
+
+                h->state = PARSE_TEXT;
+                break;
+
+        case PARSE_BAND_COUNT:
+                h->count = c;
+
+                if (h->count==0)
+                        end_band_line(h);
+                else
+                        h->state = PARSE_BAND_DATA;
+                break;
+
+        case PARSE_BAND_DATA:
+                if (--h->count==0)
+                        end_band_line(h);
+                break;
+
+        case PARSE_BAND_END:
+                h->line_empty = 1;
+                h->state = PARSE_TEXT;
+                add_boundary(h,pos+1);
+                break;
+
+        case PARSE_UNKNOWN:
+                break;
+        }
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  history_init
+Purpose   :  Initialize empty history, start of stream is a resume point
+Inputs    :  h : history structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void history_init(history_t *h)
+{
+        h->sent = 0;
+
+        h->state = PARSE_TEXT;
+        h->font = -1;
+        h->line_empty = 1;
+
+        h->num_boundaries = 0;
+        h->last_boundary = -1;
+
+        add_boundary(h,0);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  history_add
+Purpose   :  Append bytes written for the first time
+Inputs    :  h : history structure
+             buf : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void history_add(history_t *h,const unsigned char *buf,int size)
+{
+        int i;
+
+        for (i=0; i<size; i++)
+                parse(h,buf[i],h->sent+i);
+
+        /*only last HISTORY_SIZE bytes are kept*/
+        if (size>HISTORY_SIZE) {
+                h->sent += size-HISTORY_SIZE;
+                buf += size-HISTORY_SIZE;
+                size = HISTORY_SIZE;
+        }
+
+        while (size) {
+                int pos = h->sent%HISTORY_SIZE;
+                int n = HISTORY_SIZE-pos;
+
+                if (n>size)
+                        n = size;
+
+                memcpy(h->buf+pos,buf,n);
+
+                h->sent += n;
+                buf += n;
+                size -= n;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  history_get
+Purpose   :  Get bytes kept from given stream offset
+Inputs    :  h : history structure
+             pos : stream offset
+Outputs   :  buf : data pointer (inside history)
+Return    :  size of contiguous data in bytes (0 if pos is end of stream)
+             or -1 if data at pos is not kept anymore
+-----------------------------------------------------------------------------*/
+int history_get(history_t *h,long long pos,const unsigned char **buf)
+{
+        int start;
+        int n;
+
+        if (pos<h->sent-HISTORY_SIZE || pos>h->sent)
+                return -1;
+
+        start = pos%HISTORY_SIZE;
+        n = h->sent-pos;
+
+        if (n>HISTORY_SIZE-start)
+                n = HISTORY_SIZE-start;
+
+        *buf = h->buf+start;
+
+        return n;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  history_checkpoint
+Purpose   :  Find last resume point taken by printer whose data is still kept
+Inputs    :  h : history structure
+             acked : stream offset of first byte printer has not taken
+Outputs   :  font : font selected at resume point, -1 if default
+Return    :  stream offset of resume point or -1 if none
+-----------------------------------------------------------------------------*/
+long long history_checkpoint(history_t *h,long long acked,int *font)
+{
+        int i;
+
+        for (i=0; i<h->num_boundaries; i++) {
+                boundary_t *b;
+
+                b = &h->boundaries[(h->last_boundary-i+HISTORY_BOUNDARIES)%HISTORY_BOUNDARIES];
+
+                if (b->pos<h->sent-HISTORY_SIZE)
+                        break;
+
+                if (b->pos<=acked) {
+                        *font = b->font;
+                        return b->pos;
+                }
+        }
+
+        return -1;
+}
@@ -0,0 +1,78 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : history.h
+* DESCRIPTION   : Data written to printer and its safe resume points
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#define HISTORY_SIZE            (64*1024)       /*bytes*/
+#define HISTORY_BOUNDARIES      4096
+
+/*command stream parser state*/
+typedef enum {
+        PARSE_TEXT,             /*text or start of command*/
+        PARSE_ESC,              /*ESC received*/
+        PARSE_PARAM,            /*waiting for parameter byte of cmd*/
+        PARSE_BAND_COUNT,       /*waiting for byte count of band dotline*/
+        PARSE_BAND_DATA,        /*inside band dotline*/
+        PARSE_BAND_END,         /*waiting for band terminator*/
+        PARSE_UNKNOWN           /*unknown command, stream not parsed anymore*/
+} parse_state_t;
+
+/*position where printing can resume after a printer reset: between
+ *commands, with nothing left in printer line buffer*/
+typedef struct {
+        long long       pos;            /*stream offset*/
+        int             font;           /*font selected, -1 if default*/
+} boundary_t;
+
+/*last bytes of stream written to printer, positions are absolute stream
+ *offsets: [sent-HISTORY_SIZE,sent) is kept*/
+typedef struct {
+        unsigned char   buf[HISTORY_SIZE];
+        long long       sent;
+
+        parse_state_t   state;
+        int             cmd;            /*command byte after ESC*/
+        int             count;          /*bytes left in band dotline*/
+        int             line;           /*band dotline*/
+        int             font;
+        int             line_empty;     /*printer line buffer is empty*/
+
+        boundary_t      boundaries[HISTORY_BOUNDARIES];
+        int             num_boundaries;
+        int             last_boundary;
+} history_t;
+
+void            history_init(history_t *h);
+void            history_add(history_t *h,const unsigned char *buf,int size);
+int             history_get(history_t *h,long long pos,const unsigned char **buf);
+long long       history_checkpoint(history_t *h,long long acked,int *font);
+
+#endif /*_HISTORY_H*/
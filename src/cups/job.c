@@ -0,0 +1,1180 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : job.c
+* DESCRIPTION   : Job writer: writes job data to printer port, polls printer status,
+*                 resumes after errors and serves CUPS side channel requests
+*                 Used by CUPS backend and by martel-printd job processes
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+
+#include <cups/cups.h>
+#include <cups/sidechannel.h>
+
+#include <martel/martel.h>
+
+#include "common.h"
+#include "spool.h"
+#include "history.h"
+#include "reprint.h"
+#include "job.h"
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+static void *   port;
+static void *   optimizer;
+static spool_t *        spool;
+static int      chunk;
+
+/*file and descriptor ports take job data straight from input inside the
+ *kernel, input is -1 when data goes through spool (see job_read())*/
+static int      input = -1;
+static int      tee_pipe[2] = {-1,-1};  /*copy of data kept for reprint*/
+
+#define SPLICE_COPY             (16*1024)       /*bytes, reprint copy*/
+
+/*data written to printer at once, depends on port type*/
+#define CHUNK_LATENCY           50              /*ms of serial transmission*/
+#define CHUNK_SERIAL_MIN        16              /*bytes*/
+#define CHUNK_USB               (64*64)         /*bytes, 64 bulk packets*/
+#define CHUNK_PARALLEL          1024            /*bytes*/
+#define CHUNK_DEFAULT           (64*1024)       /*bytes*/
+
+/*printer status is polled when port accepts no data for STATUS_INTERVAL*/
+#define STATUS_INTERVAL         1000            /*ms*/
+#define STATUS_TIMEOUT          500             /*ms, answer to status request*/
+#define DRAIN_STEP              100             /*ms*/
+
+/*printer-state-reasons reported to CUPS*/
+#define REASON_MEDIA_EMPTY      0x01
+#define REASON_MEDIA_LOW        0x02
+#define REASON_COVER_OPEN       0x04
+#define REASON_OFFLINE          0x08
+#define REASON_OTHER            0x10
+
+/*reasons that stop printing until cleared*/
+#define REASONS_BLOCKING        (REASON_MEDIA_EMPTY|REASON_COVER_OPEN|REASON_OFFLINE|REASON_OTHER)
+
+static const char *     reason_names[] = {
+        "media-empty-error",
+        "media-low-warning",
+        "cover-open-error",
+        "offline-report",
+        "other-error"
+};
+
+static int              reasons;
+
+/*CUPS side channel, requests are handled whenever backend waits*/
+#define DEVICE_ID_SIZE          256             /*bytes*/
+
+static int              sidechannel;
+static int              in_request;
+
+static void             wait_events(int fd,int timeout);
+
+#define CMD_BUFSIZE     8       /*bytes*/
+
+typedef struct {
+        unsigned char   buf[CMD_BUFSIZE];
+        int             size;
+        int             answer;
+} command_t;
+
+/*stream written to printer is kept in history and written again from
+ *wpos when kernel buffers were flushed (status requests, resume)*/
+static history_t        history;
+static long long        wpos;
+
+/*printer reset and settings written before resuming at a checkpoint*/
+static command_t        resume;
+static int              resume_pos;
+static long long        resume_wpos;    /*stream offset they precede, -1 if none*/
+
+/*cancelled job (SIGTERM): data queued in kernel is discarded and printer
+ *reset, port is given back within CANCEL_TIMEOUT*/
+#define CANCEL_TIMEOUT          500             /*ms*/
+
+static volatile sig_atomic_t    cancelled;
+static struct timespec          cancel_time;
+static int                      cancel_pipe[2] = {-1,-1};
+
+/*settings to revert to when job is cancelled, NULL if port was set up by
+ *another process (see job_print())*/
+static const port_settings_t *  setup_defaults;
+
+static void                     abort_job(void);
+
+/*jobs written to printer are kept for reprint, NULL if ring file could
+ *not be opened*/
+static reprint_t *      reprint;
+
+/*source of data written by send_data()*/
+typedef enum {
+        FROM_RESUME,
+        FROM_HISTORY,
+        FROM_JOB
+} source_t;
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  cmd_reset
+Purpose   :  Build 'reset' command based on printer type
+Inputs    :  cmd : command structure
+Outputs   :  Fills command structure
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int cmd_reset(command_t *cmd)
+{
+        martel_error_t errnum;
+
+        errnum = MARTEL_OK;
+
+        switch (printer_type) {
+        case MARTEL_MPP:
+        case MARTEL_MCP:
+                cmd->size = 2;
+                cmd->answer = 0;
+                cmd->buf[0] = ESC;
+                cmd->buf[1] = '@';
+                break;
+        default:
+                errnum = MARTEL_INVALID_MODEL_TYPE;
+                break;
+        }
+
+        return errnum;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  get_chunk_size
+Purpose   :  Get size of data written to printer at once
+             Serial chunks take about CHUNK_LATENCY ms to transmit, so that
+             the printer is fed as soon as data comes in. USB chunks are
+             made of whole bulk packets.
+Inputs    :  <>
+Outputs   :  <>
+Return    :  chunk size in bytes
+-----------------------------------------------------------------------------*/
+static int get_chunk_size(void)
+{
+        static const int bauds[] = {
+                1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200
+        };
+        int type;
+        int size;
+
+        check(type = martel_get_port_type(port));
+
+        switch (type) {
+        case MARTEL_SERIAL:
+                /*10 bits per character (8N1)*/
+                if (prbaudrate<0 || prbaudrate>=sizeof(bauds)/sizeof(int))
+                        size = CHUNK_SERIAL_MIN;
+                else
+                        size = bauds[prbaudrate]/10*CHUNK_LATENCY/1000;
+                if (size<CHUNK_SERIAL_MIN)
+                        size = CHUNK_SERIAL_MIN;
+                break;
+        case MARTEL_USB:
+                size = CHUNK_USB;
+                break;
+        case MARTEL_PARALLEL:
+                size = CHUNK_PARALLEL;
+                break;
+        default:
+                size = CHUNK_DEFAULT;
+                break;
+        }
+
+        return size;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  take_back
+Purpose   :  Take back bytes flushed from kernel buffers, they are written
+             again from history
+Inputs    :  pending : number of bytes flushed
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void take_back(int pending)
+{
+        if (resume_wpos>=0 && pending>wpos-resume_wpos) {
+                /*resume commands were flushed too*/
+                wpos = resume_wpos;
+                resume_pos = 0;
+        }
+        else {
+                wpos -= pending;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  report_reasons
+Purpose   :  Report changes of printer-state-reasons to CUPS
+Inputs    :  mask : current reasons
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void report_reasons(int mask)
+{
+        int i;
+
+        for (i=0; i<sizeof(reason_names)/sizeof(char *); i++) {
+                int bit = 1<<i;
+
+                if ((mask&bit) && !(reasons&bit))
+                        fprintf(stderr,"STATE: +%s\n",reason_names[i]);
+                else if (!(mask&bit) && (reasons&bit))
+                        fprintf(stderr,"STATE: -%s\n",reason_names[i]);
+        }
+
+        if ((mask&REASONS_BLOCKING) && !(reasons&REASONS_BLOCKING))
+                fputs("INFO: Printer not ready, waiting\n",stderr);
+        else if (!(mask&REASONS_BLOCKING) && (reasons&REASONS_BLOCKING))
+                fputs("INFO: Printer ready\n",stderr);
+
+        reasons = mask;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  report_jitter
+Purpose   :  Log real-time mode and port access jitter of job
+Inputs    :  <>
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void report_jitter(void)
+{
+        martel_jitter_t jitter;
+
+        if (martel_get_jitter(port,&jitter)<0)
+                return;
+
+        fprintf(stderr,"DEBUG: Real-time mode%s%s%s%s, jitter %lu samples, "
+                        "mean %lu us, max %lu us, %lu over 1 ms\n",
+                jitter.mode==0 ? " off" : "",
+                (jitter.mode&MARTEL_RT_FIFO) ? " fifo" : "",
+                (jitter.mode&MARTEL_RT_MLOCK) ? " mlock" : "",
+                (jitter.mode&MARTEL_RT_PINNED) ? " pinned" : "",
+                jitter.samples,jitter.mean,jitter.max,jitter.late);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  poll_status
+Purpose   :  Request printer status and report it to CUPS
+             Status requests are real-time commands that flush data waiting
+             in kernel buffers, so they are only sent when this data can be
+             taken back from history. Port is only used from this thread, so
+             requests never interleave with print data.
+Inputs    :  <>
+Outputs   :  <>
+Return    :  reasons mask, MARTEL_NOT_IMPLEMENTED if status is not available
+             or error code
+-----------------------------------------------------------------------------*/
+static int poll_status(void)
+{
+        martel_status_t status;
+        int errnum;
+        int pending;
+        int mask;
+
+        /*no status without knowing what a request would flush*/
+        if ((pending = martel_get_pending(port))<0)
+                return MARTEL_NOT_IMPLEMENTED;
+
+        if (wpos-pending<history.sent-HISTORY_SIZE)
+                return MARTEL_NOT_IMPLEMENTED;
+
+        errnum = martel_get_status(port,printer_type,&status);
+
+        /*parallel port has no real-time commands, nothing was flushed*/
+        if (errnum!=MARTEL_NOT_IMPLEMENTED && pending>0)
+                take_back(pending);
+
+        if (errnum==MARTEL_READ_TIMEOUT || errnum==MARTEL_INVALID_STATUS
+                        || errnum==MARTEL_INVALID_MODEL_TYPE)
+                return MARTEL_NOT_IMPLEMENTED;
+
+        if (errnum<0)
+                return errnum;
+
+        mask = 0;
+
+        if (status.end_of_paper)
+                mask |= REASON_MEDIA_EMPTY;
+        else if (status.near_end_of_paper)
+                mask |= REASON_MEDIA_LOW;
+        if (status.cover_open)
+                mask |= REASON_COVER_OPEN;
+        if (status.cutter_error || status.mechanical_error || status.temp_error)
+                mask |= REASON_OTHER;
+        if (!status.online && !(mask&REASONS_BLOCKING))
+                mask |= REASON_OFFLINE;
+
+        report_reasons(mask);
+
+        return mask;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  resume_checkpoint
+Purpose   :  Drop data queued for printer, reset it and write data again from
+             last resume point it has taken (see history.h)
+             Used when printer state is unknown: bytes of an incomplete
+             command or text line may have been taken.
+Inputs    :  <>
+Outputs   :  <>
+Return    :  MARTEL_OK or MARTEL_WRITE_TIMEOUT if there is no resume point
+-----------------------------------------------------------------------------*/
+static int resume_checkpoint(void)
+{
+        long long acked;
+        long long pos;
+        int pending;
+        int font;
+        int errnum;
+
+        if ((pending = martel_get_pending(port))<0)
+                return MARTEL_WRITE_TIMEOUT;
+
+        if (resume_wpos>=0 && pending>wpos-resume_wpos)
+                acked = resume_wpos;
+        else
+                acked = wpos-pending;
+
+        if ((pos = history_checkpoint(&history,acked,&font))<0)
+                return MARTEL_WRITE_TIMEOUT;
+
+        if ((errnum = martel_flush(port))<0)
+                return errnum;
+
+        if ((errnum = cmd_reset(&resume))<0)
+                return errnum;
+
+        if (font!=-1) {
+                resume.buf[resume.size++] = ESC;
+                resume.buf[resume.size++] = '!';
+                resume.buf[resume.size++] = font;
+        }
+
+        resume_pos = 0;
+        resume_wpos = wpos = pos;
+
+        if (!(reasons&REASON_OFFLINE))
+                report_reasons(reasons|REASON_OFFLINE);
+
+        fprintf(stderr,"INFO: Printer not responding, resuming %lld bytes back\n",
+                history.sent-pos);
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  wait_ready
+Purpose   :  Handle port that accepted no data for STATUS_INTERVAL
+             Waits as long as printer reports an error, data then goes on
+             where it was flushed. Without such an error, printing resumes
+             from last checkpoint once port is stalled for prtimeout ms
+             (0 waits forever).
+Inputs    :  stalled : time port has been stalled in ms
+Outputs   :  stalled : reset when printing resumed from checkpoint
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int wait_ready(int *stalled)
+{
+        int mask;
+
+        while ((mask = poll_status())>=0 && (mask&REASONS_BLOCKING)) {
+                wait_events(-1,STATUS_INTERVAL);
+        }
+
+        if (mask<0 && mask!=MARTEL_NOT_IMPLEMENTED)
+                return mask;
+
+        if (prtimeout!=0 && *stalled>=prtimeout) {
+                *stalled = 0;
+                return resume_checkpoint();
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  send_data
+Purpose   :  Write data buffer to printer after data taken back from kernel
+             buffers, polling printer status whenever port stalls
+Inputs    :  buf : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int send_data(const unsigned char *buf,int size)
+{
+        int stalled = 0;
+        int errnum;
+
+        while (size || wpos<history.sent || resume_pos<resume.size) {
+                const unsigned char *data;
+                source_t from;
+                int len;
+                int n;
+
+                if (resume_pos<resume.size) {
+                        from = FROM_RESUME;
+                        data = resume.buf+resume_pos;
+                        len = resume.size-resume_pos;
+                }
+                else if (wpos<history.sent) {
+                        from = FROM_HISTORY;
+                        if ((len = history_get(&history,wpos,&data))<0)
+                                return MARTEL_IO_ERROR;
+                }
+                else {
+                        from = FROM_JOB;
+                        data = buf;
+                        len = size;
+                }
+
+                if ((n = martel_write_some(port,data,len))<0) {
+                        abort_job();
+                        return n;
+                }
+
+                /*bytes written again are no progress*/
+                switch (from) {
+                case FROM_RESUME:
+                        resume_pos += n;
+                        break;
+                case FROM_HISTORY:
+                        wpos += n;
+                        break;
+                case FROM_JOB:
+                        history_add(&history,buf,n);
+                        if (reprint!=NULL)
+                                reprint_add(reprint,buf,n);
+                        wpos += n;
+                        buf += n;
+                        size -= n;
+
+                        if (n>0) {
+                                stalled = 0;
+
+                                if (reasons&REASON_OFFLINE)
+                                        report_reasons(reasons&~REASON_OFFLINE);
+                        }
+                        break;
+                }
+
+                if (n==len)
+                        continue;
+
+                /*port accepted no data for STATUS_INTERVAL*/
+                stalled += STATUS_INTERVAL;
+
+                if ((errnum = wait_ready(&stalled))<0)
+                        return errnum;
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  drain
+Purpose   :  Wait until data written to port has left kernel buffers,
+             polling printer status whenever port stalls
+Inputs    :  <>
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int drain(void)
+{
+        int stalled = 0;
+        int last = -1;
+        int pending;
+        int errnum;
+
+        while ((pending = martel_get_pending(port))>0) {
+
+                if (pending!=last) {
+                        last = pending;
+                        stalled = 0;
+                }
+                else if ((stalled += DRAIN_STEP)%STATUS_INTERVAL==0) {
+                        if ((errnum = wait_ready(&stalled))<0)
+                                return errnum;
+
+                        if ((errnum = send_data(NULL,0))<0)
+                                return errnum;
+                }
+
+                wait_events(-1,DRAIN_STEP);
+        }
+
+        /*file and descriptor ports cannot tell, data is taken on write*/
+        if (pending==MARTEL_NOT_IMPLEMENTED)
+                return MARTEL_OK;
+
+        return pending;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  write_job
+Purpose   :  Write job data to printer, through optimizer if required
+Inputs    :  buf : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int write_job(const unsigned char *buf,int size)
+{
+        if (optimizer!=NULL)
+                return martel_optimizer_write(optimizer,buf,size);
+        else
+                return send_data(buf,size);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  abort_job
+Purpose   :  End cancelled job: discard data queued for printer, reset it
+             and revert port settings, each port operation taking at most
+             CANCEL_TIMEOUT, then exit program
+             Does nothing if job was not cancelled
+Inputs    :  <>
+Outputs   :  <>
+Return    :  returns only if job was not cancelled
+-----------------------------------------------------------------------------*/
+static void abort_job(void)
+{
+        struct timespec now;
+        command_t reset;
+
+        if (!cancelled)
+                return;
+
+        martel_set_write_timeout(port,CANCEL_TIMEOUT);
+        martel_set_read_timeout(port,CANCEL_TIMEOUT);
+
+        /*printer drops data it has not printed yet*/
+        martel_flush(port);
+
+        if (cmd_reset(&reset)==MARTEL_OK)
+                martel_write_rt(port,reset.buf,reset.size);
+
+        if (setup_defaults!=NULL)
+                job_setup_defaults(port,setup_defaults);
+
+        report_reasons(0);
+
+        clock_gettime(CLOCK_MONOTONIC,&now);
+        fprintf(stderr,"DEBUG: Job cancelled, printer reset after %ld ms\n",
+                (now.tv_sec-cancel_time.tv_sec)*1000+(now.tv_nsec-cancel_time.tv_nsec)/1000000);
+
+        exit(0);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  job_check
+Purpose   :  Check return code of port operation, port errors caused by
+             cancellation (interrupted write or sync) end the job as
+             cancelled
+Inputs    :  errnum : function return code
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void job_check(int errnum)
+{
+        if (errnum<0)
+                abort_job();
+
+        check(errnum);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  splice_chunk
+Purpose   :  Move some job data from input to file or descriptor port inside
+             the kernel. Data kept for reprint is duplicated with tee()
+             first, which needs an input pipe.
+             Waits while port stalls, so that 0 is only returned at end of
+             input
+Inputs    :  stalled : time port has been stalled in ms
+Outputs   :  stalled : updated
+Return    :  bytes moved, 0 at end of input, or MARTEL_NOT_IMPLEMENTED if
+             data cannot be moved this way (nothing was taken from input)
+-----------------------------------------------------------------------------*/
+static int splice_chunk(int *stalled)
+{
+        unsigned char buf[SPLICE_COPY];
+        int moved = 0;
+        int size = chunk;
+        int n;
+
+        if (reprint!=NULL) {
+                if (tee_pipe[0]<0 && pipe(tee_pipe)<0)
+                        return MARTEL_NOT_IMPLEMENTED;
+
+                /*data stays in input for martel_splice()*/
+                if ((size = tee(input,tee_pipe[1],chunk,0))<0)
+                        return MARTEL_NOT_IMPLEMENTED;
+
+                if (size==0)
+                        return 0;
+        }
+
+        while (1) {
+                n = martel_splice(port,input,size);
+
+                /*port refuses kernel copies, reprint copy is dropped*/
+                if (n==MARTEL_NOT_IMPLEMENTED && moved==0) {
+                        if (reprint!=NULL) {
+                                close(tee_pipe[0]);
+                                close(tee_pipe[1]);
+                                tee_pipe[0] = tee_pipe[1] = -1;
+                        }
+                        return n;
+                }
+
+                if (n==MARTEL_WRITE_TIMEOUT) {
+                        *stalled += STATUS_INTERVAL;
+                        job_check(wait_ready(stalled));
+                        continue;
+                }
+
+                job_check(n);
+
+                /*end of input*/
+                if (n==0)
+                        break;
+
+                if (reprint!=NULL) {
+                        int len;
+
+                        for (len=0; len<n; len+=SPLICE_COPY) {
+                                int m = n-len<SPLICE_COPY ? n-len : SPLICE_COPY;
+
+                                if (read(tee_pipe[0],buf,m)!=m)
+                                        error("error reading reprint copy");
+
+                                reprint_add(reprint,buf,m);
+                        }
+                }
+
+                *stalled = 0;
+                moved += n;
+                size -= n;
+
+                /*all data copied for reprint must go to port, any progress
+                 *will do otherwise*/
+                if (reprint==NULL || size==0)
+                        break;
+        }
+
+        return moved;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  splice_job
+Purpose   :  Move job data from input to file or descriptor port inside the
+             kernel until end of input
+Inputs    :  <>
+Outputs   :  <>
+Return    :  MARTEL_OK, or MARTEL_NOT_IMPLEMENTED if data cannot be moved this
+             way (nothing was taken from input then)
+-----------------------------------------------------------------------------*/
+static int splice_job(void)
+{
+        long long moved = 0;
+        int stalled = 0;
+        struct pollfd in;
+        int n;
+
+        while (1) {
+                in.fd = input;
+                in.events = POLLIN;
+
+                if (poll(&in,1,0)<=0) {
+                        wait_events(input,-1);
+                        continue;
+                }
+
+                if ((n = splice_chunk(&stalled))==MARTEL_NOT_IMPLEMENTED && moved==0)
+                        return n;
+
+                job_check(n);
+
+                if (n==0)
+                        break;
+
+                moved += n;
+
+                wait_events(-1,0);
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  sc_drain_output
+Purpose   :  Side channel request: write job data received so far and wait
+             until printer has taken it
+Inputs    :  <>
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int sc_drain_output(void)
+{
+        const unsigned char *data;
+        int stalled = 0;
+        int errnum;
+        int n;
+
+        /*data moved by splice_job() is taken by port at once*/
+        while (spool==NULL && input>=0) {
+                if (ioctl(input,FIONREAD,&n)<0 || n==0
+                    || splice_chunk(&stalled)<=0)
+                        break;
+        }
+
+        while (spool!=NULL) {
+                if (!spool_ready(spool)) {
+                        /*data still in input pipe was written before request*/
+                        if (ioctl(spool->fd,FIONREAD,&n)<0 || n==0)
+                                break;
+
+                        wait_events(spool_get_fd(spool),-1);
+                        continue;
+                }
+
+                if ((n = spool_get(spool,&data,chunk))<=0)
+                        break;
+
+                if ((errnum = write_job(data,n))<0)
+                        return errnum;
+
+                spool_consume(spool,n);
+        }
+
+        if (optimizer!=NULL && (errnum = martel_optimizer_sync(optimizer))<0)
+                return errnum;
+
+        return drain();
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  sc_get_state
+Purpose   :  Side channel request: get printer state
+             State comes from last status poll, printer is only asked again
+             when no data is queued (status requests flush kernel buffers)
+Inputs    :  <>
+Outputs   :  <>
+Return    :  CUPS_SC_STATE_* bits
+-----------------------------------------------------------------------------*/
+static int sc_get_state(void)
+{
+        static int no_status;
+        int state;
+        int pending;
+
+        pending = martel_get_pending(port);
+
+        if (pending==0 && wpos==history.sent && resume_pos==resume.size && !no_status)
+                no_status = poll_status()==MARTEL_NOT_IMPLEMENTED;
+
+        state = (reasons&REASON_OFFLINE) ? CUPS_SC_STATE_OFFLINE : CUPS_SC_STATE_ONLINE;
+
+        if (pending>0 || (spool!=NULL && spool_ready(spool)))
+                state |= CUPS_SC_STATE_BUSY;
+        if (reasons&REASON_MEDIA_EMPTY)
+                state |= CUPS_SC_STATE_MEDIA_EMPTY|CUPS_SC_STATE_ERROR;
+        if (reasons&REASON_MEDIA_LOW)
+                state |= CUPS_SC_STATE_MEDIA_LOW;
+        if (reasons&(REASON_COVER_OPEN|REASON_OTHER))
+                state |= CUPS_SC_STATE_ERROR;
+
+        return state;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  sc_get_device_id
+Purpose   :  Side channel request: get IEEE 1284 device ID
+             Printers do not report one, so it is built from PPD model
+Inputs    :  size : buffer size in bytes
+Outputs   :  id : device ID
+Return    :  device ID length in bytes
+-----------------------------------------------------------------------------*/
+static int sc_get_device_id(char *id,int size)
+{
+        const char *model = martel_get_model_name(printer_model);
+
+        if (model==NULL)
+                model = "Unknown";
+
+        snprintf(id,size,"MFG:MARTEL;MDL:%s;CMD:MARTEL;CLS:PRINTER;DES:MARTEL %s;",
+                model,model);
+
+        return strlen(id);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  sc_soft_reset
+Purpose   :  Side channel request: drop data queued for printer and reset it
+Inputs    :  <>
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int sc_soft_reset(void)
+{
+        int errnum;
+
+        if ((errnum = martel_flush(port))<0)
+                return errnum;
+
+        wpos = history.sent;
+        resume_pos = resume.size = 0;
+        resume_wpos = -1;
+
+        /*reset is no job data, it goes out as resume command so that it is
+         *kept out of history and reprint*/
+        if ((errnum = cmd_reset(&resume))<0) {
+                resume.size = 0;
+                return errnum;
+        }
+
+        resume_wpos = wpos;
+
+        return send_data(NULL,0);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  side_channel_request
+Purpose   :  Read and answer one CUPS side channel request
+Inputs    :  <>
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void side_channel_request(void)
+{
+        cups_sc_command_t command;
+        cups_sc_status_t status;
+        char data[DEVICE_ID_SIZE];
+        int datalen = sizeof(data);
+        int errnum = MARTEL_OK;
+
+        if (cupsSideChannelRead(&command,&status,data,&datalen,1.0)<0) {
+                sidechannel = 0;
+                return;
+        }
+
+        in_request = 1;
+
+        status = CUPS_SC_STATUS_OK;
+        datalen = 0;
+
+        switch (command) {
+        case CUPS_SC_CMD_DRAIN_OUTPUT:
+                errnum = sc_drain_output();
+                break;
+        case CUPS_SC_CMD_GET_STATE:
+                data[0] = sc_get_state();
+                datalen = 1;
+                break;
+        case CUPS_SC_CMD_GET_DEVICE_ID:
+                datalen = sc_get_device_id(data,sizeof(data));
+                break;
+        case CUPS_SC_CMD_SOFT_RESET:
+                errnum = sc_soft_reset();
+                break;
+        default:
+                status = CUPS_SC_STATUS_NOT_IMPLEMENTED;
+                break;
+        }
+
+        if (errnum<0) {
+                status = errnum==MARTEL_WRITE_TIMEOUT ? CUPS_SC_STATUS_TIMEOUT : CUPS_SC_STATUS_IO_ERROR;
+                datalen = 0;
+        }
+
+        cupsSideChannelWrite(command,status,data,datalen,1.0);
+
+        in_request = 0;
+
+        /*job cannot go on after port error*/
+        job_check(errnum);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  wait_events
+Purpose   :  Wait for descriptor, serving side channel requests meanwhile
+Inputs    :  fd : descriptor to wait for reading or -1 if none
+             timeout : ms to wait, -1 waits until fd is readable
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void wait_events(int fd,int timeout)
+{
+        struct pollfd fds[3];
+        int nfds = 0;
+        int sc = -1;
+
+        abort_job();
+
+        if (cancel_pipe[0]>=0) {
+                fds[nfds].fd = cancel_pipe[0];
+                fds[nfds].events = POLLIN;
+                nfds++;
+        }
+
+        if (fd>=0) {
+                fds[nfds].fd = fd;
+                fds[nfds].events = POLLIN;
+                nfds++;
+        }
+
+        /*requests are not nested, drain request waits here too*/
+        if (sidechannel && !in_request) {
+                sc = nfds;
+                fds[nfds].fd = CUPS_SC_FD;
+                fds[nfds].events = POLLIN;
+                nfds++;
+        }
+
+        if (poll(fds,nfds,timeout)<=0 || sc<0) {
+                abort_job();
+                return;
+        }
+
+        abort_job();
+
+        if (fds[sc].revents&POLLIN)
+                side_channel_request();
+        else if (fds[sc].revents)
+                sidechannel = 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  port_output
+Purpose   :  Output function of command stream optimizer
+Inputs    :  ctx : port structure
+             buf : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int port_output(void *ctx,const void *buf,int size)
+{
+        return send_data(buf,size);
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  job_cancel
+Purpose   :  SIGTERM handler: job is ended by the writer as soon as it
+             wakes up (see abort_job())
+Inputs    :  sig : signal number
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void job_cancel(int sig)
+{
+        int saved = errno;
+
+        if (!cancelled) {
+                clock_gettime(CLOCK_MONOTONIC,&cancel_time);
+                cancelled = 1;
+        }
+
+        if (cancel_pipe[1]>=0)
+                write(cancel_pipe[1],"",1);
+
+        errno = saved;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  read_spool
+Purpose   :  Start reading job data into spool
+             With fastdrain option, whole input is read as fast as it
+             comes, data the printer has not taken yet goes to a spill
+             file
+Inputs    :  fd : input file descriptor
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void read_spool(int fd)
+{
+        spool = spool_create(fd,SPOOL_SIZE,fastdrain==1 ? SPOOL_SPILL_MAX : 0);
+
+        if (spool==NULL || spool_start(spool)<0)
+                error("error creating spool");
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  job_read
+Purpose   :  Start reading job data, so that input is read while port is
+             opened and set up
+             File and descriptor ports take data as it comes, with neither
+             status nor resume: unless the optimizer rewrites it, job data
+             is moved from input to such ports inside the kernel by
+             job_print() and is not read here
+Inputs    :  p : port structure, created
+             fd : input file descriptor
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void job_read(void *p,int fd)
+{
+        int type = martel_get_port_type(p);
+
+        if (optimize!=1 && (type==MARTEL_FILE || type==MARTEL_FD))
+                input = fd;
+        else
+                read_spool(fd);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  job_print
+Purpose   :  Write job data to printer until end of input and wait until
+             printer has taken it
+             Exits program on port errors (see check())
+Inputs    :  p : port structure, open and set up
+             defaults : settings saved by job_setup(), reverted when job is
+                        cancelled, NULL if port was set up by another process
+             sc : CUPS side channel is available
+             job_id : CUPS job ID, job is kept for reprint if positive
+             title : job title
+Outputs   :  <>
+Return    :  0 if successful, 1 if input could not be read
+-----------------------------------------------------------------------------*/
+int job_print(void *p,const port_settings_t *defaults,int sc,int job_id,const char *title)
+{
+        char uri[MARTEL_URI_MAX+1];
+        const unsigned char *data;
+        int n = 0;
+
+        port = p;
+        setup_defaults = defaults;
+        sidechannel = sc;
+
+        /*cancellation wakes writer up wherever it waits*/
+        if (cancel_pipe[0]<0 && pipe(cancel_pipe)==0) {
+                fcntl(cancel_pipe[0],F_SETFL,O_NONBLOCK);
+                fcntl(cancel_pipe[1],F_SETFL,O_NONBLOCK);
+        }
+
+        /*port is written in STATUS_INTERVAL steps, printing timeout is
+         *handled while waiting for printer*/
+        job_check(martel_set_write_timeout(port,STATUS_INTERVAL));
+        job_check(martel_set_read_timeout(port,STATUS_TIMEOUT));
+
+        /*optimize command stream if required*/
+        if (optimize==1) {
+                optimizer = martel_create_optimizer(port_output,port);
+
+                if (optimizer==NULL)
+                        error("error creating optimizer");
+        }
+
+        /*jitter is reported per job*/
+        martel_reset_jitter(port);
+
+        /*write data to printer, serving side channel between chunks*/
+        chunk = get_chunk_size();
+
+        history_init(&history);
+        resume_wpos = -1;
+
+        if (job_id>0 && martel_get_port_uri(port,uri,sizeof(uri))>=0
+            && (reprint = reprint_open(uri,1))!=NULL)
+                reprint_begin(reprint,job_id,title);
+
+        /*kernel cannot move data between input and port, none was taken*/
+        if (input>=0 && splice_job()==MARTEL_NOT_IMPLEMENTED)
+                read_spool(input);
+
+        while (spool!=NULL) {
+
+                if (!spool_ready(spool)) {
+                        wait_events(spool_get_fd(spool),-1);
+                        continue;
+                }
+
+                if ((n = spool_get(spool,&data,chunk))<=0)
+                        break;
+
+                job_check(write_job(data,n));
+
+                spool_consume(spool,n);
+
+                wait_events(-1,0);
+        }
+
+        if (n<0) {
+                perror("ERROR: Unable to read input file - ");
+                return 1;
+        }
+
+        if (optimizer!=NULL) {
+                job_check(martel_optimizer_flush(optimizer));
+                job_check(martel_destroy_optimizer(optimizer));
+                optimizer = NULL;
+        }
+
+        /*wait for printer to take all data then clear reported status*/
+        job_check(drain());
+        job_check(martel_set_write_timeout(port,prtimeout));
+        job_check(martel_sync(port));
+
+        if (reprint!=NULL) {
+                reprint_end(reprint);
+                reprint_close(reprint);
+                reprint = NULL;
+        }
+
+        report_reasons(0);
+        report_jitter();
+
+        if (spool!=NULL) {
+                spool_destroy(spool);
+                spool = NULL;
+        }
+
+        return 0;
+}
+
@@ -0,0 +1,876 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : martel-printd.c
+* DESCRIPTION   : Printer daemon
+*                 Keeps printer ports open and set up across jobs, jobs are
+*                 received over a local socket (see printd.h) and printed by
+*                 a forked process using the backend job writer
+*
+*                 usage: martel-printd [-f] [-s socket] -p ppd uri [[-p ppd] uri...]
+*                 -f : stay in foreground, messages go to stderr as well
+*                 -s : socket path (default PRINTD_SOCKET)
+*                 -p : PPD file of following ports, it gives port settings
+*                      and job options when clients send no PPD
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <poll.h>
+#include <grp.h>
+#include <limits.h>
+#include <pwd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <cups/cups.h>
+
+#include <martel/martel.h>
+
+#include "common.h"
+#include "job.h"
+#include "printd.h"
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+#define PORTS_MAX               16
+#define CLIENTS_MAX             16      /*connections sending job header*/
+#define HEADER_TIMEOUT          2000    /*ms, to receive whole job header*/
+#define HEADER_MAX              (4*PRINTD_LINE_MAX)     /*bytes*/
+
+#define PRINTD_USER             "lp"            /*CUPS backend user*/
+#define SERVER_ROOT             "/etc/cups"     /*unless CUPS_SERVERROOT*/
+
+/*job received from a client*/
+typedef struct job_s {
+        int             fd;             /*client connection*/
+        char *          ppd;            /*NULL for port PPD*/
+        char *          options;
+        int             job_id;         /*0 if client sent none*/
+        char *          title;
+        struct job_s *  next;
+} job_t;
+
+/*port owned by daemon*/
+typedef struct {
+        const char *    uri;
+        const char *    ppd;
+        int             baudrate;       /*settings from port PPD*/
+        int             handshake;
+        int             parmode;
+        void *          port;           /*NULL while closed*/
+        port_settings_t defaults;       /*settings found when port was opened*/
+        pid_t           pid;            /*job process, 0 when idle*/
+        int             cancelled;      /*job process was sent SIGTERM*/
+        job_t *         job;            /*job printed*/
+        job_t *         queue;          /*jobs waiting for port*/
+} printd_port_t;
+
+/*connection whose job header is being received*/
+typedef struct {
+        int             fd;             /*-1 if slot is free*/
+        char            header[HEADER_MAX];
+        int             len;
+        long long       deadline;       /*ms, monotonic clock*/
+} client_t;
+
+static printd_port_t    ports[PORTS_MAX];
+static int              num_ports;
+
+static client_t         clients[CLIENTS_MAX];
+
+/*only root and CUPS backends may connect*/
+static uid_t            lp_uid;
+static gid_t            lp_gid;
+
+static const char *     socket_path = PRINTD_SOCKET;
+static int              listener = -1;
+
+/*signals are turned into events of main loop*/
+static int                      wake[2];
+static volatile sig_atomic_t    terminate;
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  on_signal
+Purpose   :  SIGCHLD, SIGTERM and SIGINT handler, wakes main loop up
+Inputs    :  sig : signal number
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void on_signal(int sig)
+{
+        int saved = errno;
+
+        if (sig!=SIGCHLD)
+                terminate = 1;
+
+        write(wake[1],"",1);
+
+        errno = saved;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  find_port
+Purpose   :  Find port owned by daemon
+Inputs    :  uri : device URI
+Outputs   :  <>
+Return    :  port or NULL if daemon does not own it
+-----------------------------------------------------------------------------*/
+static printd_port_t *find_port(const char *uri)
+{
+        int i;
+
+        for (i=0; i<num_ports; i++)
+                if (strcmp(ports[i].uri,uri)==0)
+                        return &ports[i];
+
+        return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  setup_port
+Purpose   :  Set open port up for printing with settings of port PPD
+Inputs    :  pp : port
+Outputs   :  defaults : settings found on port
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int setup_port(printd_port_t *pp,port_settings_t *defaults)
+{
+        prbaudrate = pp->baudrate;
+        prhandshake = pp->handshake;
+        parmode = pp->parmode;
+
+        return job_setup(pp->port,defaults);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  open_port
+Purpose   :  Open port and set it up for printing
+Inputs    :  pp : port
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int open_port(printd_port_t *pp)
+{
+        int errnum;
+
+        if ((pp->port = martel_create_port(pp->uri))==NULL)
+                return MARTEL_INVALID_PORT;
+
+        if ((errnum = martel_get_error(pp->port))<0
+                        || (errnum = martel_open(pp->port))<0
+                        || (errnum = setup_port(pp,&pp->defaults))<0) {
+                martel_destroy_port(pp->port);
+                pp->port = NULL;
+                return errnum;
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  close_port
+Purpose   :  Close port
+Inputs    :  pp : port
+             restore : revert port to settings found when it was opened
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void close_port(printd_port_t *pp,int restore)
+{
+        if (pp->port==NULL)
+                return;
+
+        if (restore)
+                job_setup_defaults(pp->port,&pp->defaults);
+
+        martel_close(pp->port);
+        martel_destroy_port(pp->port);
+        pp->port = NULL;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  free_job
+Purpose   :  Close client connection and free job
+Inputs    :  job : job structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void free_job(job_t *job)
+{
+        close(job->fd);
+        free(job->ppd);
+        free(job->options);
+        free(job->title);
+        free(job);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  run_job
+Purpose   :  Job process: print job on port set up by daemon
+             CUPS messages go to client through stderr
+Inputs    :  pp : port
+             job : job structure
+Outputs   :  <>
+Return    :  does not return
+-----------------------------------------------------------------------------*/
+static void run_job(printd_port_t *pp,job_t *job)
+{
+        struct sigaction sa;
+        job_t *other;
+        int i;
+
+        signal(SIGCHLD,SIG_DFL);
+        signal(SIGINT,SIG_DFL);
+        signal(SIGPIPE,SIG_DFL);
+
+        /*connections of other jobs are not ours*/
+        close(listener);
+        close(wake[0]);
+        close(wake[1]);
+
+        for (i=0; i<num_ports; i++) {
+                if (ports[i].job!=NULL && ports[i].job!=job)
+                        close(ports[i].job->fd);
+                for (other=ports[i].queue; other!=NULL; other=other->next)
+                        close(other->fd);
+        }
+
+        for (i=0; i<CLIENTS_MAX; i++)
+                if (clients[i].fd>=0)
+                        close(clients[i].fd);
+
+        /*daemon cancels job with SIGTERM*/
+        memset(&sa,0,sizeof(sa));
+        sa.sa_handler = job_cancel;
+        sigaction(SIGTERM,&sa,NULL);
+
+        dup2(job->fd,2);
+        setbuf(stderr,NULL);
+
+        setenv("PPD",job->ppd!=NULL ? job->ppd : pp->ppd,1);
+        setenv("DEVICE_URI",pp->uri,1);
+
+        get_options(job->options);
+
+        /*port keeps daemon settings whatever the job PPD says*/
+        if (martel_get_port_type(pp->port)==MARTEL_SERIAL)
+                prbaudrate = martel_serial_get_baudrate(pp->port);
+
+        job_read(pp->port,job->fd);
+
+        /*port settings are the daemon's, a cancelled job leaves them*/
+        exit(job_print(pp->port,NULL,0,job->job_id,job->title));
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  start_job
+Purpose   :  Start next job waiting for idle port
+Inputs    :  pp : port
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void start_job(printd_port_t *pp)
+{
+        while (pp->pid==0 && pp->queue!=NULL) {
+                job_t *job = pp->queue;
+                int errnum = MARTEL_OK;
+                struct pollfd hup;
+                pid_t pid;
+
+                pp->queue = job->next;
+
+                /*job was cancelled while waiting*/
+                hup.fd = job->fd;
+                hup.events = 0;
+                if (poll(&hup,1,0)>0 && hup.revents&(POLLHUP|POLLERR)) {
+                        free_job(job);
+                        continue;
+                }
+
+                /*port is opened again after failures*/
+                if (pp->port==NULL && (errnum = open_port(pp))<0) {
+                        syslog(LOG_ERR,"%s: %s",pp->uri,martel_strerror(errnum));
+                        dprintf(job->fd,"ERROR: %s\nEND 1\n",martel_strerror(errnum));
+                        free_job(job);
+                        continue;
+                }
+
+                if ((pid = fork())<0) {
+                        syslog(LOG_ERR,"fork: %m");
+                        dprintf(job->fd,"ERROR: martel-printd cannot start job\nEND 1\n");
+                        free_job(job);
+                        continue;
+                }
+
+                if (pid==0)
+                        run_job(pp,job);
+
+                pp->pid = pid;
+                pp->job = job;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  end_jobs
+Purpose   :  Collect finished job processes and give exit status to clients
+Inputs    :  <>
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void end_jobs(void)
+{
+        pid_t pid;
+        int status;
+        int i;
+
+        while ((pid = waitpid(-1,&status,WNOHANG))>0) {
+                for (i=0; i<num_ports; i++) {
+                        printd_port_t *pp = &ports[i];
+                        int code;
+
+                        if (pp->pid!=pid)
+                                continue;
+
+                        code = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+                        dprintf(pp->job->fd,"END %d\n",code);
+                        free_job(pp->job);
+
+                        /*port may be gone (printer switched off or
+                         *unplugged), it is opened again for next job*/
+                        if (code!=0) {
+                                close_port(pp,0);
+                        }
+                        else if (pp->cancelled) {
+                                /*cancelled job flushed port and reset
+                                 *printer, port is set up again*/
+                                port_settings_t current;
+
+                                if (setup_port(pp,&current)<0)
+                                        close_port(pp,0);
+                        }
+
+                        pp->job = NULL;
+                        pp->pid = 0;
+                        pp->cancelled = 0;
+
+                        start_job(pp);
+                        break;
+                }
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  now_ms
+Purpose   :  Get monotonic time
+Inputs    :  <>
+Outputs   :  <>
+Return    :  time in milliseconds
+-----------------------------------------------------------------------------*/
+static long long now_ms(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC,&ts);
+
+        return (long long)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  allowed_ppd
+Purpose   :  Check PPD file sent by client, daemon runs as root and only
+             parses the port PPD or files of the CUPS PPD directory
+Inputs    :  pp : port
+             ppd : PPD file sent by client
+Outputs   :  <>
+Return    :  1 if allowed, 0 otherwise
+-----------------------------------------------------------------------------*/
+static int allowed_ppd(printd_port_t *pp,const char *ppd)
+{
+        char dir[PATH_MAX];
+        char path[PATH_MAX];
+        const char *root;
+        int len;
+
+        if (strcmp(ppd,pp->ppd)==0)
+                return 1;
+
+        if ((root = getenv("CUPS_SERVERROOT"))==NULL)
+                root = SERVER_ROOT;
+
+        if (snprintf(path,sizeof(path),"%s/ppd",root)>=(int)sizeof(path)
+                        || realpath(path,dir)==NULL
+                        || realpath(ppd,path)==NULL)
+                return 0;
+
+        len = strlen(dir);
+
+        return strncmp(path,dir,len)==0 && path[len]=='/';
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  drop_client
+Purpose   :  Close connection whose job header was refused
+Inputs    :  c : client
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void drop_client(client_t *c)
+{
+        close(c->fd);
+        c->fd = -1;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  accept_client
+Purpose   :  Accept connection of root or CUPS backend, its job header is
+             received by main loop
+Inputs    :  <>
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void accept_client(void)
+{
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        int fd;
+        int i;
+
+        if ((fd = accept4(listener,NULL,NULL,SOCK_NONBLOCK|SOCK_CLOEXEC))<0)
+                return;
+
+        if (getsockopt(fd,SOL_SOCKET,SO_PEERCRED,&cred,&len)<0) {
+                close(fd);
+                return;
+        }
+
+        if (cred.uid!=0 && cred.uid!=lp_uid && cred.uid!=geteuid()) {
+                syslog(LOG_WARNING,"connection of uid %d refused",(int)cred.uid);
+                close(fd);
+                return;
+        }
+
+        for (i=0; i<CLIENTS_MAX; i++) {
+                if (clients[i].fd<0) {
+                        clients[i].fd = fd;
+                        clients[i].len = 0;
+                        clients[i].deadline = now_ms()+HEADER_TIMEOUT;
+                        return;
+                }
+        }
+
+        syslog(LOG_WARNING,"too many connections");
+        close(fd);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_job
+Purpose   :  Parse job header received from client and queue job
+Inputs    :  c : client, its header is complete
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void queue_job(client_t *c)
+{
+        printd_port_t *pp = NULL;
+        const char *uri = NULL;
+        const char *ppd = NULL;
+        int query = 0;
+        char *line;
+        char *next;
+        job_t *job;
+        job_t **tail;
+        int fd = c->fd;
+
+        /*connection belongs to job from now on*/
+        c->fd = -1;
+
+        if ((job = calloc(1,sizeof(job_t)))==NULL) {
+                close(fd);
+                return;
+        }
+
+        job->fd = fd;
+
+        for (line=c->header; *line!='\n'; line=next) {
+                next = strchr(line,'\n');
+                *next++ = 0;
+
+                if (strncmp(line,"URI ",4)==0 && uri==NULL)
+                        uri = line+4;
+                else if (strncmp(line,"PPD ",4)==0 && ppd==NULL)
+                        ppd = line+4;
+                else if (strncmp(line,"OPTIONS ",8)==0 && job->options==NULL)
+                        job->options = strdup(line+8);
+                else if (strcmp(line,"QUERY")==0 && !query)
+                        query = 1;
+                else if (strncmp(line,"JOB ",4)==0 && job->title==NULL) {
+                        char *title;
+
+                        job->job_id = strtol(line+4,&title,10);
+                        job->title = strdup(*title==' ' ? title+1 : title);
+                }
+                else {
+                        /*repeated or unknown line, values may have been
+                         *split by a client*/
+                        syslog(LOG_WARNING,"invalid job header line: %.64s",line);
+                        dprintf(fd,"ERROR invalid job header\n");
+                        free_job(job);
+                        return;
+                }
+        }
+
+        if (uri!=NULL)
+                pp = find_port(uri);
+
+        if (pp==NULL || query) {
+                dprintf(fd,pp==NULL ? "NOPORT\n" : "OK\n");
+                free_job(job);
+                return;
+        }
+
+        if (ppd!=NULL) {
+                if (allowed_ppd(pp,ppd))
+                        job->ppd = strdup(ppd);
+                else
+                        syslog(LOG_WARNING,"%s: PPD %s ignored",pp->uri,ppd);
+        }
+
+        if (job->options==NULL)
+                job->options = strdup("");
+
+        /*job process reads job data with blocking calls*/
+        fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)&~O_NONBLOCK);
+
+        dprintf(fd,"OK\n");
+
+        for (tail=&pp->queue; *tail!=NULL; tail=&(*tail)->next)
+                ;
+        *tail = job;
+
+        start_job(pp);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  read_client
+Purpose   :  Receive available part of job header from client, job is
+             queued once the empty line ending the header is received
+Inputs    :  c : client
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void read_client(client_t *c)
+{
+        char *end = NULL;
+        int n;
+
+        n = read(c->fd,c->header+c->len,sizeof(c->header)-1-c->len);
+
+        if (n<0 && (errno==EAGAIN || errno==EINTR))
+                return;
+
+        if (n<=0) {
+                drop_client(c);
+                return;
+        }
+
+        c->len += n;
+        c->header[c->len] = 0;
+
+        /*header ends with empty line*/
+        if (c->header[0]=='\n')
+                end = c->header;
+        else if ((end = strstr(c->header,"\n\n"))!=NULL)
+                end++;
+
+        if (end==NULL) {
+                if (c->len==sizeof(c->header)-1)
+                        drop_client(c);
+                return;
+        }
+
+        /*client sends job data only after daemon answered*/
+        if (end+1!=c->header+c->len || (int)strlen(c->header)!=c->len) {
+                drop_client(c);
+                return;
+        }
+
+        queue_job(c);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  add_port
+Purpose   :  Add port owned by daemon, its settings come from PPD file
+Inputs    :  uri : device URI
+             ppd : PPD file
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void add_port(const char *uri,const char *ppd)
+{
+        printd_port_t *pp;
+        int errnum;
+
+        if (num_ports==PORTS_MAX) {
+                fprintf(stderr,"martel-printd: too many ports\n");
+                exit(1);
+        }
+
+        if (ppd==NULL) {
+                fprintf(stderr,"martel-printd: no PPD file for %s\n",uri);
+                exit(1);
+        }
+
+        pp = &ports[num_ports++];
+        pp->uri = uri;
+        pp->ppd = ppd;
+
+        setenv("PPD",ppd,1);
+        get_options("");
+
+        pp->baudrate = prbaudrate;
+        pp->handshake = prhandshake;
+        pp->parmode = parmode;
+
+        /*printer may be off, port is opened again on first job*/
+        if ((errnum = open_port(pp))<0)
+                fprintf(stderr,"martel-printd: %s: %s\n",uri,martel_strerror(errnum));
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  listen_socket
+Purpose   :  Create socket clients connect to
+Inputs    :  path : socket path
+Outputs   :  <>
+Return    :  socket or -1 on error
+-----------------------------------------------------------------------------*/
+static int listen_socket(const char *path)
+{
+        struct sockaddr_un addr;
+        int s;
+
+        if (strlen(path)>=sizeof(addr.sun_path)) {
+                errno = ENAMETOOLONG;
+                return -1;
+        }
+
+        if ((s = socket(AF_UNIX,SOCK_STREAM,0))<0)
+                return -1;
+
+        memset(&addr,0,sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path,path);
+
+        /*left over by a daemon that did not exit cleanly*/
+        unlink(path);
+
+        /*root and lp group only, peer credentials are checked as well
+         *(see accept_client())*/
+        if (bind(s,(struct sockaddr *)&addr,sizeof(addr))<0
+                        || chown(path,geteuid(),lp_gid)<0
+                        || chmod(path,0660)<0 || listen(s,SOMAXCONN)<0) {
+                close(s);
+                return -1;
+        }
+
+        fcntl(s,F_SETFD,FD_CLOEXEC);
+
+        return s;
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  main
+Purpose   :  Program main function
+Inputs    :  argc : number of command-line arguments (including program name)
+             argv : array of command-line arguments
+Outputs   :  <>
+Return    :  0 if successful, 1 if program failed
+-----------------------------------------------------------------------------*/
+int main(int argc,char **argv)
+{
+        struct sigaction sa;
+        struct passwd *pw;
+        struct group *gr;
+        const char *ppd = NULL;
+        int foreground = 0;
+        int i;
+
+        for (i=1; i<argc; i++) {
+                if (strcmp(argv[i],"-f")==0)
+                        foreground = 1;
+                else if (strcmp(argv[i],"-s")==0 && i+1<argc)
+                        socket_path = argv[++i];
+                else if (strcmp(argv[i],"-p")==0 && i+1<argc)
+                        ppd = argv[++i];
+                else if (argv[i][0]=='-')
+                        break;
+                else
+                        add_port(argv[i],ppd);
+        }
+
+        if (i<argc || num_ports==0) {
+                fputs("usage: martel-printd [-f] [-s socket] -p ppd uri [[-p ppd] uri...]\n",stderr);
+                return 1;
+        }
+
+        lp_uid = (pw = getpwnam(PRINTD_USER))!=NULL ? pw->pw_uid : 0;
+        lp_gid = (gr = getgrnam(PRINTD_USER))!=NULL ? gr->gr_gid : getegid();
+
+        for (i=0; i<CLIENTS_MAX; i++)
+                clients[i].fd = -1;
+
+        if ((listener = listen_socket(socket_path))<0) {
+                perror(socket_path);
+                return 1;
+        }
+
+        if (pipe(wake)<0) {
+                perror("pipe");
+                return 1;
+        }
+
+        fcntl(wake[0],F_SETFL,O_NONBLOCK);
+        fcntl(wake[1],F_SETFL,O_NONBLOCK);
+
+        openlog("martel-printd",foreground ? LOG_PERROR : 0,LOG_DAEMON);
+
+        if (!foreground && daemon(0,0)<0) {
+                perror("daemon");
+                return 1;
+        }
+
+        memset(&sa,0,sizeof(sa));
+        sa.sa_handler = on_signal;
+        sa.sa_flags = SA_RESTART|SA_NOCLDSTOP;
+        sigaction(SIGCHLD,&sa,NULL);
+        sigaction(SIGTERM,&sa,NULL);
+        sigaction(SIGINT,&sa,NULL);
+
+        /*clients may go away, their job process reports it*/
+        signal(SIGPIPE,SIG_IGN);
+
+        while (!terminate) {
+                struct pollfd fds[2+PORTS_MAX+CLIENTS_MAX];
+                struct pollfd *cfds = fds+2+num_ports;
+                int timeout = -1;
+                long long now;
+                char buf[16];
+
+                fds[0].fd = listener;
+                fds[0].events = POLLIN;
+                fds[1].fd = wake[0];
+                fds[1].events = POLLIN;
+
+                /*client of job being printed hangs up when CUPS cancels
+                 *job (backend is killed)*/
+                for (i=0; i<num_ports; i++) {
+                        fds[2+i].fd = ports[i].pid!=0 && !ports[i].cancelled ? ports[i].job->fd : -1;
+                        fds[2+i].events = 0;
+                }
+
+                /*whole job header must be received before deadline*/
+                now = now_ms();
+                for (i=0; i<CLIENTS_MAX; i++) {
+                        cfds[i].fd = clients[i].fd;
+                        cfds[i].events = POLLIN;
+                        if (clients[i].fd>=0 && (timeout<0 || clients[i].deadline-now<timeout))
+                                timeout = clients[i].deadline>now ? clients[i].deadline-now : 0;
+                }
+
+                if (poll(fds,2+num_ports+CLIENTS_MAX,timeout)<0) {
+                        if (errno==EINTR)
+                                continue;
+                        syslog(LOG_ERR,"poll: %m");
+                        break;
+                }
+
+                if (fds[1].revents) {
+                        while (read(wake[0],buf,sizeof(buf))>0)
+                                ;
+                        end_jobs();
+                }
+
+                for (i=0; i<num_ports; i++) {
+                        /*job may have ended meanwhile*/
+                        if (fds[2+i].revents&(POLLHUP|POLLERR) && ports[i].pid!=0
+                            && ports[i].job->fd==fds[2+i].fd) {
+                                kill(ports[i].pid,SIGTERM);
+                                ports[i].cancelled = 1;
+                        }
+                }
+
+                now = now_ms();
+                for (i=0; i<CLIENTS_MAX; i++) {
+                        if (clients[i].fd<0)
+                                continue;
+                        if (cfds[i].revents && !terminate)
+                                read_client(&clients[i]);
+                        if (clients[i].fd>=0 && now>=clients[i].deadline)
+                                drop_client(&clients[i]);
+                }
+
+                if (fds[0].revents && !terminate)
+                        accept_client();
+        }
+
+        /*jobs being printed are cancelled*/
+        for (i=0; i<num_ports; i++) {
+                if (ports[i].pid!=0) {
+                        kill(ports[i].pid,SIGTERM);
+                        waitpid(ports[i].pid,NULL,0);
+                }
+                close_port(&ports[i],1);
+        }
+
+        for (i=0; i<CLIENTS_MAX; i++)
+                if (clients[i].fd>=0)
+                        drop_client(&clients[i]);
+
+        close(listener);
+        unlink(socket_path);
+
+        return 0;
+}
+
@@ -0,0 +1,318 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : martel-reprint.c
+* DESCRIPTION   : Reprint tool
+*                 Sends a job kept in the reprint ring file of a printer
+*                 (see reprint.h) to the printer again, without going
+*                 through CUPS filters
+*
+*                 usage: martel-reprint [-p ppd] [-l] [-j job-id] [-t title] uri
+*                 -p : PPD file giving port settings (default $PPD)
+*                 -l : list jobs which can be reprinted
+*                 -j : reprint job with this CUPS job ID
+*                 -t : reprint newest job with this title
+*                 Newest job is reprinted when neither -j nor -t is given
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <cups/cups.h>
+
+#include <martel/martel.h>
+
+#include "common.h"
+#include "setup.h"
+#include "printd.h"
+#include "reprint.h"
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+/*reprinted stream is already optimized*/
+#define PRINTD_OPTIONS          "optimize=False"
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  usage
+Purpose   :  Print usage and exit
+Inputs    :  <>
+Outputs   :  <>
+Return    :  does not return
+-----------------------------------------------------------------------------*/
+static void usage(void)
+{
+        fputs("usage: martel-reprint [-p ppd] [-l] [-j job-id] [-t title] uri\n",stderr);
+        exit(1);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  list_jobs
+Purpose   :  Print jobs which can be reprinted, newest first
+Inputs    :  r : reprint ring
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void list_jobs(reprint_t *r)
+{
+        reprint_job_t jobs[REPRINT_JOBS];
+        char date[32];
+        int num;
+        int i;
+
+        num = reprint_list(r,jobs,REPRINT_JOBS);
+
+        for (i=0; i<num; i++) {
+                strftime(date,sizeof(date),"%Y-%m-%d %H:%M:%S",localtime(&jobs[i].time));
+                printf("%-8d %8lld  %s  %s\n",jobs[i].job_id,jobs[i].length,date,jobs[i].title);
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  write_all
+Purpose   :  Write whole buffer to descriptor
+Inputs    :  fd : file descriptor
+             buf : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  0 if successful, -1 on error (errno is set)
+-----------------------------------------------------------------------------*/
+static int write_all(int fd,const void *buf,int size)
+{
+        const char *p = buf;
+
+        while (size) {
+                ssize_t n = write(fd,p,size);
+
+                if (n<0) {
+                        if (errno==EINTR)
+                                continue;
+                        return -1;
+                }
+
+                p += n;
+                size -= n;
+        }
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  printd_reprint
+Purpose   :  Send job data through martel-printd when it owns the port
+Inputs    :  uri : device URI
+             ppd : PPD file or NULL
+             buf : job data
+             size : job data size in bytes
+Outputs   :  <>
+Return    :  exit status, or -1 if daemon is not running or does not own
+             the port
+-----------------------------------------------------------------------------*/
+static int printd_reprint(const char *uri,const char *ppd,const unsigned char *buf,int size)
+{
+        char line[PRINTD_LINE_MAX];
+        FILE *answer;
+        int status = -1;
+        int s;
+
+        /*each value is one header line*/
+        if (strpbrk(uri,"\r\n")!=NULL || (ppd!=NULL && strpbrk(ppd,"\r\n")!=NULL))
+                return -1;
+
+        if ((s = printd_connect())<0)
+                return -1;
+
+        if ((answer = fdopen(s,"r"))==NULL) {
+                close(s);
+                return -1;
+        }
+
+        /*no JOB line: reprints are not kept again*/
+        if (ppd!=NULL)
+                dprintf(s,"URI %s\nPPD %s\nOPTIONS " PRINTD_OPTIONS "\n\n",uri,ppd);
+        else
+                dprintf(s,"URI %s\nOPTIONS " PRINTD_OPTIONS "\n\n",uri);
+
+        line[0] = 0;
+
+        if (fgets(line,sizeof(line),answer)==NULL || strcmp(line,"OK\n")!=0) {
+                if (strncmp(line,"ERROR ",6)==0) {
+                        fprintf(stderr,"ERROR: martel-printd: %s",line+6);
+                        status = 1;
+                }
+                fclose(answer);
+                return status;
+        }
+
+        if (write_all(s,buf,size)<0) {
+                perror("ERROR: Unable to send job to martel-printd - ");
+                fclose(answer);
+                return 1;
+        }
+
+        shutdown(s,SHUT_WR);
+
+        /*daemon messages until job status*/
+        status = 1;
+
+        while (fgets(line,sizeof(line),answer)!=NULL) {
+                if (strncmp(line,"END ",4)==0) {
+                        status = atoi(line+4);
+                        break;
+                }
+                fputs(line,stderr);
+        }
+
+        fclose(answer);
+
+        return status;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  port_reprint
+Purpose   :  Write job data to printer port
+             Exits program on port errors (see check())
+Inputs    :  uri : device URI
+             buf : job data
+             size : job data size in bytes
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void port_reprint(const char *uri,const unsigned char *buf,int size)
+{
+        port_settings_t defaults;
+        void *port;
+
+        port = martel_create_port(uri);
+
+        if (port==NULL)
+                error("error creating port");
+
+        check(martel_get_error(port));
+        check(martel_open(port));
+        check(job_setup(port,&defaults));
+
+        check(martel_set_write_timeout(port,prtimeout));
+        check(martel_write(port,buf,size));
+        check(martel_sync(port));
+
+        check(job_setup_defaults(port,&defaults));
+        check(martel_close(port));
+        check(martel_destroy_port(port));
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  main
+Purpose   :  Program main function
+Inputs    :  argc : number of command-line arguments (including program name)
+             argv : array of command-line arguments
+Outputs   :  <>
+Return    :  0 if successful, 1 if program failed
+-----------------------------------------------------------------------------*/
+int main(int argc,char **argv)
+{
+        const char *ppd = NULL;
+        const char *title = NULL;
+        const char *uri;
+        unsigned char *buf;
+        reprint_t *r;
+        int list = 0;
+        int job_id = 0;
+        int status;
+        int size;
+        int c;
+
+        while ((c = getopt(argc,argv,"p:lj:t:"))!=-1) {
+                switch (c) {
+                case 'p':
+                        ppd = optarg;
+                        break;
+                case 'l':
+                        list = 1;
+                        break;
+                case 'j':
+                        if ((job_id = atoi(optarg))<=0)
+                                usage();
+                        break;
+                case 't':
+                        title = optarg;
+                        break;
+                default:
+                        usage();
+                }
+        }
+
+        if (optind!=argc-1)
+                usage();
+
+        uri = argv[optind];
+
+        if ((r = reprint_open(uri,0))==NULL) {
+                fprintf(stderr,"ERROR: no reprint file for %s\n",uri);
+                return 1;
+        }
+
+        if (list) {
+                list_jobs(r);
+                reprint_close(r);
+                return 0;
+        }
+
+        size = reprint_copy(r,job_id,title,&buf);
+        reprint_close(r);
+
+        if (size<0) {
+                fputs("ERROR: job is not kept for reprint\n",stderr);
+                return 1;
+        }
+
+        if ((status = printd_reprint(uri,ppd,buf,size))>=0) {
+                free(buf);
+                return status;
+        }
+
+        /*port settings come from PPD*/
+        if (ppd!=NULL)
+                setenv("PPD",ppd,1);
+
+        get_options("");
+
+        port_reprint(uri,buf,size);
+
+        free(buf);
+
+        return 0;
+}
@@ -5,6 +5,7 @@
 * NAME          : martel.c
 * DESCRIPTION   : CUPS backend for MARTEL printers
 *                 Use MARTEL library to send data to printers
+*                 Jobs go through martel-printd when it owns the port
 * CVS           : $Id: martel.c,v 1.1 2006/08/01 09:08:38 chris Exp $
 *******************************************************************************
 *   Copyright (C) 2006  MARTEL Instruments Ltd.
@@ -28,70 +29,56 @@
 * HISTORY       :
 *   27-Jul-06   CML     Initial revision
 ******************************************************************************/
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 
 #include <cups/cups.h>
+#include <cups/sidechannel.h>
 
 #include <martel/martel.h>
 
 #include "common.h"
+#include "job.h"
+#include "printd.h"
 
 /* PRIVATE DEFINITIONS ------------------------------------------------------*/
 static const char id_str[] = "$Id: martel.c,v 1.1 2006/08/01 09:08:38 chris Exp $";
 
 #define PRINTERS_MAX    32
 
-#define BUFSIZE         4096    /*bytes*/
-
 static void *   port;
 
-static martel_serial_baudrate_t    defbaudrate;
-static martel_serial_handshake_t   defhandshake;
-static martel_parallel_mode_t      defparmode;
+/*CUPS side channel*/
+#define SC_DATA_SIZE    256             /*bytes*/
 
-#define CMD_BUFSIZE     8       /*bytes*/
+static int      sidechannel;
 
-typedef struct {
-        unsigned char   buf[CMD_BUFSIZE];
-        int             size;
-        int             answer;
-} command_t;
+/*job data copied to martel-printd at once*/
+#define PRINTD_CHUNK    (16*1024)       /*bytes*/
 
-/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+/*ways of copying job data to martel-printd, tried in this order*/
+typedef enum {
+        COPY_SPLICE             = 0,    /*input is a pipe*/
+        COPY_SENDFILE           = 1,    /*input is a file*/
+        COPY_PIPE               = 2,    /*splice through internal pipe*/
+        COPY_READWRITE          = 3
+} copy_method_t;
 
-/*-----------------------------------------------------------------------------
-Name      :  cmd_reset
-Purpose   :  Build 'reset' command based on printer type
-Inputs    :  cmd : command structure
-Outputs   :  Fills command structure
-Return    :  MARTEL_OK or error code
------------------------------------------------------------------------------*/
-static int cmd_reset(command_t *cmd)
-{
-        martel_error_t errnum;
-
-        errnum = MARTEL_OK;
-
-        switch (printer_type) {
-        case MARTEL_MPP:
-        case MARTEL_MCP:
-                cmd->size = 2;
-                cmd->answer = 0;
-                cmd->buf[0] = ESC;
-                cmd->buf[1] = '@';
-                break;
-        default:
-                errnum = MARTEL_INVALID_MODEL_TYPE;
-                break;
-        }
+static copy_method_t    copy_method;
+static int              copy_pipe[2] = {-1,-1};
 
-        return errnum;
-}
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
 
 /*-----------------------------------------------------------------------------
 Name      :  clean
@@ -121,103 +108,366 @@ static void clean(void)
 }
 
 /*-----------------------------------------------------------------------------
-Name      :  check
-Purpose   :  Check return code of MARTEL library function and exit on error
-Inputs    :  errnum : function return code
+Name      :  write_all
+Purpose   :  Write whole buffer to descriptor
+Inputs    :  fd : file descriptor
+             buf : data buffer
+             size : data buffer size in bytes
 Outputs   :  <>
-Return    :  <>
+Return    :  0 if successful, -1 on error (errno is set)
+-----------------------------------------------------------------------------*/
+static int write_all(int fd,const void *buf,int size)
+{
+        const char *p = buf;
+
+        while (size) {
+                ssize_t n = write(fd,p,size);
+
+                if (n<0) {
+                        if (errno==EINTR)
+                                continue;
+                        return -1;
+                }
+
+                p += n;
+                size -= n;
+        }
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  splice_all
+Purpose   :  Move whole pipe content to descriptor
+Inputs    :  fd : pipe read end
+             s : output descriptor
+             size : bytes in pipe
+Outputs   :  <>
+Return    :  0 if successful, -1 on error (errno is set)
+-----------------------------------------------------------------------------*/
+static int splice_all(int fd,int s,ssize_t size)
+{
+        while (size) {
+                ssize_t n = splice(fd,NULL,s,NULL,size,SPLICE_F_MOVE|SPLICE_F_MORE);
+
+                if (n<0) {
+                        if (errno==EINTR)
+                                continue;
+                        return -1;
+                }
+
+                size -= n;
+        }
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  printd_copy
+Purpose   :  Copy some job data from input to martel-printd
+             Data stays in the kernel with splice() (input is a pipe),
+             sendfile() (input is a file) or splice() through an internal
+             pipe. Each method is dropped as soon as the kernel refuses it
+             for the input, down to a plain read()/write() loop.
+Inputs    :  fd : input file descriptor
+             s : socket connected to daemon
+Outputs   :  <>
+Return    :  bytes copied, 0 at end of input, -1 on error (errno is set)
 -----------------------------------------------------------------------------*/
-static void check(int errnum)
+static ssize_t printd_copy(int fd,int s)
 {
-        if (errnum<0) {
-                error(martel_strerror(errnum));
+        char buf[PRINTD_CHUNK];
+        ssize_t n;
+
+        while (1) {
+                switch (copy_method) {
+                case COPY_SPLICE:
+                        n = splice(fd,NULL,s,NULL,PRINTD_CHUNK,SPLICE_F_MOVE|SPLICE_F_MORE);
+                        break;
+                case COPY_SENDFILE:
+                        n = sendfile(s,fd,NULL,PRINTD_CHUNK);
+                        break;
+                case COPY_PIPE:
+                        if (copy_pipe[0]<0 && pipe(copy_pipe)<0)
+                                return -1;
+
+                        n = splice(fd,NULL,copy_pipe[1],NULL,PRINTD_CHUNK,SPLICE_F_MOVE);
+
+                        /*data taken from input must not be lost*/
+                        if (n>0 && splice_all(copy_pipe[0],s,n)<0)
+                                return -1;
+                        break;
+                default:
+                        n = read(fd,buf,sizeof(buf));
+                        if (n>0 && write_all(s,buf,n)<0)
+                                return -1;
+                        break;
+                }
+
+                if (n>=0)
+                        return n;
+
+                if (errno==EINTR)
+                        continue;
+
+                /*method not supported for this input*/
+                if (copy_method!=COPY_READWRITE &&
+                    (errno==EINVAL || errno==ENOSYS || errno==EBADF ||
+                     errno==ESPIPE || errno==EOPNOTSUPP)) {
+                        copy_method++;
+                        continue;
+                }
+
+                return -1;
         }
 }
 
 /*-----------------------------------------------------------------------------
-Name      :  setup
-Purpose   :  Save current port settings (defaults) and setup port for printing
+Name      :  sc_unavailable
+Purpose   :  Answer CUPS side channel request while this process does not
+             own the port (job goes through martel-printd or port is not
+             open yet): none is implemented
 Inputs    :  <>
 Outputs   :  <>
 Return    :  <>
 -----------------------------------------------------------------------------*/
-static void setup(void)
+static void sc_unavailable(void)
 {
-        int type;
+        cups_sc_command_t command;
+        cups_sc_status_t status;
+        char data[SC_DATA_SIZE];
+        int datalen = sizeof(data);
+
+        if (cupsSideChannelRead(&command,&status,data,&datalen,1.0)<0) {
+                sidechannel = 0;
+                return;
+        }
 
-        check(type = martel_get_port_type(port));
-        
-        switch (type) {
-        case MARTEL_SERIAL:
-                 /*save current settings*/
-                check(defbaudrate = martel_serial_get_baudrate(port));
-                check(defhandshake = martel_serial_get_handshake(port));
-                /*setup printing settings as defaults if required*/
-                if (prbaudrate==-1) {
-                        prbaudrate = defbaudrate;
+        cupsSideChannelWrite(command,CUPS_SC_STATUS_NOT_IMPLEMENTED,NULL,0,1.0);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  wait_input
+Purpose   :  Wait until job data comes in, answering side channel requests
+             meanwhile. Port is left alone for empty jobs, such as raster
+             jobs printed by the filter in direct mode
+Inputs    :  fd : input file descriptor
+Outputs   :  <>
+Return    :  1 if job has data, 0 if it is empty, -1 on error
+-----------------------------------------------------------------------------*/
+static int wait_input(int fd)
+{
+        while (1) {
+                struct pollfd fds[2];
+                int nfds = 0;
+                int n;
+
+                fds[nfds].fd = fd;
+                fds[nfds].events = POLLIN;
+                nfds++;
+
+                if (sidechannel) {
+                        fds[nfds].fd = CUPS_SC_FD;
+                        fds[nfds].events = POLLIN;
+                        nfds++;
                 }
-                if (prhandshake==-1) {
-                        prhandshake = defhandshake;
+
+                if (poll(fds,nfds,-1)<0) {
+                        if (errno==EINTR)
+                                continue;
+                        return -1;
+                }
+
+                if (nfds>1 && fds[1].revents) {
+                        if (fds[1].revents&POLLIN)
+                                sc_unavailable();
+                        else
+                                sidechannel = 0;
+                }
+
+                /*input is readable at end of file too*/
+                if (fds[0].revents) {
+                        if (ioctl(fd,FIONREAD,&n)<0)
+                                return 1;
+
+                        return n>0;
+                }
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  printd_print
+Purpose   :  Print job through martel-printd
+             Job data is copied to daemon, its messages are copied to CUPS
+Inputs    :  s : socket connected to daemon
+             fd : input file descriptor
+             job_id : CUPS job ID
+             title : job title
+             options : job options
+Outputs   :  <>
+Return    :  program exit status, or -1 if daemon does not own the port
+-----------------------------------------------------------------------------*/
+static int printd_print(int s,int fd,int job_id,const char *title,const char *options)
+{
+        char line[PRINTD_LINE_MAX];
+        char buf[PRINTD_CHUNK];
+        const char *ppd = getenv("PPD");
+        const char *uri = getenv("DEVICE_URI");
+        int len = 0;
+        int status = -1;
+        int eof = 0;
+        int n;
+        int i;
+
+        /*each value is one header line*/
+        if (uri==NULL || strpbrk(uri,"\r\n")!=NULL
+            || (ppd!=NULL && strpbrk(ppd,"\r\n")!=NULL))
+                return -1;
+
+        /*send header and wait for answer*/
+        n = snprintf(buf,sizeof(buf),"URI %s\n",uri);
+        if (ppd!=NULL)
+                n += snprintf(buf+n,sizeof(buf)-n,"PPD %s\n",ppd);
+        n += snprintf(buf+n,sizeof(buf)-n,"JOB %d %.*s\n",job_id,
+                      (int)strcspn(title,"\r\n"),title);
+        i = n+8;
+        n += snprintf(buf+n,sizeof(buf)-n,"OPTIONS %s\n\n",options);
+
+        if (n>=sizeof(buf))
+                return -1;
+
+        /*CUPS keeps newlines of text option values (escaped)*/
+        for (; i<n-2; i++)
+                if (buf[i]=='\r' || buf[i]=='\n')
+                        buf[i] = ' ';
+
+        if (write_all(s,buf,n)<0)
+                return -1;
+
+        while (len<sizeof(line)-1 && (n = read(s,line+len,1))==1 && line[len]!='\n')
+                len++;
+        line[len] = 0;
+
+        if (strcmp(line,"OK")!=0) {
+                if (strncmp(line,"ERROR ",6)==0) {
+                        fprintf(stderr,"ERROR: martel-printd: %s\n",line+6);
+                        return 1;
                 }
+                return -1;
+        }
+
+        len = 0;
 
-                check(martel_sync(port));
+        while (status<0) {
+                struct pollfd fds[3];
+                int nfds = 0;
+                char *p;
 
-                check(martel_serial_set_baudrate(port,prbaudrate));
-                check(martel_serial_set_handshake(port,prhandshake));
+                fds[nfds].fd = s;
+                fds[nfds].events = POLLIN;
+                nfds++;
 
-                break;
+                fds[nfds].fd = eof ? -1 : fd;
+                fds[nfds].events = POLLIN;
+                nfds++;
 
-        case MARTEL_PARALLEL:
-                 /*save current settings*/
-                check(defparmode = martel_parallel_get_mode(port));
+                if (sidechannel) {
+                        fds[nfds].fd = CUPS_SC_FD;
+                        fds[nfds].events = POLLIN;
+                        nfds++;
+                }
+
+                if (poll(fds,nfds,-1)<0) {
+                        if (errno==EINTR)
+                                continue;
+                        perror("ERROR: poll - ");
+                        return 1;
+                }
 
-                /*setup printing settings as defaults if required*/
-                if (parmode==-1) {
-                        parmode = defparmode;
+                /*daemon messages, copied line by line*/
+                if (fds[0].revents) {
+                        if ((n = read(s,line+len,sizeof(line)-1-len))<=0) {
+                                fputs("ERROR: martel-printd closed connection\n",stderr);
+                                return 1;
+                        }
+                        len += n;
+                        line[len] = 0;
+
+                        while ((p = strchr(line,'\n'))!=NULL || len==sizeof(line)-1) {
+                                if (p==NULL)
+                                        p = line+len-1;
+                                *p = 0;
+
+                                if (strncmp(line,"END ",4)==0)
+                                        status = atoi(line+4);
+                                else
+                                        fprintf(stderr,"%s\n",line);
+
+                                len -= p+1-line;
+                                memmove(line,p+1,len+1);
+                        }
                 }
 
-                /*update parallel settings*/
-                check(martel_parallel_set_mode(port,parmode));
+                /*job data*/
+                if (fds[1].revents) {
+                        if ((n = printd_copy(fd,s))<0) {
+                                perror("ERROR: Unable to copy job to martel-printd - ");
+                                return 1;
+                        }
+
+                        if (n==0) {
+                                shutdown(s,SHUT_WR);
+                                eof = 1;
+                        }
+                }
 
-                break;
+                if (nfds>2 && fds[2].revents) {
+                        if (fds[2].revents&POLLIN)
+                                sc_unavailable();
+                        else
+                                sidechannel = 0;
+                }
+        }
 
-        case MARTEL_USB:
-                /*nothing to set*/
-                break;
-        }        
+        return status;
 }
 
 /*-----------------------------------------------------------------------------
-Name      :  setup_defaults
-Purpose   :  Revert to default port settings
+Name      :  list_printers
+Purpose   :  List detected printers for CUPS device discovery
 Inputs    :  <>
 Outputs   :  <>
 Return    :  <>
 -----------------------------------------------------------------------------*/
-static void setup_defaults(void)
+static void list_printers(void)
 {
-        int type;
+        martel_printer_t printers[PRINTERS_MAX];
+        int num;
+        int i;
 
-        check(type = martel_get_port_type(port));
-        
-        switch (type) {
-        case MARTEL_SERIAL:
-                check(martel_sync(port));
-                
-                check(martel_serial_set_baudrate(port,defbaudrate));
-                check(martel_serial_set_handshake(port,defhandshake));
+        if ((num = martel_detect_printers(printers,PRINTERS_MAX))<0) {
+                fprintf(stderr,"ERROR: %s\n",martel_strerror(num));
+                return;
+        }
 
-                break;
+        for (i=0; i<num; i++) {
+                char device[MARTEL_URI_MAX+1];
+                const char *model;
+                char *c;
 
-        case MARTEL_PARALLEL:
-                /*revert to default parallel settings*/
-                check(martel_parallel_set_mode(port,defparmode));
+                /*martel:device?options*/
+                strcpy(device,printers[i].uri+strlen("martel:"));
+                if ((c = strchr(device,'?'))!=NULL)
+                        *c = 0;
 
-                break;
+                if (printers[i].model==MODEL_UNKNOWN)
+                        model = "Unknown";
+                else
+                        model = martel_get_model_name(printers[i].model);
 
-        case MARTEL_USB:
-                /*nothing to set*/
-                break;
+                printf("%s %s \"MARTEL %s\" \"MARTEL printer on %s\" \"MFG:MARTEL;CMD:MARTEL;CLS:PRINTER;\"\n",
+                        strstr(printers[i].uri,"type=serial")!=NULL ? "serial" : "direct",
+                        printers[i].uri,model,device);
         }
 }
 
@@ -233,22 +483,31 @@ Return    :  0 if successful, 1 if program failed
 -----------------------------------------------------------------------------*/
 int main(int argc,char** argv)
 {
+        struct sigaction sa;
+        port_settings_t defaults;
+        int status;
         int fd;
-        int n;
-        unsigned char buf[BUFSIZE];
+        int s;
 
         atexit(clean);
         
         setbuf(stderr,NULL);
 
+        /*device discovery*/
+        if (argc==1) {
+                list_printers();
+                return 0;
+        }
+
         /*check arguments*/
         if (argc<6 || argc>7) {
                 fputs("ERROR: martel job-id user title copies options [file]\n",stderr);
                 return 1;
         }
 
-        /*retrieve options*/
-        get_options(argv[5]);
+        /*side channel is set up by the scheduler, check it before opening
+         *descriptors that could take its number*/
+        sidechannel = fcntl(CUPS_SC_FD,F_GETFD)!=-1;
 
         /*open input file*/
         if (argc==7) {
@@ -260,6 +519,34 @@ int main(int argc,char** argv)
         else
                 fd = 0; /*stdin*/
 
+        /*port is only opened once job data comes in*/
+        if ((status = wait_input(fd))<=0) {
+                if (status<0)
+                        perror("ERROR: Unable to read input file - ");
+                return status<0;
+        }
+
+        /*martel-printd keeps its ports open and set up, jobs for them go
+         *through it*/
+        if ((s = printd_connect())>=0) {
+                signal(SIGPIPE,SIG_IGN);
+
+                status = printd_print(s,fd,atoi(argv[1]),argv[3],argv[5]);
+                close(s);
+
+                if (status>=0)
+                        return status;
+        }
+
+        /*cancelled job gives port back at once (see job_cancel()), no
+         *SA_RESTART so that port waits are interrupted*/
+        memset(&sa,0,sizeof(sa));
+        sa.sa_handler = job_cancel;
+        sigaction(SIGTERM,&sa,NULL);
+
+        /*retrieve options*/
+        get_options(argv[5]);
+
         /*create printer port*/
         port = martel_create_port(getenv("DEVICE_URI"));
 
@@ -268,25 +555,20 @@ int main(int argc,char** argv)
 
         check(martel_get_error(port));
 
+        /*read input while port is set up*/
+        job_read(port,fd);
+
         /*open port*/
         check(martel_open(port));
 
         /*setup port settings for printing*/
-        setup();
-
-        /*setup printing timeout*/
-        check(martel_set_write_timeout(port,prtimeout));
-
-        /*write data to printer*/
-        while ((n = read(fd,buf,BUFSIZE))!=0) {
+        check(job_setup(port,&defaults));
 
-                check(martel_write(port,buf,n));
-        }
-
-        check(martel_sync(port));
+        if ((status = job_print(port,&defaults,sidechannel,atoi(argv[1]),argv[3]))!=0)
+                return status;
 
         /*revert port settings to defaults*/
-        setup_defaults();
+        check(job_setup_defaults(port,&defaults));
 
         /*close port*/
         check(martel_close(port));
@@ -302,7 +584,5 @@ int main(int argc,char** argv)
         }
 
         return 0;
-	cmd_reset(NULL);	/* shut compiler up */
 }
 
-
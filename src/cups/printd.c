@@ -0,0 +1,109 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : printd.c
+* DESCRIPTION   : martel-printd client routines (see printd.h)
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "printd.h"
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  printd_connect
+Purpose   :  Connect to martel-printd
+Inputs    :  <>
+Outputs   :  <>
+Return    :  socket or -1 if daemon is not running
+-----------------------------------------------------------------------------*/
+int printd_connect(void)
+{
+        struct sockaddr_un addr;
+        const char *path;
+        int s;
+
+        if ((path = getenv(PRINTD_SOCKET_ENV))==NULL)
+                path = PRINTD_SOCKET;
+
+        if (strlen(path)>=sizeof(addr.sun_path))
+                return -1;
+
+        if ((s = socket(AF_UNIX,SOCK_STREAM,0))<0)
+                return -1;
+
+        memset(&addr,0,sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path,path);
+
+        if (connect(s,(struct sockaddr *)&addr,sizeof(addr))<0) {
+                close(s);
+                return -1;
+        }
+
+        return s;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  printd_owns_port
+Purpose   :  Ask martel-printd whether it owns a port, jobs for it must then
+             go through the daemon
+Inputs    :  uri : device URI
+Outputs   :  <>
+Return    :  1 if daemon owns the port, 0 if not or daemon is not running
+-----------------------------------------------------------------------------*/
+int printd_owns_port(const char *uri)
+{
+        char line[PRINTD_LINE_MAX];
+        int len = 0;
+        int s;
+
+        if (strpbrk(uri,"\r\n")!=NULL || (s = printd_connect())<0)
+                return 0;
+
+        if (dprintf(s,"URI %s\nQUERY\n\n",uri)<0) {
+                close(s);
+                return 0;
+        }
+
+        while (len<sizeof(line)-1 && read(s,line+len,1)==1 && line[len]!='\n')
+                len++;
+        line[len] = 0;
+
+        close(s);
+
+        return strcmp(line,"OK")==0;
+}
@@ -0,0 +1,67 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : printd.h
+* DESCRIPTION   : martel-printd protocol, used by daemon and its clients
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#ifndef _PRINTD_H
+#define _PRINTD_H
+
+/*martel-printd owns printer ports and prints jobs sent over a local stream
+ *socket. A client sends a header made of text lines ending with an empty
+ *line:
+ *      URI <device URI>
+ *      PPD <PPD file>          (optional, port PPD is used otherwise)
+ *      OPTIONS <job options>   (optional, CUPS option string)
+ *      JOB <job ID> <title>    (optional, job is kept for reprint)
+ *      QUERY                   (optional, no job: client only asks whether
+ *                              the daemon owns the port)
+ *
+ *Each line appears at most once, headers with repeated or unknown lines
+ *are refused with ERROR.
+ *
+ *The daemon answers one line:
+ *      OK                      job is queued, client sends job data and
+ *                              shuts down its side of the socket at end
+ *                              (daemon owns the port for QUERY)
+ *      NOPORT                  daemon does not own this port
+ *      ERROR <message>
+ *
+ *While the job is printed, the daemon sends CUPS messages (STATE:, INFO:,
+ *ERROR: lines) and ends with:
+ *      END <exit status>
+ */
+
+#define PRINTD_SOCKET           "/var/run/martel-printd.socket"
+#define PRINTD_SOCKET_ENV       "MARTEL_PRINTD_SOCKET"  /*overrides default*/
+
+#define PRINTD_LINE_MAX         1024    /*bytes*/
+
+int     printd_connect(void);
+int     printd_owns_port(const char *uri);
+
+#endif /*_PRINTD_H*/
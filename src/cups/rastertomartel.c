@@ -46,177 +46,95 @@
 #include <martel/martel.h>
 
 #include "common.h"
+#include "setup.h"
+#include "printd.h"
 
 /* PRIVATE DEFINITIONS ------------------------------------------------------*/
 static const char id_str[] = "$Id: rastertomartel.c,v 1.1 2006/08/01 09:08:43 chris Exp $";
 
-
-#define BLACK   1
-#define WHITE   0
-
-static unsigned char bit_no[8] =
-                {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
-
+/*direct mode port settings found on port*/
+static port_settings_t  defaults;
 
 /* PRIVATE FUNCTIONS --------------------------------------------------------*/
 
 /*-----------------------------------------------------------------------------
-Name      :  consecutive_bits
-Purpose   :  count no of consecutive bit the same colour
-Inputs    :  bitmap : dotline buffer
-             max_bytes : width of dotline in bytes
-             line_no : which of 24 lines are we printing  
+Name      :  clean
+Purpose   :  Close direct mode port left open
+Inputs    :  <>
 Outputs   :  <>
-Return    :  count of pixels or bit image
+Return    :  <>
 -----------------------------------------------------------------------------*/
-static unsigned char consecutive_bits(unsigned char *bitmap, int bit_ptr, int max_bytes)
+static void clean(void)
 {
-        int i, j = bit_ptr;
-        int bit_clr;
-        unsigned char bits;
-
-        if ( bitmap[j / 8] & bit_no[j & 7])
-                bit_clr = BLACK;
-        else
-                bit_clr = WHITE;
-        for ( i = 0; (j < (max_bytes * 8)) && (i < 63); j++, i++ )
-        {
-                if ((( bitmap[j / 8] & bit_no[j & 7]) && (bit_clr == WHITE))
-                || (!( bitmap[j / 8] & bit_no[j & 7]) && (bit_clr == BLACK)))
-                        break; /* consecutive bits no longer the same */
+        if (direct_port!=NULL) {
+                martel_close(direct_port);
+                martel_destroy_port(direct_port);
         }
-        if (i > 7)
-        {
-                switch (bit_clr)
-                {
-                        case BLACK:
-                                bits = 0x40 | i;
-                                break;
-                        case WHITE:
-                                bits = 0x00 | i;
-                                break;
-                }
-        }
-        else /* 7 bit bit map */
-        {
-                unsigned char bit_mask = 0x40;
-
-                bits = 0x80;
-                for (i = 0; i < 7; i++)
-                {
-                        if ( bitmap[(bit_ptr + i) / 8] & bit_no[(bit_ptr + i) & 7])
-                        {
-                                bits  |= bit_mask;
-                        }
-                        else
-                        {
-                        }
-                        bit_mask >>= 1;
-                }
-        }
-        return(bits);
 }
 
-
 /*-----------------------------------------------------------------------------
-Name      :  convert_to_rle
-Purpose   :  Converts a dotline bit map to Martel Run Length Encoded bit
-             image gaphics
-             d7 d6 d5 d4 d3 d2 d1 d0
-             0  0  x  x  x  x  x  x RLE white pixels (0 to 63)
-             0  1  x  x  x  x  x  x RLE black pixels (0 to 63)
-             1  x  x  x  x  x  x  x Seven bit image pixels (0=white, 1=black)
-Inputs    :  bmp_in : dotline buffer
-             bytes_in : width of dotline in bytes
-Outputs   :  bytes_out : width of converted line in bytes
-Return    :  ptr to converted line (must free memory after use)
+Name      :  open_direct
+Purpose   :  Open and setup printer port for direct mode
+             Printer commands are then written to port instead of standard
+             output, so that the backend gets an empty job and leaves the
+             port alone. Ports owned by martel-printd are left to it, the
+             backend relays the job to the daemon as it is written.
+Inputs    :  <>
+Outputs   :  <>
+Return    :  <>
 -----------------------------------------------------------------------------*/
-/* 
- * 
- *
- *
- * returns rle bits
- */
-static unsigned char *convert_to_rle(unsigned char *bmp_in, int bytes_in, int *bytes_out)
+static void open_direct(void)
 {
-        unsigned char *rle_out = malloc(bytes_in * 2);  /* plenty of space */
-        int bit_ptr;            /* start at bit zero (MSB), byte zero */
-        unsigned char bits;
-        int i, j;
-
-        *bytes_out = 0;
-        if (rle_out == NULL)
-                return (NULL);
-        memset(rle_out, 0x00, bytes_in * 2);
-
-        /* check for blank line */
-        for (i = 0, j = 0; i < bytes_in; i++)
-        {
-                if (bmp_in[i])
-                {
-                        j = 1;
-                }
-        }
-        if (!j) /* no dots found so exit early */
-        {
-                rle_out[0] = 0;
-                *bytes_out = 1;
-                return(rle_out);
+        const char *uri = getenv("DEVICE_URI");
+        void *port;
+
+        if (uri==NULL || strncmp(uri,"martel:",7)!=0) {
+                fputs("WARNING: Direct mode needs a martel device URI\n",stderr);
+                return;
         }
 
-        for (bit_ptr = 0; bit_ptr < (bytes_in * 8); )
-        {
-                bits = consecutive_bits(bmp_in, bit_ptr, bytes_in);
-                if (bits & 0x80) /* 7 bit image byte */
-                {
-                        bit_ptr += 7;
-                }
-                else /* RLE byte */
-                {
-                        bit_ptr += (bits & 0x3f);
-                }
-                rle_out[(*bytes_out)++] = bits;
+        if (printd_owns_port(uri)) {
+                fputs("DEBUG: Port owned by martel-printd, direct mode off\n",stderr);
+                return;
         }
-        return(rle_out);
+
+        port = martel_create_port(uri);
+
+        if (port==NULL)
+                error("error creating port");
+
+        check(martel_get_error(port));
+
+        check(martel_open(port));
+
+        direct_port = port;
+
+        check(job_setup(port,&defaults));
+
+        check(martel_set_write_timeout(port,prtimeout));
 }
 
 /*-----------------------------------------------------------------------------
-Name      :  write_dotline
-Purpose   :  Write MARTEL commands to print given dotline
-Inputs    :  dotline : dotline buffer
-             num_bytes : width of dotline in bytes
-             line_no : which of 24 lines are we printing  
+Name      :  close_direct
+Purpose   :  Wait until printer port has sent everything, revert its
+             settings and close it
+Inputs    :  <>
 Outputs   :  <>
 Return    :  <>
 -----------------------------------------------------------------------------*/
-static void write_dotline(unsigned char *dotline,int num_bytes, int line_no)
+static void close_direct(void)
 {
-        unsigned char *rle_dotline;
-        int rle_bytes;
-
-        switch (printer_type) {
-        case MARTEL_MPP:
-        case MARTEL_MCP:
-                {
-                        unsigned char cmd[2] = { ESC,'Z' };
-
-                        if (line_no == 0)
-                                fwrite(cmd,sizeof(cmd),1,stdout);
-                        rle_dotline =
-                            convert_to_rle(dotline, num_bytes, &rle_bytes);
-                        fprintf(stdout, "%c", rle_bytes);
-                        fwrite(rle_dotline,rle_bytes,1,stdout);
-                        if (line_no == 23)
-                                fwrite("\n", 1, 1, stdout);
-                        free(rle_dotline);
-                }
-                break;
-        default:
-                error("unknown model type");
-                break;
-        }
-        
-        fflush(stdout);
+        flush_data();
+
+        check(martel_sync(direct_port));
+
+        check(job_setup_defaults(direct_port,&defaults));
+
+        check(martel_close(direct_port));
+
+        check(martel_destroy_port(direct_port));
+
+        direct_port = NULL;
 }
 
 /* PUBLIC FUNCTIONS ---------------------------------------------------------*/
@@ -236,6 +154,8 @@ int main(int argc,char** argv)
 	cups_page_header_t header;
 	int page;
 
+        atexit(clean);
+
 	setbuf(stderr,NULL);
 
 	/*check arguments*/
@@ -261,6 +181,10 @@ int main(int argc,char** argv)
 	if (ras==NULL)
 		error("cupsRasterOpen failed");
 
+        /*write to printer port without backend if required*/
+        if (direct==1)
+                open_direct();
+
         /*write ticket prolog*/
         write_prolog();
 
@@ -270,7 +194,6 @@ int main(int argc,char** argv)
                 int num_bytes;
 		int y;
 		unsigned char *dotline;
-                int line_no = 0;
 
 		page++;
 		fprintf(stderr,"PAGE: %d 1\n",page);
@@ -289,26 +212,19 @@ int main(int argc,char** argv)
 		for (y=0; y<header.cupsHeight; y++) {
                         if (cupsRasterReadPixels(ras,dotline,header.cupsBytesPerLine) != header.cupsBytesPerLine)
                                 error("cupsRasterReadPixels did not read enough data");
-                        write_dotline(dotline,num_bytes, line_no++);
-                        line_no %= 24;
+                        write_dotline(dotline,num_bytes);
 		}
                 /* finish printing 24 lines. */
-                {
-                        int left_over = (24 - (header.cupsHeight % 24)) % 24;
-                        dotline[0] = 0;
-                        num_bytes = 1;
-
-                        while (left_over--) {
-                                write_dotline(dotline,num_bytes, line_no++);
-                                line_no %= 24;
-                        }
-                }
+                flush_dotlines();
                 free(dotline);
 	}
 
         /*write ticket epilog*/
         write_epilog();
 
+        if (direct_port!=NULL)
+                close_direct();
+
 	/*close raster stream*/
 	cupsRasterClose(ras);
 
@@ -0,0 +1,389 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : reprint.c
+* DESCRIPTION   : Recently printed jobs kept for reprint
+*                 Command streams written to a printer are appended to a
+*                 memory mapped ring file, a job can be copied back from it
+*                 until newer jobs overwrite it
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <martel/martel.h>
+
+#include "reprint.h"
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+#define REPRINT_MAGIC           0x4d525052      /*MRPR*/
+#define REPRINT_VERSION         1
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  reprint_path
+Purpose   :  Build path of reprint ring file of device
+Inputs    :  uri : device URI
+             path : path buffer
+             size : path buffer size (includes trailing zero)
+Outputs   :  Fills path buffer
+Return    :  0 if successful, -1 on error
+-----------------------------------------------------------------------------*/
+static int reprint_path(const char *uri,char *path,int size)
+{
+        char device[MARTEL_URI_MAX+1];
+        const char *dir;
+        const char *c;
+        int n;
+
+        /*martel:device?options*/
+        if ((c = strchr(uri,':'))==NULL)
+                return -1;
+        c++;
+
+        for (n=0; *c && *c!='?' && n<MARTEL_URI_MAX; c++,n++)
+                device[n] = *c=='/' ? '_' : *c;
+        device[n] = 0;
+
+        if ((dir = getenv("CUPS_CACHEDIR"))==NULL)
+                dir = REPRINT_CACHE_DIR;
+
+        if (snprintf(path,size,"%s/" REPRINT_CACHE_PREFIX "%s",dir,device)>=size)
+                return -1;
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  header_valid
+Purpose   :  Check ring file header was written by this version
+Inputs    :  h : ring file header
+Outputs   :  <>
+Return    :  1 if valid, 0 otherwise
+-----------------------------------------------------------------------------*/
+static int header_valid(const reprint_header_t *h)
+{
+        return h->magic==REPRINT_MAGIC
+               && h->version==REPRINT_VERSION
+               && h->size==REPRINT_SIZE
+               && h->num_jobs==REPRINT_JOBS
+               && h->last>=0 && h->last<REPRINT_JOBS;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  job_valid
+Purpose   :  Check job was completely printed and is still in ring
+Inputs    :  h : ring file header
+             job : job slot
+Outputs   :  <>
+Return    :  1 if job can be reprinted, 0 otherwise
+-----------------------------------------------------------------------------*/
+static int job_valid(const reprint_header_t *h,const reprint_job_t *job)
+{
+        return job->job_id>0
+               && job->complete
+               && job->start>=h->head-REPRINT_SIZE
+               && job->start+job->length<=h->head;
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  reprint_open
+Purpose   :  Open and map reprint ring file of device
+Inputs    :  uri : device URI
+             create : 1 to create or reset file for writing, 0 to read it
+Outputs   :  <>
+Return    :  ring structure or NULL on error
+-----------------------------------------------------------------------------*/
+reprint_t *reprint_open(const char *uri,int create)
+{
+        char path[PATH_MAX];
+        reprint_t *r;
+        struct stat st;
+        int map_size = sizeof(reprint_header_t)+REPRINT_SIZE;
+        int fd;
+
+        if (uri==NULL || reprint_path(uri,path,sizeof(path))<0)
+                return NULL;
+
+        if ((fd = open(path,create ? O_RDWR|O_CREAT : O_RDONLY,0644))<0)
+                return NULL;
+
+        if ((r = calloc(1,sizeof(reprint_t)))==NULL) {
+                close(fd);
+                return NULL;
+        }
+
+        r->fd = fd;
+        r->map_size = map_size;
+        r->slot = -1;
+
+        flock(fd,LOCK_EX);
+
+        if (fstat(fd,&st)<0)
+                goto failed;
+
+        if (st.st_size!=map_size) {
+                if (!create || ftruncate(fd,0)<0 || ftruncate(fd,map_size)<0)
+                        goto failed;
+        }
+
+        r->map = mmap(NULL,map_size,create ? PROT_READ|PROT_WRITE : PROT_READ,
+                      MAP_SHARED,fd,0);
+        if (r->map==MAP_FAILED) {
+                r->map = NULL;
+                goto failed;
+        }
+
+        r->header = r->map;
+        r->data = (unsigned char *)(r->header+1);
+
+        if (!header_valid(r->header)) {
+                if (!create)
+                        goto failed;
+
+                memset(r->header,0,sizeof(reprint_header_t));
+                r->header->magic = REPRINT_MAGIC;
+                r->header->version = REPRINT_VERSION;
+                r->header->size = REPRINT_SIZE;
+                r->header->num_jobs = REPRINT_JOBS;
+        }
+
+        flock(fd,LOCK_UN);
+
+        return r;
+
+failed:
+        flock(fd,LOCK_UN);
+        reprint_close(r);
+        return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  reprint_close
+Purpose   :  Unmap and close reprint ring file, job being recorded is
+             dropped
+Inputs    :  r : ring structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void reprint_close(reprint_t *r)
+{
+        if (r==NULL)
+                return;
+
+        if (r->map!=NULL)
+                munmap(r->map,r->map_size);
+
+        close(r->fd);
+        free(r);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  reprint_begin
+Purpose   :  Start recording a job, it takes the slot of the oldest one
+Inputs    :  r : ring structure
+             job_id : CUPS job ID, job is not recorded if not positive
+             title : job title
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void reprint_begin(reprint_t *r,int job_id,const char *title)
+{
+        reprint_header_t *h = r->header;
+        reprint_job_t *job;
+
+        if (job_id<=0)
+                return;
+
+        flock(r->fd,LOCK_EX);
+
+        r->slot = (h->last+1)%REPRINT_JOBS;
+
+        job = &h->jobs[r->slot];
+        job->job_id = job_id;
+        strncpy(job->title,title!=NULL ? title : "",REPRINT_TITLE_MAX-1);
+        job->title[REPRINT_TITLE_MAX-1] = 0;
+        job->time = time(NULL);
+        job->start = h->head;
+        job->length = 0;
+        job->complete = 0;
+
+        h->last = r->slot;
+
+        flock(r->fd,LOCK_UN);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  reprint_add
+Purpose   :  Append data written to printer to job being recorded
+Inputs    :  r : ring structure
+             buf : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void reprint_add(reprint_t *r,const void *buf,int size)
+{
+        reprint_header_t *h = r->header;
+        const unsigned char *data = buf;
+
+        if (r->slot<0 || size<=0)
+                return;
+
+        flock(r->fd,LOCK_EX);
+
+        /*only the end of data larger than ring is kept, job is lost anyway*/
+        if (size>REPRINT_SIZE) {
+                h->head += size-REPRINT_SIZE;
+                h->jobs[r->slot].length += size-REPRINT_SIZE;
+                data += size-REPRINT_SIZE;
+                size = REPRINT_SIZE;
+        }
+
+        while (size>0) {
+                int offset = h->head%REPRINT_SIZE;
+                int n = REPRINT_SIZE-offset;
+
+                if (n>size)
+                        n = size;
+
+                memcpy(r->data+offset,data,n);
+
+                h->head += n;
+                h->jobs[r->slot].length += n;
+                data += n;
+                size -= n;
+        }
+
+        flock(r->fd,LOCK_UN);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  reprint_end
+Purpose   :  End recording of job, after printer took all its data
+Inputs    :  r : ring structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void reprint_end(reprint_t *r)
+{
+        if (r->slot<0)
+                return;
+
+        flock(r->fd,LOCK_EX);
+        r->header->jobs[r->slot].complete = 1;
+        flock(r->fd,LOCK_UN);
+
+        r->slot = -1;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  reprint_list
+Purpose   :  List jobs which can be reprinted, newest first
+Inputs    :  r : ring structure
+             jobs : job table
+             max : job table size
+Outputs   :  Fills job table
+Return    :  number of jobs
+-----------------------------------------------------------------------------*/
+int reprint_list(reprint_t *r,reprint_job_t *jobs,int max)
+{
+        const reprint_header_t *h = r->header;
+        int num = 0;
+        int i;
+
+        flock(r->fd,LOCK_SH);
+
+        for (i=0; i<REPRINT_JOBS && num<max; i++) {
+                const reprint_job_t *job = &h->jobs[(h->last-i+REPRINT_JOBS)%REPRINT_JOBS];
+
+                if (job_valid(h,job))
+                        jobs[num++] = *job;
+        }
+
+        flock(r->fd,LOCK_UN);
+
+        return num;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  reprint_copy
+Purpose   :  Copy command stream of newest matching job out of ring
+Inputs    :  r : ring structure
+             job_id : CUPS job ID, 0 for any
+             title : job title, NULL for any
+Outputs   :  buf : allocated buffer with job data, to be freed by caller
+Return    :  job data size in bytes or -1 if job is not found
+-----------------------------------------------------------------------------*/
+int reprint_copy(reprint_t *r,int job_id,const char *title,unsigned char **buf)
+{
+        const reprint_header_t *h = r->header;
+        int size = -1;
+        int i;
+
+        flock(r->fd,LOCK_SH);
+
+        for (i=0; i<REPRINT_JOBS; i++) {
+                const reprint_job_t *job = &h->jobs[(h->last-i+REPRINT_JOBS)%REPRINT_JOBS];
+                int offset;
+                int n;
+
+                if (!job_valid(h,job)
+                    || (job_id>0 && job->job_id!=job_id)
+                    || (title!=NULL && strcmp(job->title,title)!=0))
+                        continue;
+
+                if ((*buf = malloc(job->length+1))==NULL)
+                        break;
+
+                /*job may wrap around end of ring*/
+                size = job->length;
+                offset = job->start%REPRINT_SIZE;
+                n = REPRINT_SIZE-offset;
+                if (n>size)
+                        n = size;
+
+                memcpy(*buf,r->data+offset,n);
+                memcpy(*buf+n,r->data,size-n);
+                break;
+        }
+
+        flock(r->fd,LOCK_UN);
+
+        return size;
+}
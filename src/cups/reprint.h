@@ -0,0 +1,83 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : reprint.h
+* DESCRIPTION   : Recently printed jobs kept for reprint
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#ifndef _REPRINT_H
+#define _REPRINT_H
+
+#include <time.h>
+
+/*command streams of the last jobs written to a printer are kept in a ring
+ *file per device in CUPS cache directory, mapped in memory by writers and
+ *readers. Positions are absolute stream offsets: [head-REPRINT_SIZE,head)
+ *is kept in the ring, a job is lost once its start falls behind.*/
+#define REPRINT_SIZE            (1024*1024)     /*bytes*/
+#define REPRINT_JOBS            64
+#define REPRINT_TITLE_MAX       64              /*bytes, includes trailing zero*/
+
+#define REPRINT_CACHE_DIR       "/var/cache/cups"
+#define REPRINT_CACHE_PREFIX    "martel-reprint"
+
+typedef struct {
+        int             job_id;         /*0 if slot is unused*/
+        char            title[REPRINT_TITLE_MAX];
+        time_t          time;           /*job start*/
+        long long       start;          /*stream offset*/
+        long long       length;         /*bytes*/
+        int             complete;       /*printer took whole job*/
+} reprint_job_t;
+
+typedef struct {
+        unsigned int    magic;
+        unsigned int    version;
+        unsigned int    size;           /*REPRINT_SIZE*/
+        unsigned int    num_jobs;       /*REPRINT_JOBS*/
+        long long       head;
+        int             last;           /*slot of newest job*/
+        reprint_job_t   jobs[REPRINT_JOBS];
+} reprint_header_t;
+
+typedef struct {
+        int                     fd;
+        void *                  map;
+        int                     map_size;
+        reprint_header_t *      header;
+        unsigned char *         data;
+        int                     slot;   /*job being recorded, -1 if none*/
+} reprint_t;
+
+reprint_t *     reprint_open(const char *uri,int create);
+void            reprint_close(reprint_t *r);
+void            reprint_begin(reprint_t *r,int job_id,const char *title);
+void            reprint_add(reprint_t *r,const void *buf,int size);
+void            reprint_end(reprint_t *r);
+int             reprint_list(reprint_t *r,reprint_job_t *jobs,int max);
+int             reprint_copy(reprint_t *r,int job_id,const char *title,unsigned char **buf);
+
+#endif /*_REPRINT_H*/
@@ -0,0 +1,248 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : setup.c
+* DESCRIPTION   : Port setup for printing: serial and parallel settings from
+*                 PPD options, saved first so that they can be reverted
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <cups/cups.h>
+
+#include <martel/martel.h>
+
+#include "common.h"
+#include "setup.h"
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+/*detected serial baudrates are cached per device in CUPS cache directory*/
+#define BAUDRATE_CACHE_DIR      "/var/cache/cups"
+#define BAUDRATE_CACHE_PREFIX   "martel-baudrate"
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  baudrate_cache_path
+Purpose   :  Build path of file caching detected baudrate of port device
+Inputs    :  p    : port structure
+             path : path buffer
+             size : path buffer size (includes trailing zero)
+Outputs   :  Fills path buffer
+Return    :  0 if successful, -1 on error
+-----------------------------------------------------------------------------*/
+static int baudrate_cache_path(void *p,char *path,int size)
+{
+        char uri[MARTEL_URI_MAX+1];
+        const char *dir;
+        char *device;
+        char *c;
+
+        if (martel_get_port_uri(p,uri,sizeof(uri))<0)
+                return -1;
+
+        /*martel:device?options*/
+        if ((device = strchr(uri,':'))==NULL)
+                return -1;
+        device++;
+
+        if ((c = strchr(device,'?'))!=NULL)
+                *c = 0;
+
+        for (c=device; *c; c++)
+                if (*c=='/')
+                        *c = '_';
+
+        if ((dir = getenv("CUPS_CACHEDIR"))==NULL)
+                dir = BAUDRATE_CACHE_DIR;
+
+        if (snprintf(path,size,"%s/" BAUDRATE_CACHE_PREFIX "%s",dir,device)>=size)
+                return -1;
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  detect_baudrate
+Purpose   :  Detect printer baudrate, starting with cached one
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  baudrate or error code
+-----------------------------------------------------------------------------*/
+static int detect_baudrate(void *p)
+{
+        char path[PATH_MAX];
+        int cached = -1;
+        int baudrate;
+        FILE *f;
+
+        if (baudrate_cache_path(p,path,sizeof(path))<0)
+                path[0] = 0;
+
+        if (path[0] && (f = fopen(path,"r"))!=NULL) {
+                if (fscanf(f,"%d",&cached)!=1)
+                        cached = -1;
+                fclose(f);
+        }
+
+        if ((baudrate = martel_serial_detect_baudrate(p,printer_type,cached))<0)
+                return baudrate;
+
+        if (baudrate!=cached && path[0]) {
+                if ((f = fopen(path,"w"))!=NULL) {
+                        fprintf(f,"%d\n",baudrate);
+                        fclose(f);
+                }
+        }
+
+        fprintf(stderr,"DEBUG: Printer baudrate setting %d detected\n",baudrate);
+
+        return baudrate;
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  job_setup
+Purpose   :  Save current port settings (defaults) and setup port for printing
+Inputs    :  p : port structure
+Outputs   :  defaults : settings found on port
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int job_setup(void *p,port_settings_t *defaults)
+{
+        int type;
+        int errnum;
+
+        if ((type = martel_get_port_type(p))<0)
+                return type;
+
+        switch (type) {
+        case MARTEL_SERIAL:
+                /*save current settings*/
+                if ((defaults->baudrate = martel_serial_get_baudrate(p))<0)
+                        return defaults->baudrate;
+                if ((defaults->handshake = martel_serial_get_handshake(p))<0)
+                        return defaults->handshake;
+
+                if ((errnum = martel_sync(p))<0)
+                        return errnum;
+
+                /*use baudrate printer answers at, or port default one*/
+                if (prbaudrate==PRBAUDRATE_AUTO) {
+                        if ((prbaudrate = detect_baudrate(p))<0) {
+                                fprintf(stderr,"WARNING: %s, using default baudrate\n",
+                                                martel_strerror(prbaudrate));
+                                prbaudrate = -1;
+                        }
+                }
+
+                /*setup printing settings as defaults if required*/
+                if (prbaudrate==-1) {
+                        prbaudrate = defaults->baudrate;
+                }
+                if (prhandshake==-1) {
+                        prhandshake = defaults->handshake;
+                }
+
+                if ((errnum = martel_serial_set_baudrate(p,prbaudrate))<0)
+                        return errnum;
+                if ((errnum = martel_serial_set_handshake(p,prhandshake))<0)
+                        return errnum;
+
+                break;
+
+        case MARTEL_PARALLEL:
+                /*save current settings*/
+                if ((defaults->parmode = martel_parallel_get_mode(p))<0)
+                        return defaults->parmode;
+
+                /*setup printing settings as defaults if required*/
+                if (parmode==-1) {
+                        parmode = defaults->parmode;
+                }
+
+                /*update parallel settings*/
+                if ((errnum = martel_parallel_set_mode(p,parmode))<0)
+                        return errnum;
+
+                break;
+
+        case MARTEL_USB:
+                /*nothing to set*/
+                break;
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  job_setup_defaults
+Purpose   :  Revert to default port settings
+Inputs    :  p : port structure
+             defaults : settings saved by job_setup()
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int job_setup_defaults(void *p,const port_settings_t *defaults)
+{
+        int type;
+        int errnum;
+
+        if ((type = martel_get_port_type(p))<0)
+                return type;
+
+        switch (type) {
+        case MARTEL_SERIAL:
+                if ((errnum = martel_sync(p))<0)
+                        return errnum;
+
+                if ((errnum = martel_serial_set_baudrate(p,defaults->baudrate))<0)
+                        return errnum;
+                if ((errnum = martel_serial_set_handshake(p,defaults->handshake))<0)
+                        return errnum;
+
+                break;
+
+        case MARTEL_PARALLEL:
+                /*revert to default parallel settings*/
+                if ((errnum = martel_parallel_set_mode(p,defaults->parmode))<0)
+                        return errnum;
+
+                break;
+
+        case MARTEL_USB:
+                /*nothing to set*/
+                break;
+        }
+
+        return MARTEL_OK;
+}
@@ -0,0 +1,45 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : setup.h
+* DESCRIPTION   : Port setup for printing, shared by backend, printer daemon,
+*                 reprint tool and raster filter direct mode
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#ifndef _SETUP_H
+#define _SETUP_H
+
+/*port settings found before job_setup()*/
+typedef struct {
+        int     baudrate;
+        int     handshake;
+        int     parmode;
+} port_settings_t;
+
+int     job_setup(void *port,port_settings_t *defaults);
+int     job_setup_defaults(void *port,const port_settings_t *defaults);
+
+#endif /*_SETUP_H*/
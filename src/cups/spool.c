@@ -0,0 +1,445 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : spool.c
+* DESCRIPTION   : Backend job spool
+*                 A reader thread fills a ring buffer from the input file
+*                 while the backend writes the previous data to the printer
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spool.h"
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+/*sent part of spill file is given back to the file system in steps*/
+#define SPILL_FREE_STEP         (1024*1024)     /*bytes*/
+#define SPILL_DIR               "/tmp"          /*if TMPDIR is not set*/
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  unlock
+Purpose   :  Cancellation cleanup handler releasing spool lock
+Inputs    :  arg : spool structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void unlock(void *arg)
+{
+        spool_t *s = arg;
+
+        pthread_mutex_unlock(&s->lock);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  spill_open
+Purpose   :  Create and map spill file, it is unlinked at once and goes away
+             with the process
+             The whole file is allocated before it is used, a store to a
+             hole the file system has no room for would raise SIGBUS
+             Spilling is disabled if the file cannot be created, it only
+             waits for the printer this time if blocks freed by a previous
+             spill cannot be allocated again
+             Called with spool lock held
+Inputs    :  s : spool structure
+Outputs   :  <>
+Return    :  0 if successful, -1 on error
+-----------------------------------------------------------------------------*/
+static int spill_open(spool_t *s)
+{
+        char path[PATH_MAX];
+        const char *dir;
+        void *map;
+        int fd;
+
+        if (s->spill_map!=NULL)
+                return posix_fallocate(s->spill_fd,0,s->spill_max)==0 ? 0 : -1;
+
+        if ((dir = getenv("TMPDIR"))==NULL)
+                dir = SPILL_DIR;
+
+        if (snprintf(path,sizeof(path),"%s/martel-spoolXXXXXX",dir)>=sizeof(path)
+            || (fd = mkstemp(path))<0) {
+                s->spill_max = 0;
+                return -1;
+        }
+
+        unlink(path);
+
+        if (posix_fallocate(fd,0,s->spill_max)!=0
+            || (map = mmap(NULL,s->spill_max,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0))==MAP_FAILED) {
+                close(fd);
+                s->spill_max = 0;
+                return -1;
+        }
+
+        s->spill_fd = fd;
+        s->spill_map = map;
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  spill_free
+Purpose   :  Give sent part of spill file back to the file system
+             Called with spool lock held
+Inputs    :  s : spool structure
+             end : spill file offset up to which data was sent
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void spill_free(spool_t *s,long long end)
+{
+        if (end<=s->spill_freed)
+                return;
+
+        fallocate(s->spill_fd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+                  s->spill_freed,end-s->spill_freed);
+
+        s->spill_freed = end;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  reader
+Purpose   :  Reader thread, copies input file into ring buffer, or spill
+             file when ring is full, until end of file or read error
+Inputs    :  arg : spool structure
+Outputs   :  <>
+Return    :  NULL
+-----------------------------------------------------------------------------*/
+static void *reader(void *arg)
+{
+        spool_t *s = arg;
+        sigset_t set;
+
+        /*signals are handled by the writer*/
+        sigfillset(&set);
+        pthread_sigmask(SIG_BLOCK,&set,NULL);
+
+        while (1) {
+                unsigned char *buf;
+                long long room;
+                int pos;
+                ssize_t n;
+
+                /*wait for room in ring buffer or spill file*/
+                pthread_mutex_lock(&s->lock);
+                pthread_cleanup_push(unlock,s);
+
+                while (1) {
+                        /*everything sent: back to ring*/
+                        if (s->spill_start>=0 && s->send==s->head) {
+                                spill_free(s,s->head-s->spill_start);
+                                s->spill_start = -1;
+                                s->spill_freed = 0;
+                                s->tail = s->head;
+                        }
+
+                        if (s->spill_start<0) {
+                                if (s->head-s->tail<s->size) {
+                                        pos = s->head%s->size;
+                                        room = s->size-(s->head-s->tail);
+                                        if (room>s->size-pos)
+                                                room = s->size-pos;
+                                        buf = s->buf+pos;
+                                        break;
+                                }
+
+                                if (s->spill_max>0 && spill_open(s)==0) {
+                                        s->spill_start = s->head;
+                                        continue;
+                                }
+                        }
+                        else if (s->head-s->spill_start<s->spill_max) {
+                                room = s->spill_max-(s->head-s->spill_start);
+                                buf = s->spill_map+(s->head-s->spill_start);
+                                break;
+                        }
+
+                        pthread_cond_wait(&s->room,&s->lock);
+                }
+
+                pthread_cleanup_pop(1);
+
+                if (room>SSIZE_MAX)
+                        room = SSIZE_MAX;
+
+                /*data after head is not used by the writer, no lock needed*/
+                n = read(s->fd,buf,room);
+
+                if (n<0 && errno==EINTR)
+                        continue;
+
+                pthread_mutex_lock(&s->lock);
+
+                if (n>0) {
+                        s->head += n;
+                }
+                else {
+                        if (n<0)
+                                s->errnum = errno;
+                        s->eof = 1;
+                }
+
+                pthread_cond_signal(&s->data);
+
+                if (s->notify) {
+                        s->notify = 0;
+                        write(s->wake[1],"",1);
+                }
+
+                pthread_mutex_unlock(&s->lock);
+
+                if (n<=0)
+                        break;
+        }
+
+        return NULL;
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  spool_create
+Purpose   :  Create job spool
+Inputs    :  fd : input file descriptor
+             size : ring buffer size in bytes
+             spill : spill file size in bytes, 0 to wait for the printer
+                     when ring is full
+                     Regular input files are never spilled
+Outputs   :  <>
+Return    :  spool structure or NULL on error
+-----------------------------------------------------------------------------*/
+spool_t *spool_create(int fd,int size,long long spill)
+{
+        struct stat st;
+        spool_t *s;
+
+        if ((s = calloc(1,sizeof(spool_t)))==NULL)
+                return NULL;
+
+        if ((s->buf = malloc(size))==NULL) {
+                free(s);
+                return NULL;
+        }
+
+        if (pipe(s->wake)<0) {
+                free(s->buf);
+                free(s);
+                return NULL;
+        }
+
+        fcntl(s->wake[0],F_SETFL,O_NONBLOCK);
+
+        s->fd = fd;
+        s->size = size;
+
+        s->spill_start = -1;
+        s->spill_fd = -1;
+        if (spill>0 && fstat(fd,&st)==0 && !S_ISREG(st.st_mode))
+                s->spill_max = spill;
+
+        pthread_mutex_init(&s->lock,NULL);
+        pthread_cond_init(&s->data,NULL);
+        pthread_cond_init(&s->room,NULL);
+
+        return s;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  spool_start
+Purpose   :  Start reader thread
+Inputs    :  s : spool structure
+Outputs   :  <>
+Return    :  0 if successful, -1 on error
+-----------------------------------------------------------------------------*/
+int spool_start(spool_t *s)
+{
+        if (pthread_create(&s->reader,NULL,reader,s)!=0)
+                return -1;
+
+        s->started = 1;
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  spool_destroy
+Purpose   :  Stop reader thread and free spool
+Inputs    :  s : spool structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void spool_destroy(spool_t *s)
+{
+        if (s->started) {
+                pthread_cancel(s->reader);
+                pthread_join(s->reader,NULL);
+        }
+
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->data);
+        pthread_cond_destroy(&s->room);
+
+        close(s->wake[0]);
+        close(s->wake[1]);
+
+        if (s->spill_map!=NULL)
+                munmap(s->spill_map,s->spill_max);
+        if (s->spill_fd>=0)
+                close(s->spill_fd);
+
+        free(s->buf);
+        free(s);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  spool_get
+Purpose   :  Wait for data to send
+             Data is left in the spool until spool_consume() is called
+Inputs    :  s : spool structure
+             max : maximum size in bytes
+Outputs   :  buf : data pointer (inside ring buffer)
+Return    :  size of contiguous data in bytes, 0 at end of file or -1 if
+             input file could not be read (errno is set)
+-----------------------------------------------------------------------------*/
+int spool_get(spool_t *s,const unsigned char **buf,int max)
+{
+        int pos;
+        int n;
+
+        pthread_mutex_lock(&s->lock);
+
+        while (s->send==s->head && !s->eof)
+                pthread_cond_wait(&s->data,&s->lock);
+
+        if (s->send==s->head) {
+                if (s->errnum) {
+                        errno = s->errnum;
+                        n = -1;
+                }
+                else
+                        n = 0;
+        }
+        else if (s->spill_start>=0 && s->send>=s->spill_start) {
+                n = s->head-s->send;
+                if (n>max)
+                        n = max;
+                *buf = s->spill_map+(s->send-s->spill_start);
+        }
+        else {
+                pos = s->send%s->size;
+                n = (s->spill_start>=0 ? s->spill_start : s->head)-s->send;
+                if (n>s->size-pos)
+                        n = s->size-pos;
+                if (n>max)
+                        n = max;
+                *buf = s->buf+pos;
+        }
+
+        pthread_mutex_unlock(&s->lock);
+
+        return n;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  spool_ready
+Purpose   :  Check whether spool_get() would return without waiting
+             If not, spool descriptor becomes readable when it would.
+Inputs    :  s : spool structure
+Outputs   :  <>
+Return    :  1 if data or end of file is available, 0 otherwise
+-----------------------------------------------------------------------------*/
+int spool_ready(spool_t *s)
+{
+        char buf[16];
+        int ready;
+
+        /*clear previous notification*/
+        while (read(s->wake[0],buf,sizeof(buf))>0)
+                ;
+
+        pthread_mutex_lock(&s->lock);
+
+        ready = s->send<s->head || s->eof;
+        s->notify = !ready;
+
+        pthread_mutex_unlock(&s->lock);
+
+        return ready;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  spool_get_fd
+Purpose   :  Get descriptor to poll() for spool data (see spool_ready())
+Inputs    :  s : spool structure
+Outputs   :  <>
+Return    :  file descriptor
+-----------------------------------------------------------------------------*/
+int spool_get_fd(spool_t *s)
+{
+        return s->wake[0];
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  spool_consume
+Purpose   :  Mark data as sent, its room is given back to the reader thread
+Inputs    :  s : spool structure
+             n : size of data sent in bytes
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void spool_consume(spool_t *s,int n)
+{
+        pthread_mutex_lock(&s->lock);
+
+        s->send += n;
+
+        if (s->spill_start>=0 && s->send>s->spill_start) {
+                s->tail = s->spill_start;
+                spill_free(s,(s->send-s->spill_start)/SPILL_FREE_STEP*SPILL_FREE_STEP);
+        }
+        else
+                s->tail = s->send;
+
+        pthread_cond_signal(&s->room);
+        pthread_mutex_unlock(&s->lock);
+}
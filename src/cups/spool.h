@@ -0,0 +1,91 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : spool.h
+* DESCRIPTION   : Backend job spool (ring buffer filled by a reader thread)
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of the MARTEL Linux Driver.
+*
+*   MARTEL Linux Driver is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   MARTEL Linux Driver is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with MARTEL Linux Driver; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#ifndef _SPOOL_H
+#define _SPOOL_H
+
+#include <pthread.h>
+
+#define SPOOL_SIZE      (256*1024)      /*bytes*/
+#define SPOOL_SPILL_MAX (64*1024*1024)  /*bytes*/
+
+/*job data between input file and printer port
+ *positions are absolute stream offsets:
+ *      tail <= send <= head
+ *      [tail,send) sent data still kept in ring
+ *      [send,head) data waiting to be sent
+ *
+ *When spilling is enabled and the ring is full, input keeps being read
+ *into a memory mapped temporary file, so that the process writing the
+ *input is not held up by the printer:
+ *      [tail,spill_start) data in ring
+ *      [spill_start,head) data in spill file, at offset pos-spill_start
+ *The spill file is emptied and the ring used again once everything has
+ *been sent.
+ */
+typedef struct {
+        int             fd;
+        unsigned char * buf;
+        int             size;
+
+        long long       tail;
+        long long       send;
+        long long       head;
+
+        int             eof;
+        int             errnum;         /*errno of failed read, 0 if none*/
+
+        long long       spill_max;      /*spill file size, 0 if disabled*/
+        long long       spill_start;    /*-1 while data fits in ring*/
+        long long       spill_freed;    /*spill file bytes given back*/
+        int             spill_fd;
+        unsigned char * spill_map;
+
+        pthread_t       reader;
+        int             started;
+        pthread_mutex_t lock;
+        pthread_cond_t  data;           /*signaled when head or eof change*/
+        pthread_cond_t  room;           /*signaled when tail changes*/
+
+        /*pipe written by reader when data comes in and writer asked for
+         *it, so that writer can wait in poll() with other descriptors*/
+        int             wake[2];
+        int             notify;
+} spool_t;
+
+spool_t *       spool_create(int fd,int size,long long spill);
+int             spool_start(spool_t *s);
+void            spool_destroy(spool_t *s);
+int             spool_get(spool_t *s,const unsigned char **buf,int max);
+int             spool_ready(spool_t *s);
+int             spool_get_fd(spool_t *s);
+void            spool_consume(spool_t *s,int n);
+
+#endif /*_SPOOL_H*/
@@ -33,11 +33,18 @@
 *   27-Jul-06   CML     Initial revision
 ******************************************************************************/
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 
 #include <cups/cups.h>
 #include <cups/raster.h>
@@ -45,12 +52,24 @@
 #include <martel/martel.h>
 
 #include "common.h"
+#include "barcode.h"
+#include "bmfont.h"
 
 /* PRIVATE DEFINITIONS ------------------------------------------------------*/
 static const char id_str[] = "$Id: texttomartel.c,v 1.1 2006/08/01 09:08:49 chris Exp $";
 
 #define BUFSIZE 4096    /*bytes*/
 
+#define ZEROCOPY_CHUNK  (1024*1024)     /*bytes*/
+
+/*passthrough copy methods, tried in order*/
+typedef enum {
+        COPY_SPLICE     = 0,
+        COPY_FILE_RANGE = 1,
+        COPY_SENDFILE   = 2,
+        COPY_READWRITE  = 3
+} copy_method_t;
+
 static enum {
         PROCESSING_IDLE = 0,
         PROCESSING_TAG  = 1,
@@ -61,6 +80,20 @@ static enum {
 static int      tag_index;
 static char     tag_buf[TAG_BUFSIZE+1];
 
+/*text line waiting to be rendered with the host font*/
+#define TEXT_LINE_MAX   1024    /*bytes*/
+
+static bmfont_t *       host_font;
+static char             text_line[TEXT_LINE_MAX];
+static int              text_len;
+
+#define BARCODE_MODULE_WIDTH    2       /*dots*/
+#define BARCODE_QUIET_ZONE      10      /*modules*/
+#define BARCODE_HEIGHT          80      /*dotlines*/
+
+#define QR_MODULE_SIZE          4       /*dots*/
+#define QR_QUIET_ZONE           4       /*modules*/
+
 typedef struct {
         char *  text;
         int     value;
@@ -103,6 +136,22 @@ static const alias_t alias_table[] = {
 
 #define ALIAS_TABLE_SIZE        (sizeof(alias_table)/sizeof(alias_t))
 
+/*encoded images, kept while the filter runs*/
+#define IMAGE_CACHE_MAX         16      /*images*/
+
+typedef struct image {
+        struct image *  next;
+        char *          path;
+        struct timespec mtime;
+        off_t           size;           /*PBM file size*/
+        unsigned char * data;           /*encoded dotlines*/
+        int             data_size;
+        int             lines;
+} image_t;
+
+static image_t *        image_cache;
+static int              image_count;
+
 /* PRIVATE FUNCTIONS --------------------------------------------------------*/
 
 /*-----------------------------------------------------------------------------
@@ -134,6 +183,534 @@ static int tag_to_char(void)
         return -1;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  pbm_get_int
+Purpose   :  Read unsigned decimal value from PBM header
+             Whitespace and comments before value are skipped
+Inputs    :  f : PBM file
+Outputs   :  <>
+Return    :  value or -1 on error
+-----------------------------------------------------------------------------*/
+static int pbm_get_int(FILE *f)
+{
+        int c;
+        int n;
+
+        do {
+                c = getc(f);
+                if (c=='#') {
+                        while (c!='\n' && c!=EOF)
+                                c = getc(f);
+                }
+        } while (c!=EOF && isspace(c));
+
+        if (c==EOF || !isdigit(c))
+                return -1;
+
+        for (n=0; c!=EOF && isdigit(c); c = getc(f)) {
+                if (n>65535)
+                        return -1;
+                n = n*10 + c-'0';
+        }
+
+        return n;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  load_image
+Purpose   :  Load PBM image (raw or plain) and encode it as graphics dotlines
+             Image is clipped to the printer width
+Inputs    :  path : PBM file name
+             st : PBM file status
+Outputs   :  <>
+Return    :  image structure or NULL on error
+-----------------------------------------------------------------------------*/
+static image_t *load_image(const char *path,const struct stat *st)
+{
+        FILE *f;
+        image_t *img;
+        unsigned char *row;
+        unsigned char *p;
+        int raw;
+        int width,height;
+        int row_bytes,num_bytes;
+        int x,y;
+
+        if ((f = fopen(path,"rb"))==NULL)
+                return NULL;
+
+        /*parse header*/
+        if (getc(f)!='P') {
+                fclose(f);
+                return NULL;
+        }
+
+        switch (getc(f)) {
+        case '1':
+                raw = 0;
+                break;
+        case '4':
+                raw = 1;
+                break;
+        default:
+                fclose(f);
+                return NULL;
+        }
+
+        width = pbm_get_int(f);
+        height = pbm_get_int(f);
+
+        if (width<=0 || height<=0) {
+                fclose(f);
+                return NULL;
+        }
+
+        row_bytes = (width+7)/8;
+        num_bytes = (row_bytes>printer_width) ? printer_width : row_bytes;
+
+        img = calloc(1,sizeof(image_t));
+        row = calloc(1,row_bytes);
+
+        if (img!=NULL)
+                img->data = malloc((size_t)height*(num_bytes*2+1));
+
+        if (img==NULL || row==NULL || img->data==NULL)
+                goto fail;
+
+        /*read and encode rows*/
+        p = img->data;
+
+        for (y=0; y<height; y++) {
+                if (raw) {
+                        if (fread(row,1,row_bytes,f)!=row_bytes)
+                                goto fail;
+                }
+                else {
+                        memset(row,0,row_bytes);
+
+                        for (x=0; x<width; x++) {
+                                int c;
+
+                                do {
+                                        c = getc(f);
+                                        if (c=='#') {
+                                                while (c!='\n' && c!=EOF)
+                                                        c = getc(f);
+                                        }
+                                } while (c!=EOF && isspace(c));
+
+                                if (c=='1')
+                                        row[x/8] |= 0x80 >> (x%8);
+                                else if (c!='0')
+                                        goto fail;
+                        }
+                }
+
+                /*clear padding bits of last byte*/
+                if (width%8)
+                        row[row_bytes-1] &= 0xff << (8 - width%8);
+
+                p += encode_dotline(row,num_bytes,p);
+        }
+
+        img->path = strdup(path);
+        if (img->path==NULL)
+                goto fail;
+
+        img->mtime = st->st_mtim;
+        img->size = st->st_size;
+        img->data_size = p - img->data;
+        img->lines = height;
+
+        free(row);
+        fclose(f);
+
+        return img;
+
+fail:
+        if (img!=NULL) {
+                free(img->data);
+                free(img);
+        }
+        free(row);
+        fclose(f);
+
+        return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  free_image
+Purpose   :  Release image structure
+Inputs    :  img : image structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void free_image(image_t *img)
+{
+        free(img->path);
+        free(img->data);
+        free(img);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  get_image
+Purpose   :  Retrieve encoded image from cache, loading it if it is missing
+             or if the file changed since it was encoded
+             Most recently used images are kept at head of cache list
+Inputs    :  path : PBM file name
+Outputs   :  <>
+Return    :  image structure or NULL on error
+-----------------------------------------------------------------------------*/
+static image_t *get_image(const char *path)
+{
+        struct stat st;
+        image_t **pimg;
+        image_t *img;
+
+        if (stat(path,&st)<0)
+                return NULL;
+
+        /*lookup cache*/
+        for (pimg = &image_cache; *pimg!=NULL; pimg = &(*pimg)->next) {
+                img = *pimg;
+
+                if (strcmp(img->path,path)==0) {
+                        *pimg = img->next;
+                        image_count--;
+
+                        if (img->mtime.tv_sec==st.st_mtim.tv_sec &&
+                            img->mtime.tv_nsec==st.st_mtim.tv_nsec &&
+                            img->size==st.st_size) {
+                                img->next = image_cache;
+                                image_cache = img;
+                                image_count++;
+                                return img;
+                        }
+
+                        /*file changed: encode it again*/
+                        free_image(img);
+                        break;
+                }
+        }
+
+        if ((img = load_image(path,&st))==NULL)
+                return NULL;
+
+        /*drop least recently used image if cache is full*/
+        if (image_count==IMAGE_CACHE_MAX) {
+                for (pimg = &image_cache; (*pimg)->next!=NULL; pimg = &(*pimg)->next)
+                        ;
+                free_image(*pimg);
+                *pimg = NULL;
+                image_count--;
+        }
+
+        img->next = image_cache;
+        image_cache = img;
+        image_count++;
+
+        return img;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  write_image
+Purpose   :  Write MARTEL commands to print a PBM image
+             Image is printed as graphics bands, last band is completed
+             with blank dotlines
+Inputs    :  path : PBM file name
+Outputs   :  <>
+Return    :  0 if successful, -1 if image cannot be loaded
+-----------------------------------------------------------------------------*/
+static int write_image(const char *path)
+{
+        image_t *img;
+        const unsigned char *p;
+        int y;
+
+        if ((img = get_image(path))==NULL)
+                return -1;
+
+        for (p = img->data, y=0; y<img->lines; y++) {
+                write_encoded_dotline(p,p[0]+1);
+                p += p[0]+1;
+        }
+
+        flush_dotlines();
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  set_dots
+Purpose   :  Set a run of black dots in a dotline
+Inputs    :  dotline : dotline buffer
+             x : first dot
+             width : number of dots
+Outputs   :  Updates dotline buffer
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void set_dots(unsigned char *dotline,int x,int width)
+{
+        for (; width>0; x++, width--)
+                dotline[x/8] |= 0x80>>(x%8);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  write_barcode
+Purpose   :  Print linear barcode as graphics bands
+             The dotline is encoded once and repeated for the barcode height
+Inputs    :  args : "type data" tag arguments
+Outputs   :  <>
+Return    :  0 if successful, -1 if barcode cannot be encoded
+-----------------------------------------------------------------------------*/
+static int write_barcode(const char *args)
+{
+        static unsigned char modules[BARCODE_MODULES_MAX];
+        unsigned char dotline[DOTLINE_BYTES_MAX];
+        unsigned char buf[DOTLINE_ENCODED_MAX];
+        char name[16];
+        const char *data;
+        int type;
+        int n,size;
+        int module;
+        int x,i;
+
+        /*split symbology name and data*/
+        if ((data = strchr(args,' '))==NULL || data-args>=sizeof(name))
+                return -1;
+
+        memcpy(name,args,data-args);
+        name[data-args] = 0;
+        data++;
+
+        if ((type = barcode_get_type(name))==BARCODE_INVALID)
+                return -1;
+        if ((n = barcode_encode(type,data,modules,BARCODE_MODULES_MAX))<0)
+                return -1;
+
+        /*use largest module width fitting on paper, quiet zones included*/
+        for (module=BARCODE_MODULE_WIDTH; module>0; module--)
+                if ((n+2*BARCODE_QUIET_ZONE)*module <= printer_width*8)
+                        break;
+
+        if (module==0)
+                return -1;
+
+        memset(dotline,0,sizeof(dotline));
+
+        for (i=0, x=BARCODE_QUIET_ZONE*module; i<n; i++, x+=module)
+                if (modules[i])
+                        set_dots(dotline,x,module);
+
+        size = encode_dotline(dotline,printer_width,buf);
+
+        for (i=0; i<BARCODE_HEIGHT; i++)
+                write_encoded_dotline(buf,size);
+
+        flush_dotlines();
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  write_qr
+Purpose   :  Print QR code as graphics bands
+Inputs    :  data : data string
+Outputs   :  <>
+Return    :  0 if successful, -1 if QR code cannot be encoded
+-----------------------------------------------------------------------------*/
+static int write_qr(const char *data)
+{
+        static unsigned char matrix[QR_SIZE_MAX*QR_SIZE_MAX];
+        unsigned char dotline[DOTLINE_BYTES_MAX];
+        unsigned char buf[DOTLINE_ENCODED_MAX];
+        int n,size;
+        int module;
+        int x,y,i;
+
+        if ((n = qr_encode((const unsigned char *)data,strlen(data),matrix))<0)
+                return -1;
+
+        /*use largest module size fitting on paper, quiet zones included*/
+        for (module=QR_MODULE_SIZE; module>0; module--)
+                if ((n+2*QR_QUIET_ZONE)*module <= printer_width*8)
+                        break;
+
+        if (module==0)
+                return -1;
+
+        for (y=0; y<n; y++) {
+                memset(dotline,0,sizeof(dotline));
+
+                for (x=0; x<n; x++)
+                        if (matrix[y*n+x])
+                                set_dots(dotline,(QR_QUIET_ZONE+x)*module,module);
+
+                size = encode_dotline(dotline,printer_width,buf);
+
+                for (i=0; i<module; i++)
+                        write_encoded_dotline(buf,size);
+        }
+
+        flush_dotlines();
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  render_text
+Purpose   :  Render pending host font text, if any
+Inputs    :  <>
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void render_text(void)
+{
+        if (host_font!=NULL && text_len!=0) {
+                bmfont_write_line(host_font,text_line,text_len);
+                text_len = 0;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  end_text
+Purpose   :  Render pending host font text and complete graphics band, so
+             that printer commands can follow
+Inputs    :  <>
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void end_text(void)
+{
+        if (host_font!=NULL) {
+                render_text();
+                flush_dotlines();
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  put_text
+Purpose   :  Write text character
+             With a host font, characters are collected and rendered one
+             line at a time, otherwise they are sent to the printer
+Inputs    :  c : character
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void put_text(int c)
+{
+        if (host_font==NULL) {
+                fputc(c,stdout);
+        }
+        else if (c=='\n') {
+                /*empty lines still take one text line*/
+                bmfont_write_line(host_font,text_line,text_len);
+                text_len = 0;
+        }
+        else {
+                if (text_len==TEXT_LINE_MAX)
+                        render_text();
+                text_line[text_len++] = c;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  put_string
+Purpose   :  Write text string
+Inputs    :  s : string
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void put_string(const char *s)
+{
+        while (*s)
+                put_text(*s++);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  put_code
+Purpose   :  Write control code produced by a tag
+             With a host font, line feed ends the text line and other codes
+             are sent after the text rendered so far
+Inputs    :  c : control code
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void put_code(int c)
+{
+        if (host_font!=NULL && c==LF) {
+                put_text('\n');
+        }
+        else {
+                end_text();
+                fputc(c,stdout);
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  put_tag
+Purpose   :  Write current tag unchanged
+Inputs    :  closed : tag was closed by '>'
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void put_tag(int closed)
+{
+        put_text('<');
+        put_string(tag_buf);
+        if (closed)
+                put_text('>');
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  process_tag
+Purpose   :  Write MARTEL commands for current tag
+             <IMG file.pbm> prints a PBM image, <BARCODE type data> and
+             <QR data> print barcodes, other tags are control codes
+             Tags that cannot be converted are written unchanged
+Inputs    :  <>
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void process_tag(void)
+{
+        int n;
+
+        /*graphics continue the current band after pending text*/
+        render_text();
+
+        if (strncmp(tag_buf,"IMG ",4)==0) {
+                if (write_image(tag_buf+4)<0) {
+                        fprintf(stderr,"WARNING: Unable to print image %s\n",tag_buf+4);
+                        put_tag(1);
+                }
+                return;
+        }
+
+        if (strncmp(tag_buf,"BARCODE ",8)==0) {
+                if (write_barcode(tag_buf+8)<0) {
+                        fprintf(stderr,"WARNING: Unable to print barcode %s\n",tag_buf+8);
+                        put_tag(1);
+                }
+                return;
+        }
+
+        if (strncmp(tag_buf,"QR ",3)==0) {
+                if (write_qr(tag_buf+3)<0) {
+                        fprintf(stderr,"WARNING: Unable to print QR code %s\n",tag_buf+3);
+                        put_tag(1);
+                }
+                return;
+        }
+
+        n = tag_to_char();
+
+        if (n==-1)
+                put_tag(1);
+        else
+                put_code(n);
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  process_and_write
 Purpose   :  Process buffer data and write on standard output
@@ -154,27 +731,20 @@ static void process_and_write(char *buf,int bufsize)
                                 state = PROCESSING_TAG;
                         }
                         else
-                                fputc(c,stdout);
+                                put_text(c);
                         break;
                 
                 case PROCESSING_TAG:
                         if (c=='>') {
-                                int n;
-
                                 tag_buf[tag_index] = 0;
-                                n = tag_to_char();
-
-                                if (n==-1)
-                                        printf("<%s>",tag_buf);
-                                else
-                                        fputc(n,stdout);
+                                process_tag();
 
                                 state = PROCESSING_IDLE;
                         }
                         else {
                                 if (tag_index==TAG_BUFSIZE) {
                                         tag_buf[tag_index] = 0;
-                                        printf("<%s",tag_buf);
+                                        put_tag(0);
 
                                         state = PROCESSING_IDLE;
                                 }
@@ -188,6 +758,96 @@ static void process_and_write(char *buf,int bufsize)
         }
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  write_all
+Purpose   :  Write complete data buffer to file descriptor
+Inputs    :  fd : file descriptor
+             buf : data buffer
+             bufsize : data buffer size in bytes
+Outputs   :  <>
+Return    :  0 if successful, -1 on error (errno is set)
+-----------------------------------------------------------------------------*/
+static int write_all(int fd,const char *buf,int bufsize)
+{
+        while (bufsize) {
+                ssize_t n = write(fd,buf,bufsize);
+
+                if (n<0) {
+                        if (errno==EINTR)
+                                continue;
+                        return -1;
+                }
+
+                buf += n;
+                bufsize -= n;
+        }
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  passthrough
+Purpose   :  Copy input file to standard output without processing
+             Data is moved inside the kernel with splice() (input or output
+             is a pipe), copy_file_range() (both are files) or sendfile()
+             (input is a file). Each method is dropped as soon as the kernel
+             refuses it for this pair of descriptors, down to a plain
+             read()/write() loop.
+             Standard output stream is flushed first so that the ticket
+             prolog written through stdio stays in front of the data.
+Inputs    :  fd : input file descriptor
+Outputs   :  <>
+Return    :  0 if successful, -1 on error (errno is set)
+-----------------------------------------------------------------------------*/
+static int passthrough(int fd)
+{
+        copy_method_t method = COPY_SPLICE;
+        char buf[BUFSIZE];
+        ssize_t n;
+
+        if (fflush(stdout)==EOF)
+                return -1;
+
+        while (1) {
+                switch (method) {
+                case COPY_SPLICE:
+                        n = splice(fd,NULL,1,NULL,ZEROCOPY_CHUNK,SPLICE_F_MOVE|SPLICE_F_MORE);
+                        break;
+                case COPY_FILE_RANGE:
+                        n = copy_file_range(fd,NULL,1,NULL,ZEROCOPY_CHUNK,0);
+                        break;
+                case COPY_SENDFILE:
+                        n = sendfile(1,fd,NULL,ZEROCOPY_CHUNK);
+                        break;
+                default:
+                        n = read(fd,buf,sizeof(buf));
+                        if (n>0 && write_all(1,buf,n)<0)
+                                return -1;
+                        break;
+                }
+
+                if (n==0)
+                        break;  /*end of file*/
+
+                if (n<0) {
+                        if (errno==EINTR)
+                                continue;
+
+                        /*method not supported for these descriptors*/
+                        if (method!=COPY_READWRITE &&
+                            (errno==EINVAL || errno==ENOSYS || errno==EXDEV ||
+                             errno==EBADF || errno==ESPIPE || errno==EOPNOTSUPP)) {
+                                method++;
+                                continue;
+                        }
+
+                        return -1;
+                }
+        }
+
+        return 0;
+}
+
 /* PUBLIC FUNCTIONS ---------------------------------------------------------*/
 
 /*-----------------------------------------------------------------------------
@@ -215,6 +875,10 @@ int main(int argc,char** argv)
         /*retrieve options*/
         get_options(argv[5]);
 
+        /*map host font, printer font is used if it cannot be loaded*/
+        if (hostfont!=NULL && (host_font = bmfont_open(hostfont))==NULL)
+                fprintf(stderr,"WARNING: Unable to load font %s\n",hostfont);
+
 	/*open page stream*/
 	if (argc==7) {
 		if ((fd = open(argv[6],O_RDONLY))==-1) {
@@ -232,12 +896,25 @@ int main(int argc,char** argv)
         fprintf(stderr,"PAGE: 1 1\n");
 
         /*pipe text file to standard output*/
-        while ((n = read(fd,buf,sizeof(buf)))!=0) {
-                if (process)
+        if (process) {
+                while ((n = read(fd,buf,sizeof(buf)))>0)
                         process_and_write(buf,n);
-                else
-                        write(1,buf,n);
         }
+        else if (host_font!=NULL) {
+                while ((n = read(fd,buf,sizeof(buf)))>0) {
+                        int i;
+
+                        for (i=0; i<n; i++)
+                                put_text(buf[i]);
+                }
+        }
+        else if (passthrough(fd)<0) {
+                perror("ERROR: Unable to copy text file - ");
+                return 1;
+        }
+
+        /*complete text rendered with the host font*/
+        end_text();
 
         /*write ticket epilog*/
         write_epilog();
@@ -0,0 +1,445 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : detect.c
+* DESCRIPTION   : MARTEL library - printer detection
+*                 Candidate device nodes are probed in parallel threads,
+*                 with status requests (parallel ports: handshake lines).
+*                 Results are kept until candidate nodes are added to or
+*                 removed from /dev.
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd
+*
+*   This file is part of libmartel.
+*
+*   libmartel is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   libmartel is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with libmartel; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+
+#include <martel/martel.h>
+#include <martel/martel-private.h>
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+#define CANDIDATES_MAX          256
+#define PROBE_THREADS           16
+#define PROBE_TIMEOUT           200     /*ms, status answer*/
+
+#define INOTIFY_BUFSIZE         4096    /*bytes*/
+
+/*candidate device nodes*/
+typedef struct {
+        const char *    dir;
+        const char *    prefix;
+        int             type;
+} candidate_class_t;
+
+static const candidate_class_t classes[] = {
+        { "/dev",       "ttyS",         MARTEL_SERIAL   },
+        { "/dev",       "ttyUSB",       MARTEL_SERIAL   },
+        { "/dev",       "ttyACM",       MARTEL_USB      },
+        { "/dev",       "parport",      MARTEL_PARALLEL },
+};
+
+#define NUM_CLASSES     (sizeof(classes)/sizeof(classes[0]))
+
+typedef struct {
+        char            device[DEVICE_MAX+1];
+        int             type;
+        int             found;
+        martel_printer_t        printer;
+} candidate_t;
+
+/*probing state shared by threads*/
+typedef struct {
+        candidate_t *   candidates;
+        int             num;
+        int             next;
+        pthread_mutex_t lock;
+} probe_t;
+
+/*results of last detection, valid until inotify reports changes*/
+static pthread_mutex_t          cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static martel_printer_t *       cache;
+static int                      cache_num = -1;
+static int                      cache_fd = -1;
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  compare_candidates
+Purpose   :  qsort() callback ordering candidates by type and device name,
+             shorter names first so that ttyS2 comes before ttyS10
+Inputs    :  a, b : candidates
+Outputs   :  <>
+Return    :  <0, 0 or >0
+-----------------------------------------------------------------------------*/
+static int compare_candidates(const void *a,const void *b)
+{
+        const candidate_t *ca = a;
+        const candidate_t *cb = b;
+        int la = strlen(ca->device);
+        int lb = strlen(cb->device);
+
+        if (ca->type!=cb->type)
+                return ca->type-cb->type;
+        if (la!=lb)
+                return la-lb;
+
+        return strcmp(ca->device,cb->device);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  list_candidates
+Purpose   :  List device nodes which could have a printer behind them
+Inputs    :  candidates : candidate array
+             max        : candidate array size
+Outputs   :  Fills candidate array
+Return    :  number of candidates
+-----------------------------------------------------------------------------*/
+static int list_candidates(candidate_t *candidates,int max)
+{
+        int num = 0;
+        int i;
+
+        for (i=0; i<NUM_CLASSES; i++) {
+                const candidate_class_t *c = &classes[i];
+                struct dirent *e;
+                DIR *d;
+
+                if ((d = opendir(c->dir))==NULL)
+                        continue;
+
+                while ((e = readdir(d))!=NULL && num<max) {
+                        candidate_t *cd = &candidates[num];
+
+                        if (strncmp(e->d_name,c->prefix,strlen(c->prefix))!=0)
+                                continue;
+
+                        /*prefix must be followed by port number*/
+                        if (strspn(e->d_name+strlen(c->prefix),"0123456789")!=
+                            strlen(e->d_name+strlen(c->prefix)) ||
+                            e->d_name[strlen(c->prefix)]==0)
+                                continue;
+
+                        if (snprintf(cd->device,sizeof(cd->device),"%s/%s",
+                                     c->dir,e->d_name)>=sizeof(cd->device))
+                                continue;
+
+                        cd->type = c->type;
+                        cd->found = 0;
+                        num++;
+                }
+
+                closedir(d);
+        }
+
+        qsort(candidates,num,sizeof(candidate_t),compare_candidates);
+
+        return num;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  probe
+Purpose   :  Check whether a printer answers status requests behind device
+             Serial baudrate is detected and kept in printer URI
+Inputs    :  cd : candidate
+Outputs   :  Fills candidate printer if one was found
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void probe(candidate_t *cd)
+{
+        martel_status_t status;
+        void *port = NULL;
+        int errnum;
+
+        switch (cd->type) {
+        case MARTEL_SERIAL:
+                port = martel_create_serial_port(cd->device);
+                break;
+        case MARTEL_PARALLEL:
+                port = martel_create_parallel_port(cd->device);
+                break;
+        case MARTEL_USB:
+                port = martel_create_usb_port(cd->device);
+                break;
+        }
+
+        if (port==NULL)
+                return;
+
+        if (martel_get_error(port)<0 || martel_open(port)<0) {
+                martel_destroy_port(port);
+                return;
+        }
+
+        /*model type does not change status answer format*/
+        if (cd->type==MARTEL_SERIAL) {
+                errnum = martel_serial_detect_baudrate(port,MARTEL_MPP,-1);
+        }
+        else if (cd->type==MARTEL_PARALLEL) {
+                /*no status requests without real-time writes, printer
+                 *is recognized by its handshake lines*/
+                errnum = par_probe(port);
+        }
+        else {
+                martel_set_read_timeout(port,PROBE_TIMEOUT);
+                errnum = martel_get_status(port,MARTEL_MPP,&status);
+        }
+
+        if (errnum>=0) {
+                memset(&cd->printer,0,sizeof(cd->printer));
+                cd->printer.model = MODEL_UNKNOWN;
+
+                if (martel_get_port_uri(port,cd->printer.uri,sizeof(cd->printer.uri))>=0)
+                        cd->found = 1;
+        }
+
+        martel_close(port);
+        martel_destroy_port(port);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  probe_thread
+Purpose   :  Probe candidates until none is left
+Inputs    :  arg : probing state
+Outputs   :  <>
+Return    :  NULL
+-----------------------------------------------------------------------------*/
+static void *probe_thread(void *arg)
+{
+        probe_t *pr = arg;
+
+        for (;;) {
+                candidate_t *cd = NULL;
+
+                pthread_mutex_lock(&pr->lock);
+                if (pr->next<pr->num)
+                        cd = &pr->candidates[pr->next++];
+                pthread_mutex_unlock(&pr->lock);
+
+                if (cd==NULL)
+                        break;
+
+                probe(cd);
+        }
+
+        return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  probe_all
+Purpose   :  Probe candidates with a pool of threads. Port timeouts are
+             per-port deadlines, so candidates of any type can be probed
+             at the same time
+Inputs    :  candidates : candidate array
+             num        : number of candidates
+Outputs   :  Updates candidates
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void probe_all(candidate_t *candidates,int num)
+{
+        pthread_t threads[PROBE_THREADS];
+        probe_t pr;
+        int num_threads = 0;
+        int i;
+
+        pr.candidates = candidates;
+        pr.num = num;
+        pr.next = 0;
+        pthread_mutex_init(&pr.lock,NULL);
+
+        for (i=0; i<PROBE_THREADS && i<num; i++) {
+                if (pthread_create(&threads[num_threads],NULL,probe_thread,&pr)==0)
+                        num_threads++;
+        }
+
+        /*no thread could be started*/
+        if (num_threads==0)
+                probe_thread(&pr);
+
+        for (i=0; i<num_threads; i++)
+                pthread_join(threads[i],NULL);
+
+        pthread_mutex_destroy(&pr.lock);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  cache_watch
+Purpose   :  Watch candidate directories. A directory may only appear
+             with first device, so watches are added at each refresh
+Inputs    :  <>
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void cache_watch(void)
+{
+        int i;
+
+        for (i=0; i<NUM_CLASSES; i++) {
+                inotify_add_watch(cache_fd,classes[i].dir,
+                                IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO);
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  cache_changed
+Purpose   :  Check whether candidate nodes were added or removed since
+             cache was filled. Pending events are consumed
+Inputs    :  <>
+Outputs   :  <>
+Return    :  1 if cache is stale, 0 otherwise
+-----------------------------------------------------------------------------*/
+static int cache_changed(void)
+{
+        char buf[INOTIFY_BUFSIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+        int changed = 0;
+        ssize_t n;
+
+        while ((n = read(cache_fd,buf,sizeof(buf)))>0) {
+                char *c = buf;
+
+                while (c<buf+n) {
+                        struct inotify_event *ev = (struct inotify_event *)c;
+                        int i;
+
+                        for (i=0; i<NUM_CLASSES; i++) {
+                                const char *prefix = classes[i].prefix;
+
+                                if (ev->len && strncmp(ev->name,prefix,strlen(prefix))==0)
+                                        changed = 1;
+                        }
+
+                        if (ev->mask & IN_Q_OVERFLOW)
+                                changed = 1;
+
+                        c += sizeof(struct inotify_event)+ev->len;
+                }
+        }
+
+        return changed;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  cache_refresh
+Purpose   :  Probe all candidates and keep printers found in cache
+Inputs    :  <>
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int cache_refresh(void)
+{
+        candidate_t *candidates;
+        int num;
+        int i;
+
+        cache_num = -1;
+
+        candidates = malloc(CANDIDATES_MAX*sizeof(candidate_t));
+
+        if (candidates==NULL) {
+                return MARTEL_IO_ERROR;
+        }
+
+        num = list_candidates(candidates,CANDIDATES_MAX);
+
+        probe_all(candidates,num);
+
+        free(cache);
+        cache = malloc((num ? num : 1)*sizeof(martel_printer_t));
+
+        if (cache!=NULL) {
+                cache_num = 0;
+
+                for (i=0; i<num; i++) {
+                        if (candidates[i].found)
+                                cache[cache_num++] = candidates[i].printer;
+                }
+        }
+
+        free(candidates);
+
+        return cache_num<0 ? MARTEL_IO_ERROR : MARTEL_OK;
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_detect_printers
+Purpose   :  Detect printers on serial, USB and parallel ports
+             Printers do not report their model, so it is MODEL_UNKNOWN and
+             identity is empty. Serial printer URIs hold detected baudrate.
+             Results are cached until candidate device nodes are added or
+             removed.
+Inputs    :  printers : printer array
+             max      : printer array size
+Outputs   :  Fills printer array
+Return    :  number of printers found or error code
+-----------------------------------------------------------------------------*/
+int martel_detect_printers(martel_printer_t *printers,int max)
+{
+        martel_error_t errnum = MARTEL_OK;
+        int num;
+
+        pthread_mutex_lock(&cache_lock);
+
+        if (cache_fd<0) {
+                cache_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        }
+
+        if (cache_num<0 || cache_fd<0 || cache_changed()) {
+                /*watch before listing so that no change is missed*/
+                if (cache_fd>=0) {
+                        cache_watch();
+                        cache_changed();
+                }
+
+                errnum = cache_refresh();
+        }
+
+        if (errnum<0) {
+                pthread_mutex_unlock(&cache_lock);
+                return errnum;
+        }
+
+        num = cache_num<max ? cache_num : max;
+
+        if (num>0) {
+                memcpy(printers,cache,num*sizeof(martel_printer_t));
+        }
+
+        /*without inotify, results are not kept*/
+        if (cache_fd<0) {
+                cache_num = -1;
+        }
+
+        pthread_mutex_unlock(&cache_lock);
+
+        return num;
+}
@@ -0,0 +1,1109 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : engine.c
+* DESCRIPTION   : MARTEL library - asynchronous submission engine
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of libmartel.
+*
+*   libmartel is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   libmartel is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with libmartel; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+/* martel_submit_write() and martel_submit_read() queue buffers on ports,
+ * martel_reap() hands them to the kernel and reports completions. Built with
+ * HAVE_IO_URING (see Makefile), the engine runs them through an io_uring
+ * set up with raw system calls: every transfer started during a reap goes
+ * to the kernel in one io_uring_enter() call, which also waits for the
+ * completions. Without io_uring support in headers or kernel, and for
+ * ports without a descriptor (parallel, memory), martel_reap() runs the
+ * operations with the blocking martel_write() and martel_read().
+ *
+ * Operations on one port and direction are done one at a time in the order
+ * they were submitted, so short writes are resumed before the next buffer
+ * starts. A descriptor that is not ready completes with -EAGAIN; a poll
+ * request then waits for it without blocking an io_uring worker.
+ *
+ * Port write and read timeouts apply as for blocking calls: a transfer in
+ * flight is cancelled once no byte moved for that long, and a failure ends
+ * every operation queued in the same direction.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include <martel/martel.h>
+#include <martel/martel-private.h>
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+#define ENGINE_DEFDEPTH         64      /*submission queue entries*/
+#define ENGINE_MAXDEPTH         4096
+
+/*operation states*/
+#define OP_IDLE                 0       /*transfer to start*/
+#define OP_WAIT                 1       /*poll to start, port was not ready*/
+#define OP_BUSY                 2       /*request in flight*/
+
+/*request kinds, in low bits of io_uring user data*/
+#define TAG_TRANSFER            0
+#define TAG_POLL                1
+#define TAG_CANCEL              2
+#define TAG_MASK                3
+
+typedef struct engine_op {
+        struct engine_op *      next;
+        struct engine_port *    ep;
+        unsigned char * buf;
+        int             size;           /*bytes*/
+        int             done;           /*bytes transferred so far*/
+        long long       deadline;       /*us, monotonic, 0 if none*/
+        int             state;          /*OP_xxx*/
+        int             tag;            /*kind of request in flight*/
+        int             expired;        /*cancelled on timeout*/
+        martel_done_t   complete;
+        void *          ctx;
+} engine_op_t;
+
+typedef struct {
+        engine_op_t *   head;
+        engine_op_t *   tail;
+        int             event;          /*martel_event_t*/
+} engine_queue_t;
+
+struct engine_port {
+        struct engine_port *    next;
+        struct martel_engine *  engine;
+        martel_port_t * port;
+        int             fd;             /*-1 for blocking calls*/
+        engine_queue_t  writes;
+        engine_queue_t  reads;
+};
+
+typedef struct martel_engine {
+        int             mode;           /*martel_engine_mode_t*/
+        struct engine_port *    ports;
+        int             queued;         /*operations not completed*/
+        int             running;        /*inside martel_reap()*/
+        int             dropping;       /*destroying, completions not reported*/
+
+#ifdef HAVE_IO_URING
+        int             ring_fd;
+        unsigned        sq_entries;
+        unsigned        sq_tail;        /*next entry to fill*/
+        unsigned        to_submit;      /*entries filled, not submitted*/
+        unsigned *      sq_khead;
+        unsigned *      sq_ktail;
+        unsigned *      sq_kmask;
+        unsigned *      sq_karray;
+        struct io_uring_sqe *   sqes;
+        unsigned *      cq_khead;
+        unsigned *      cq_ktail;
+        unsigned *      cq_kmask;
+        struct io_uring_cqe *   cqes;
+        void *          sq_map;
+        size_t          sq_map_size;
+        void *          cq_map;
+        size_t          cq_map_size;
+        size_t          sqes_size;
+#endif
+} martel_engine_t;
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  op_failed
+Purpose   :  Get error code of failed operation
+Inputs    :  op    : operation
+             event : MARTEL_EVENT_WRITE or MARTEL_EVENT_READ
+Outputs   :  <>
+Return    :  error code
+-----------------------------------------------------------------------------*/
+static int op_failed(engine_op_t *op,int event)
+{
+        if (event==MARTEL_EVENT_WRITE) {
+                return op->expired ? MARTEL_WRITE_TIMEOUT : MARTEL_WRITE_FAILED;
+        }
+        else {
+                return op->expired ? MARTEL_READ_TIMEOUT : MARTEL_READ_FAILED;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_arm
+Purpose   :  Start timeout of first operation in queue
+Inputs    :  ep : port entry
+             q  : operation queue
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void queue_arm(struct engine_port *ep,engine_queue_t *q)
+{
+        int ms;
+
+        if (q->head==NULL) {
+                return;
+        }
+
+        if (q->event==MARTEL_EVENT_WRITE) {
+                ms = ep->port->write_timeout;
+        }
+        else {
+                ms = ep->port->read_timeout;
+        }
+
+        if (ms==0) {
+                q->head->deadline = 0;
+        }
+        else {
+                q->head->deadline = timeout_now()+ms*1000LL;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_complete
+Purpose   :  Remove first operation from queue and report it
+Inputs    :  ep     : port entry
+             q      : operation queue
+             errnum : operation result
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void queue_complete(struct engine_port *ep,engine_queue_t *q,int errnum)
+{
+        engine_op_t *op = q->head;
+
+        q->head = op->next;
+        if (q->head==NULL) {
+                q->tail = NULL;
+        }
+
+        queue_arm(ep,q);
+
+        ep->engine->queued--;
+        ep->port->errnum = errnum;
+
+        if (!ep->engine->dropping) {
+                op->complete(op->ctx,ep->port,q->event,op->buf,op->done,errnum);
+        }
+
+        free(op);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_fail
+Purpose   :  End every operation queued in one direction with an error
+             Operations queued by completion functions are kept
+Inputs    :  ep     : port entry
+             q      : operation queue
+             errnum : error code
+Outputs   :  <>
+Return    :  number of operations ended
+-----------------------------------------------------------------------------*/
+static int queue_fail(struct engine_port *ep,engine_queue_t *q,int errnum)
+{
+        engine_queue_t failed = *q;
+        int n = 0;
+
+        q->head = NULL;
+        q->tail = NULL;
+
+        while (failed.head!=NULL) {
+                queue_complete(ep,&failed,errnum);
+                n++;
+        }
+
+        return n;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_block
+Purpose   :  Run first operation in queue with a blocking call
+Inputs    :  ep : port entry
+             q  : operation queue
+Outputs   :  <>
+Return    :  number of operations completed
+-----------------------------------------------------------------------------*/
+static int queue_block(struct engine_port *ep,engine_queue_t *q)
+{
+        engine_op_t *op = q->head;
+        martel_error_t errnum;
+
+        if (ep->engine->dropping) {
+                return queue_fail(ep,q,op_failed(op,q->event));
+        }
+
+        if (q->event==MARTEL_EVENT_WRITE) {
+                /*port engine entry makes martel_write() bypass the
+                 *write-combining buffer: completion means port took data*/
+                errnum = martel_write(ep->port,op->buf,op->size);
+                op->done = ep->port->written;
+        }
+        else {
+                errnum = martel_read(ep->port,op->buf,op->size);
+                op->done = errnum==MARTEL_OK ? op->size : 0;
+        }
+
+        if (errnum<0) {
+                return queue_fail(ep,q,errnum);
+        }
+
+        queue_complete(ep,q,MARTEL_OK);
+
+        return 1;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  block_all
+Purpose   :  Run one operation per direction of ports without io_uring
+Inputs    :  e : engine structure
+Outputs   :  <>
+Return    :  number of operations completed
+-----------------------------------------------------------------------------*/
+static int block_all(martel_engine_t *e)
+{
+        struct engine_port *ep;
+        int completed = 0;
+
+        for (ep=e->ports; ep!=NULL; ep=ep->next) {
+                if (ep->fd>=0) {
+                        continue;
+                }
+                if (ep->writes.head!=NULL) {
+                        completed += queue_block(ep,&ep->writes);
+                }
+                if (ep->reads.head!=NULL) {
+                        completed += queue_block(ep,&ep->reads);
+                }
+        }
+
+        return completed;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  reap_ports
+Purpose   :  Free entries of ports without queued operations
+Inputs    :  e : engine structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void reap_ports(martel_engine_t *e)
+{
+        struct engine_port **pep = &e->ports;
+
+        while (*pep!=NULL) {
+                struct engine_port *ep = *pep;
+
+                if (ep->writes.head==NULL && ep->reads.head==NULL) {
+                        *pep = ep->next;
+                        ep->port->engine = NULL;
+                        free(ep);
+                }
+                else {
+                        pep = &ep->next;
+                }
+        }
+}
+
+#ifdef HAVE_IO_URING
+
+/*-----------------------------------------------------------------------------
+Name      :  ring_setup
+Purpose   :  Create io_uring and map its rings
+Inputs    :  e       : engine structure
+             entries : submission queue entries
+Outputs   :  <>
+Return    :  0 if successful, -1 if io_uring is not available
+-----------------------------------------------------------------------------*/
+static int ring_setup(martel_engine_t *e,unsigned entries)
+{
+        struct io_uring_params params;
+        char *sq;
+        char *cq;
+
+        memset(&params,0,sizeof(params));
+
+        if ((e->ring_fd = syscall(__NR_io_uring_setup,entries,&params))<0) {
+                return -1;
+        }
+
+        e->sq_entries = params.sq_entries;
+        e->sq_map_size = params.sq_off.array+params.sq_entries*sizeof(unsigned);
+        e->cq_map_size = params.cq_off.cqes
+                         +params.cq_entries*sizeof(struct io_uring_cqe);
+
+        /*both rings share one mapping on kernels since 5.4*/
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                if (e->cq_map_size>e->sq_map_size) {
+                        e->sq_map_size = e->cq_map_size;
+                }
+                e->cq_map_size = e->sq_map_size;
+        }
+
+        e->sq_map = mmap(NULL,e->sq_map_size,PROT_READ|PROT_WRITE,
+                         MAP_SHARED|MAP_POPULATE,e->ring_fd,IORING_OFF_SQ_RING);
+        if (e->sq_map==MAP_FAILED) {
+                close(e->ring_fd);
+                return -1;
+        }
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                e->cq_map = e->sq_map;
+        }
+        else {
+                e->cq_map = mmap(NULL,e->cq_map_size,PROT_READ|PROT_WRITE,
+                                 MAP_SHARED|MAP_POPULATE,e->ring_fd,
+                                 IORING_OFF_CQ_RING);
+                if (e->cq_map==MAP_FAILED) {
+                        munmap(e->sq_map,e->sq_map_size);
+                        close(e->ring_fd);
+                        return -1;
+                }
+        }
+
+        e->sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+        e->sqes = mmap(NULL,e->sqes_size,PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE,e->ring_fd,IORING_OFF_SQES);
+        if (e->sqes==MAP_FAILED) {
+                if (e->cq_map!=e->sq_map) {
+                        munmap(e->cq_map,e->cq_map_size);
+                }
+                munmap(e->sq_map,e->sq_map_size);
+                close(e->ring_fd);
+                return -1;
+        }
+
+        sq = e->sq_map;
+        e->sq_khead = (unsigned *)(sq+params.sq_off.head);
+        e->sq_ktail = (unsigned *)(sq+params.sq_off.tail);
+        e->sq_kmask = (unsigned *)(sq+params.sq_off.ring_mask);
+        e->sq_karray = (unsigned *)(sq+params.sq_off.array);
+
+        cq = e->cq_map;
+        e->cq_khead = (unsigned *)(cq+params.cq_off.head);
+        e->cq_ktail = (unsigned *)(cq+params.cq_off.tail);
+        e->cq_kmask = (unsigned *)(cq+params.cq_off.ring_mask);
+        e->cqes = (struct io_uring_cqe *)(cq+params.cq_off.cqes);
+
+        e->sq_tail = *e->sq_ktail;
+        e->to_submit = 0;
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  ring_teardown
+Purpose   :  Unmap and close io_uring
+Inputs    :  e : engine structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void ring_teardown(martel_engine_t *e)
+{
+        munmap(e->sqes,e->sqes_size);
+        if (e->cq_map!=e->sq_map) {
+                munmap(e->cq_map,e->cq_map_size);
+        }
+        munmap(e->sq_map,e->sq_map_size);
+        close(e->ring_fd);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  ring_enter
+Purpose   :  Submit filled entries and optionally wait for completions
+Inputs    :  e   : engine structure
+             min : completions to wait for, 0 not to wait
+Outputs   :  <>
+Return    :  0 if successful, -1 on error (errno is set)
+-----------------------------------------------------------------------------*/
+static int ring_enter(martel_engine_t *e,unsigned min)
+{
+        int n;
+
+        n = syscall(__NR_io_uring_enter,e->ring_fd,e->to_submit,min,
+                    min>0 ? IORING_ENTER_GETEVENTS : 0,NULL,0);
+
+        if (n<0) {
+                return -1;
+        }
+
+        e->to_submit -= n;
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  ring_get_sqe
+Purpose   :  Get free submission queue entry, submitting filled ones if the
+             queue is full
+Inputs    :  e : engine structure
+Outputs   :  <>
+Return    :  cleared entry or NULL if none is free
+-----------------------------------------------------------------------------*/
+static struct io_uring_sqe *ring_get_sqe(martel_engine_t *e)
+{
+        struct io_uring_sqe *sqe;
+        unsigned idx;
+
+        if (e->sq_tail-__atomic_load_n(e->sq_khead,__ATOMIC_ACQUIRE)
+            >=e->sq_entries) {
+                if (ring_enter(e,0)<0
+                    || e->sq_tail-__atomic_load_n(e->sq_khead,__ATOMIC_ACQUIRE)
+                       >=e->sq_entries) {
+                        return NULL;
+                }
+        }
+
+        idx = e->sq_tail & *e->sq_kmask;
+        sqe = &e->sqes[idx];
+        memset(sqe,0,sizeof(*sqe));
+
+        e->sq_karray[idx] = idx;
+
+        return sqe;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  ring_push
+Purpose   :  Hand entry filled after ring_get_sqe() to the kernel side
+Inputs    :  e : engine structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void ring_push(martel_engine_t *e)
+{
+        e->sq_tail++;
+        e->to_submit++;
+
+        __atomic_store_n(e->sq_ktail,e->sq_tail,__ATOMIC_RELEASE);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  ring_start
+Purpose   :  Queue transfer or poll request of first operation in queue
+Inputs    :  e  : engine structure
+             ep : port entry
+             q  : operation queue
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void ring_start(martel_engine_t *e,struct engine_port *ep,
+                       engine_queue_t *q)
+{
+        engine_op_t *op = q->head;
+        struct io_uring_sqe *sqe;
+
+        if ((sqe = ring_get_sqe(e))==NULL) {
+                /*tried again at next turn*/
+                return;
+        }
+
+        sqe->fd = ep->fd;
+
+        if (op->state==OP_WAIT) {
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->poll32_events = q->event==MARTEL_EVENT_WRITE ? POLLOUT : POLLIN;
+                op->tag = TAG_POLL;
+        }
+        else {
+                if (q->event==MARTEL_EVENT_WRITE) {
+                        sqe->opcode = IORING_OP_WRITE;
+                }
+                else {
+                        sqe->opcode = IORING_OP_READ;
+                }
+                sqe->addr = (uintptr_t)(op->buf+op->done);
+                sqe->len = op->size-op->done;
+                sqe->off = (__u64)-1;   /*current position, streams*/
+                op->tag = TAG_TRANSFER;
+        }
+
+        sqe->user_data = (uintptr_t)op | op->tag;
+
+        ring_push(e);
+
+        op->state = OP_BUSY;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  ring_cancel
+Purpose   :  Queue cancellation of request in flight of timed out operation
+Inputs    :  e  : engine structure
+             op : operation
+Outputs   :  <>
+Return    :  0 if queued, -1 if submission queue is full
+-----------------------------------------------------------------------------*/
+static int ring_cancel(martel_engine_t *e,engine_op_t *op)
+{
+        struct io_uring_sqe *sqe;
+
+        if ((sqe = ring_get_sqe(e))==NULL) {
+                return -1;
+        }
+
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (uintptr_t)op | op->tag;
+        sqe->user_data = (uintptr_t)op | TAG_CANCEL;
+
+        ring_push(e);
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  ring_done
+Purpose   :  Handle completion of request
+Inputs    :  data : request user data
+             res  : request result
+Outputs   :  <>
+Return    :  number of operations completed
+-----------------------------------------------------------------------------*/
+static int ring_done(__u64 data,int res)
+{
+        engine_op_t *op = (engine_op_t *)(uintptr_t)(data & ~(__u64)TAG_MASK);
+        struct engine_port *ep;
+        engine_queue_t *q;
+
+        if ((data & TAG_MASK)==TAG_CANCEL) {
+                /*the cancelled request reports the outcome*/
+                return 0;
+        }
+
+        ep = op->ep;
+        q = op==ep->writes.head ? &ep->writes : &ep->reads;
+
+        if ((data & TAG_MASK)==TAG_POLL) {
+                if (res<0 || op->expired) {
+                        return queue_fail(ep,q,op_failed(op,q->event));
+                }
+
+                op->state = OP_IDLE;
+                return 0;
+        }
+
+        if (res==-EAGAIN && !op->expired) {
+                /*port not ready, wait for it*/
+                op->state = OP_WAIT;
+                return 0;
+        }
+
+        if (res==-EINTR && !op->expired) {
+                /*blocking call of io_uring worker interrupted, start again*/
+                op->state = OP_IDLE;
+                return 0;
+        }
+
+        if (res<0 || (res==0 && op->size>0 && q->event==MARTEL_EVENT_READ)) {
+                /*end of file is a failure, as for blocking reads*/
+                return queue_fail(ep,q,op_failed(op,q->event));
+        }
+
+        op->done += res;
+
+        if (op->done==op->size) {
+                queue_complete(ep,q,MARTEL_OK);
+                return 1;
+        }
+
+        if (op->expired) {
+                return queue_fail(ep,q,op_failed(op,q->event));
+        }
+
+        /*short transfer, go on with the rest*/
+        queue_arm(ep,q);
+        op->state = OP_IDLE;
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  ring_harvest
+Purpose   :  Handle completions available in completion queue
+Inputs    :  e : engine structure
+Outputs   :  <>
+Return    :  number of operations completed
+-----------------------------------------------------------------------------*/
+static int ring_harvest(martel_engine_t *e)
+{
+        unsigned head = *e->cq_khead;
+        int completed = 0;
+
+        while (head!=__atomic_load_n(e->cq_ktail,__ATOMIC_ACQUIRE)) {
+                struct io_uring_cqe *cqe = &e->cqes[head & *e->cq_kmask];
+                __u64 data = cqe->user_data;
+                int res = cqe->res;
+
+                /*free entry before completion functions submit more*/
+                head++;
+                __atomic_store_n(e->cq_khead,head,__ATOMIC_RELEASE);
+
+                completed += ring_done(data,res);
+        }
+
+        return completed;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  ring_start_all
+Purpose   :  Queue requests of operations not in flight, unless engine is
+             being destroyed
+Inputs    :  e : engine structure
+Outputs   :  <>
+Return    :  number of operations with a request in flight
+-----------------------------------------------------------------------------*/
+static int ring_start_all(martel_engine_t *e)
+{
+        struct engine_port *ep;
+        int busy = 0;
+
+        for (ep=e->ports; ep!=NULL; ep=ep->next) {
+                engine_queue_t *q[2];
+                int i;
+
+                if (ep->fd<0) {
+                        continue;
+                }
+
+                q[0] = &ep->writes;
+                q[1] = &ep->reads;
+
+                for (i=0; i<2; i++) {
+                        if (q[i]->head==NULL) {
+                                continue;
+                        }
+                        if (q[i]->head->state!=OP_BUSY && !e->dropping) {
+                                ring_start(e,ep,q[i]);
+                        }
+                        if (q[i]->head->state==OP_BUSY) {
+                                busy++;
+                        }
+                }
+        }
+
+        return busy;
+}
+
+#endif /*HAVE_IO_URING*/
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_expire
+Purpose   :  Cancel or end first operation in queue if it timed out
+Inputs    :  e    : engine structure
+             ep   : port entry
+             q    : operation queue
+             now  : monotonic time in microseconds
+             wait : milliseconds until next deadline, -1 if none
+Outputs   :  Lowers wait to time left before deadline of queue
+Return    :  number of operations ended
+-----------------------------------------------------------------------------*/
+static int queue_expire(martel_engine_t *e,struct engine_port *ep,
+                        engine_queue_t *q,long long now,int *wait)
+{
+        engine_op_t *op = q->head;
+        long long left;
+
+        if (op==NULL || op->expired || ep->fd<0) {
+                return 0;
+        }
+
+        /*everything times out when engine is destroyed*/
+        if (!e->dropping) {
+                if (op->deadline==0) {
+                        return 0;
+                }
+
+                left = op->deadline-now;
+
+                if (left>0) {
+                        left = (left+999)/1000;
+                        if (*wait<0 || left<*wait) {
+                                *wait = left;
+                        }
+                        return 0;
+                }
+        }
+
+        if (op->state!=OP_BUSY) {
+                op->expired = 1;
+                return queue_fail(ep,q,op_failed(op,q->event));
+        }
+
+#ifdef HAVE_IO_URING
+        /*request ends with -ECANCELED, or completes if it was too late*/
+        if (ring_cancel(e,op)==0) {
+                op->expired = 1;
+        }
+#endif
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  submit
+Purpose   :  Queue operation on port
+Inputs    :  engine   : engine structure
+             port     : port structure
+             event    : MARTEL_EVENT_WRITE or MARTEL_EVENT_READ
+             buf      : data buffer
+             size     : data buffer size in bytes
+             complete : completion function
+             ctx      : completion function context
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int submit(void *engine,void *port,int event,void *buf,int size,
+                  martel_done_t complete,void *ctx)
+{
+        martel_engine_t *e = engine;
+        martel_port_t *p = port;
+        struct engine_port *ep;
+        engine_queue_t *q;
+        engine_op_t *op;
+
+        if (e==NULL || p==NULL || complete==NULL || e->dropping) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        if (!p->open) {
+                return MARTEL_PORT_NOT_OPEN;
+        }
+
+        if (p->reactor!=NULL) {
+                return MARTEL_PORT_IN_REACTOR;
+        }
+
+        if (p->engine!=NULL && p->engine->engine!=e) {
+                return MARTEL_PORT_BUSY;
+        }
+
+        if (buf==NULL || size<0) {
+                return MARTEL_IO_ERROR;
+        }
+
+        if ((ep = p->engine)==NULL) {
+                martel_error_t errnum;
+
+                /*queued writes must follow data held in write-combining
+                 *buffer, which is bypassed until the queues are empty*/
+                if ((errnum = martel_flush_output(p))<0) {
+                        return errnum;
+                }
+
+                if ((ep = calloc(1,sizeof(struct engine_port)))==NULL) {
+                        return MARTEL_IO_ERROR;
+                }
+
+                ep->engine = e;
+                ep->port = p;
+                ep->fd = -1;
+                ep->writes.event = MARTEL_EVENT_WRITE;
+                ep->reads.event = MARTEL_EVENT_READ;
+
+                if (e->mode==MARTEL_ENGINE_URING) {
+                        int fd = p->ops->get_fd(p);
+
+                        if (fd>=0) {
+                                ep->fd = fd;
+                        }
+                }
+
+                ep->next = e->ports;
+                e->ports = ep;
+                p->engine = ep;
+        }
+
+        if ((op = calloc(1,sizeof(engine_op_t)))==NULL) {
+                return MARTEL_IO_ERROR;
+        }
+
+        op->ep = ep;
+        op->buf = buf;
+        op->size = size;
+        op->state = OP_IDLE;
+        op->complete = complete;
+        op->ctx = ctx;
+
+        q = event==MARTEL_EVENT_WRITE ? &ep->writes : &ep->reads;
+
+        if (q->tail==NULL) {
+                q->head = op;
+                queue_arm(ep,q);
+        }
+        else {
+                q->tail->next = op;
+        }
+        q->tail = op;
+
+        e->queued++;
+
+        return MARTEL_OK;
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_create_engine
+Purpose   :  Create asynchronous submission engine
+             io_uring is used when built in and allowed by the kernel,
+             see martel_get_engine_mode
+Inputs    :  depth : requests handed to the kernel at once, 0 for default
+Outputs   :  <>
+Return    :  engine structure or NULL on error
+-----------------------------------------------------------------------------*/
+void *martel_create_engine(int depth)
+{
+        martel_engine_t *e;
+
+        if (depth<0 || depth>ENGINE_MAXDEPTH) {
+                return NULL;
+        }
+
+        if ((e = calloc(1,sizeof(martel_engine_t)))==NULL) {
+                return NULL;
+        }
+
+        e->mode = MARTEL_ENGINE_BLOCKING;
+
+#ifdef HAVE_IO_URING
+        if (ring_setup(e,depth==0 ? ENGINE_DEFDEPTH : depth)==0) {
+                e->mode = MARTEL_ENGINE_URING;
+        }
+#endif
+
+        return e;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_destroy_engine
+Purpose   :  Destroy engine. Queued operations are dropped without being
+             reported, requests in flight are cancelled first
+Inputs    :  engine : engine structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_destroy_engine(void *engine)
+{
+        martel_engine_t *e = engine;
+
+        if (e==NULL || e->running) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        /*every operation times out, requests in flight are waited for so
+         *that the kernel lets their buffers go*/
+        e->dropping = 1;
+
+        martel_reap(e,INT_MAX,0);
+
+#ifdef HAVE_IO_URING
+        if (e->mode==MARTEL_ENGINE_URING) {
+                ring_teardown(e);
+        }
+#endif
+
+        free(e);
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_get_engine_mode
+Purpose   :  Tell how engine runs operations
+Inputs    :  engine : engine structure
+Outputs   :  <>
+Return    :  engine mode (martel_engine_mode_t) or error code
+-----------------------------------------------------------------------------*/
+int martel_get_engine_mode(void *engine)
+{
+        martel_engine_t *e = engine;
+
+        if (e==NULL) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        return e->mode;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_submit_write
+Purpose   :  Queue data buffer to write to port
+             Buffer must stay valid until completion function is called
+Inputs    :  engine   : engine structure
+             port     : port structure
+             buf      : data buffer
+             size     : data buffer size in bytes
+             complete : completion function
+             ctx      : completion function context
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_submit_write(void *engine,void *port,const void *buf,int size,
+                        martel_done_t complete,void *ctx)
+{
+        return submit(engine,port,MARTEL_EVENT_WRITE,(void *)buf,size,
+                      complete,ctx);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_submit_read
+Purpose   :  Queue data buffer to fill with data read from port
+             Buffer must stay valid until completion function is called
+Inputs    :  engine   : engine structure
+             port     : port structure
+             buf      : data buffer
+             size     : data buffer size in bytes
+             complete : completion function
+             ctx      : completion function context
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_submit_read(void *engine,void *port,void *buf,int size,
+                       martel_done_t complete,void *ctx)
+{
+        return submit(engine,port,MARTEL_EVENT_READ,buf,size,complete,ctx);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_reap
+Purpose   :  Start queued operations and report completed ones
+             Operations submitted by completion functions are started
+             before returning. Blocking calls used without io_uring are
+             not interrupted when ms runs out
+Inputs    :  engine : engine structure
+             min    : operations to wait for, 0 to report those already
+                      completed; returns earlier once nothing is queued
+             ms     : longest wait in milliseconds, 0 for no limit
+Outputs   :  <>
+Return    :  number of operations completed or error code
+-----------------------------------------------------------------------------*/
+int martel_reap(void *engine,int min,int ms)
+{
+        martel_engine_t *e = engine;
+        long long end = 0;
+        int completed = 0;
+
+        if (e==NULL || e->running) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        if (ms!=0) {
+                end = timeout_now()+ms*1000LL;
+        }
+
+        e->running = 1;
+
+        for (;;) {
+                struct engine_port *ep;
+                long long now;
+                int wait = -1;
+
+                completed += block_all(e);
+
+#ifdef HAVE_IO_URING
+                if (e->mode==MARTEL_ENGINE_URING) {
+                        completed += ring_harvest(e);
+                }
+#endif
+
+                now = timeout_now();
+
+                for (ep=e->ports; ep!=NULL; ep=ep->next) {
+                        completed += queue_expire(e,ep,&ep->writes,now,&wait);
+                        completed += queue_expire(e,ep,&ep->reads,now,&wait);
+                }
+
+                if (completed>=min || e->queued==0) {
+                        break;
+                }
+
+                if (end!=0) {
+                        long long left = (end-now+999)/1000;
+
+                        if (left<=0) {
+                                break;
+                        }
+                        if (wait<0 || left<wait) {
+                                wait = left;
+                        }
+                }
+
+#ifdef HAVE_IO_URING
+                if (e->mode==MARTEL_ENGINE_URING) {
+                        if (ring_start_all(e)==0) {
+                                /*only blocking calls left*/
+                                continue;
+                        }
+
+                        if (wait<0) {
+                                /*submit and wait in one system call*/
+                                if (ring_enter(e,1)<0) {
+                                        if (errno!=EINTR) {
+                                                completed = MARTEL_IO_ERROR;
+                                        }
+                                        break;
+                                }
+                        }
+                        else {
+                                if (e->to_submit>0 && ring_enter(e,0)<0) {
+                                        completed = MARTEL_IO_ERROR;
+                                        break;
+                                }
+                                if (wait_fd(e->ring_fd,POLLIN,wait==0 ? 1 : wait)<0) {
+                                        if (errno!=EINTR) {
+                                                completed = MARTEL_IO_ERROR;
+                                        }
+                                        break;
+                                }
+                        }
+                }
+#endif
+        }
+
+#ifdef HAVE_IO_URING
+        if (e->mode==MARTEL_ENGINE_URING) {
+                ring_start_all(e);
+
+                if (e->to_submit>0 && ring_enter(e,0)<0 && completed>=0) {
+                        completed = MARTEL_IO_ERROR;
+                }
+        }
+#endif
+
+        e->running = 0;
+
+        reap_ports(e);
+
+        return completed;
+}
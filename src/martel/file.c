@@ -0,0 +1,542 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : file.c
+* DESCRIPTION   : MARTEL library - file and file descriptor port routines
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of libmartel.
+*
+*   libmartel is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   libmartel is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with libmartel; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+/* File ports write the command stream to a file, FIFO or character device
+ * (martel:/tmp/out.prn?type=file). Descriptor ports use a descriptor the
+ * application inherited or created, such as one end of a pipe or a socket
+ * (martel:3?type=fd); the descriptor is duplicated on open so that closing
+ * the port leaves it to the application.
+ *
+ * Neither type can tell how much data the other side has not taken yet, so
+ * martel_get_pending() is not implemented and callers never send status
+ * requests into the stream.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include <martel/martel.h>
+#include <martel/martel-private.h>
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+static  int     file_get_uri(martel_port_t *,char *,int);
+static  int     file_create_from_uri(martel_port_t *,struct martel_uri *);
+static  int     file_open(martel_port_t *);
+
+static  int     fd_get_uri(martel_port_t *,char *,int);
+static  int     fd_create_from_uri(martel_port_t *,struct martel_uri *);
+static  int     fd_open(martel_port_t *);
+static  int     fd_close(martel_port_t *);
+
+static  int     file_close(martel_port_t *);
+static  int     file_write(martel_port_t *,const void *,int);
+static  int     file_writev(martel_port_t *,const struct iovec *,int);
+static  int     file_read(martel_port_t *,void *,int);
+static  int     file_sync(martel_port_t *);
+static  int     file_flush(martel_port_t *);
+static  int     file_get_pending(martel_port_t *);
+static  int     file_get_fd(martel_port_t *);
+
+/* PUBLIC DEFINITIONS -------------------------------------------------------*/
+
+const martel_ops_t file_ops = {
+        MARTEL_FILE,
+        "file",
+        file_get_uri,
+        file_create_from_uri,
+        file_open,
+        file_close,
+        file_write,
+        file_writev,
+        file_write,
+        file_read,
+        file_sync,
+        file_flush,
+        file_get_pending,
+        file_get_fd
+};
+
+const martel_ops_t fd_ops = {
+        MARTEL_FD,
+        "fd",
+        fd_get_uri,
+        fd_create_from_uri,
+        fd_open,
+        fd_close,
+        file_write,
+        file_writev,
+        file_write,
+        file_read,
+        file_sync,
+        file_flush,
+        file_get_pending,
+        file_get_fd
+};
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  file_get_uri
+Purpose   :  Get URI string defining file port
+Inputs    :  p    : port structure
+             uri  : URI string buffer
+             size : URI string buffer size (includes trailing zero)
+Outputs   :  Fills URI string buffer
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int file_get_uri(martel_port_t *p,char *uri,int size)
+{
+        if (snprintf(uri,size,"martel:%s?type=file",
+                        p->set.file.device)>=size) {
+                return MARTEL_INVALID_URI;
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  file_create_from_uri
+Purpose   :  Create file port from URI string
+Inputs    :  p  : port structure
+             su : URI structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int file_create_from_uri(martel_port_t *p,struct martel_uri *su)
+{
+        const char *device;
+
+        if ((device = uri_get_device(su))==NULL) {
+                return MARTEL_INVALID_URI;
+        }
+
+        if (strlen(device)>sizeof(p->set.file.device)-1) {
+                return MARTEL_NAME_TOO_LONG;
+        }
+
+        strcpy(p->set.file.device,device);
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  file_open
+Purpose   :  Open file port, truncating regular files
+             O_NONBLOCK keeps FIFOs without reader from blocking open
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int file_open(martel_port_t *p)
+{
+        int fd;
+
+        fd = open(p->set.file.device,O_WRONLY|O_CREAT|O_TRUNC|O_NONBLOCK|O_NOCTTY,0666);
+
+        if (fd<0) {
+                return MARTEL_OPEN_FAILED;
+        }
+
+        p->set.file.fd = fd;
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  fd_get_uri
+Purpose   :  Get URI string defining descriptor port
+Inputs    :  p    : port structure
+             uri  : URI string buffer
+             size : URI string buffer size (includes trailing zero)
+Outputs   :  Fills URI string buffer
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int fd_get_uri(martel_port_t *p,char *uri,int size)
+{
+        if (snprintf(uri,size,"martel:%s?type=fd",
+                        p->set.file.device)>=size) {
+                return MARTEL_INVALID_URI;
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  fd_create_from_uri
+Purpose   :  Create descriptor port from URI string, device is the
+             descriptor number
+Inputs    :  p  : port structure
+             su : URI structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int fd_create_from_uri(martel_port_t *p,struct martel_uri *su)
+{
+        const char *device;
+        char *end;
+        long fd;
+
+        if ((device = uri_get_device(su))==NULL) {
+                return MARTEL_INVALID_URI;
+        }
+
+        fd = strtol(device,&end,10);
+
+        if (*end!=0 || fd<0 || fd>=0x10000) {
+                return MARTEL_INVALID_URI;
+        }
+
+        snprintf(p->set.file.device,sizeof(p->set.file.device),"%ld",fd);
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  fd_open
+Purpose   :  Open descriptor port
+             The duplicate shares status flags with the descriptor, which is
+             non-blocking while the port is open so that writes keep to the
+             write timeout
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int fd_open(martel_port_t *p)
+{
+        int flags;
+        int fd;
+
+        if ((fd = fcntl(atoi(p->set.file.device),F_DUPFD_CLOEXEC,3))<0) {
+                return MARTEL_OPEN_FAILED;
+        }
+
+        if ((flags = fcntl(fd,F_GETFL))<0
+            || fcntl(fd,F_SETFL,flags|O_NONBLOCK)<0) {
+                close(fd);
+                return MARTEL_OPEN_FAILED;
+        }
+
+        p->set.file.fd = fd;
+        p->set.file.flags = flags;
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  fd_close
+Purpose   :  Close descriptor port, giving back original status flags
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int fd_close(martel_port_t *p)
+{
+        fcntl(p->set.file.fd,F_SETFL,p->set.file.flags);
+
+        return file_close(p);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  file_close
+Purpose   :  Close file or descriptor port
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int file_close(martel_port_t *p)
+{
+        if (close(p->set.file.fd)<0) {
+                return MARTEL_CLOSE_FAILED;
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  file_write
+Purpose   :  Write data buffer to file or descriptor port
+             There is no handshaking to bypass, real-time writes use this
+             routine as well
+Inputs    :  p    : port structure
+             buf  : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int file_write(martel_port_t *p,const void *buf,int size)
+{
+        martel_error_t errnum = MARTEL_OK;
+        p->written = 0;
+
+        while (size) {
+                int n;
+
+                /*wait until some room is available*/
+                rt_io_begin(p);
+                n = wait_fd(p->set.file.fd,POLLOUT,p->write_timeout);
+                rt_io_end(p);
+
+                if (n<0) {
+                        errnum = MARTEL_WRITE_FAILED;
+                        break;
+                }
+                else if (n==0) {
+                        errnum = MARTEL_WRITE_TIMEOUT;
+                        break;
+                }
+
+                /*write some bytes*/
+                rt_io_begin(p);
+                n = write(p->set.file.fd,buf,size);
+                rt_io_end(p);
+
+                if (n<0) {
+                        if (errno==EAGAIN) {
+                                continue;
+                        }
+                        errnum = MARTEL_WRITE_FAILED;
+                        break;
+                }
+                else {
+                        buf += n;
+                        size -= n;
+                        p->written += n;
+                }
+        }
+
+        return errnum;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  file_writev
+Purpose   :  Write data fragments to file or descriptor port
+Inputs    :  p   : port structure
+             iov : data fragments
+             n   : number of fragments
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int file_writev(martel_port_t *p,const struct iovec *iov,int n)
+{
+        return writev_fd(p,p->set.file.fd,iov,n);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  file_splice
+Purpose   :  Move data from descriptor to file or descriptor port inside the
+             kernel: splice() when either end is a pipe, copy_file_range()
+             between files, sendfile() from a file to anything else
+Inputs    :  p    : port structure
+             fd   : input descriptor
+             size : maximum number of bytes to move
+Outputs   :  <>
+Return    :  number of bytes moved (0 at end of input), MARTEL_NOT_IMPLEMENTED
+             if the kernel cannot move data between both descriptors, or
+             error code
+-----------------------------------------------------------------------------*/
+int file_splice(martel_port_t *p,int fd,int size)
+{
+        int out = p->set.file.fd;
+        int n;
+
+        p->written = 0;
+
+        while (1) {
+                /*wait until some room is available*/
+                rt_io_begin(p);
+                n = wait_fd(out,POLLOUT,p->write_timeout);
+                rt_io_end(p);
+
+                if (n<0) {
+                        return MARTEL_WRITE_FAILED;
+                }
+                else if (n==0) {
+                        return MARTEL_WRITE_TIMEOUT;
+                }
+
+                /*each call fails without moving data when it does not
+                 *support the descriptors, none blocks on port*/
+                rt_io_begin(p);
+                n = splice(fd,NULL,out,NULL,size,SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+                if (n<0 && errno==EINVAL) {
+                        n = copy_file_range(fd,NULL,out,NULL,size,0);
+                }
+                if (n<0 && (errno==EINVAL || errno==EXDEV || errno==EBADF
+                            || errno==ENOSYS || errno==EOPNOTSUPP)) {
+                        n = sendfile(out,fd,NULL,size);
+                }
+                rt_io_end(p);
+
+                if (n>=0) {
+                        p->written = n;
+                        return n;
+                }
+
+                if (errno==EINTR) {
+                        continue;
+                }
+
+                /*input pipe may be empty as well as port full, wait for
+                 *input like a read would before waiting for port again*/
+                if (errno==EAGAIN) {
+                        if (wait_fd(fd,POLLIN,0)<0) {
+                                return MARTEL_READ_FAILED;
+                        }
+                        continue;
+                }
+
+                if (errno==EINVAL || errno==ENOSYS || errno==ESPIPE
+                    || errno==EOPNOTSUPP) {
+                        return MARTEL_NOT_IMPLEMENTED;
+                }
+
+                return MARTEL_WRITE_FAILED;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  file_read
+Purpose   :  Read data buffer from file or descriptor port
+Inputs    :  p    : port structure
+             buf  : data buffer
+             size : data buffer size in bytes
+Outputs   :  Fills data buffer
+Return    :  MARTEL_OK or error code (MARTEL_READ_FAILED at end of file)
+-----------------------------------------------------------------------------*/
+static int file_read(martel_port_t *p,void *buf,int size)
+{
+        martel_error_t errnum = MARTEL_OK;
+        while (size) {
+                int n;
+
+                /*wait until some bytes are available*/
+                rt_io_begin(p);
+                n = wait_fd(p->set.file.fd,POLLIN,p->read_timeout);
+                rt_io_end(p);
+
+                if (n<0) {
+                        errnum = MARTEL_READ_FAILED;
+                        break;
+                }
+                else if (n==0) {
+                        errnum = MARTEL_READ_TIMEOUT;
+                        break;
+                }
+
+                /*read some bytes*/
+                rt_io_begin(p);
+                n = read(p->set.file.fd,buf,size);
+                rt_io_end(p);
+
+                if (n<0 && errno==EAGAIN) {
+                        continue;
+                }
+                else if (n<=0) {
+                        errnum = MARTEL_READ_FAILED;
+                        break;
+                }
+                else {
+                        buf += n;
+                        size -= n;
+                }
+        }
+
+        return errnum;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  file_sync
+Purpose   :  Block until written data is taken. Data written to a file or
+             descriptor is taken as soon as write returns
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int file_sync(martel_port_t *p)
+{
+        if (isatty(p->set.file.fd) && tcdrain(p->set.file.fd)<0) {
+                return MARTEL_SYNC_FAILED;
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  file_flush
+Purpose   :  Discard data not taken yet. Only terminals keep such data
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int file_flush(martel_port_t *p)
+{
+        if (isatty(p->set.file.fd) && tcflush(p->set.file.fd,TCIOFLUSH)<0) {
+                return MARTEL_FLUSH_FAILED;
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  file_get_pending
+Purpose   :  Get number of bytes written but not taken yet (see top of file)
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_NOT_IMPLEMENTED
+-----------------------------------------------------------------------------*/
+static int file_get_pending(martel_port_t *p)
+{
+        return MARTEL_NOT_IMPLEMENTED;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  file_get_fd
+Purpose   :  Get descriptor of file or descriptor port for event loops
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  descriptor
+-----------------------------------------------------------------------------*/
+static int file_get_fd(martel_port_t *p)
+{
+        return p->set.file.fd;
+}
@@ -97,6 +97,9 @@ int     uri_add_opt(struct martel_uri *su,const char *key,const char *value);
 const char *    uri_get_device(struct martel_uri *su);
 const char *    uri_get_opt(struct martel_uri *su,const char *key);
 
+int     uri_get_realtime(struct martel_uri *su,int *priority,int *cpu);
+int     uri_get_buffer(struct martel_uri *su,int *size);
+
 /* Port definition ----------------------------------------------------------*/
 
 #define DEVICE_MAX              255     /*characters*/
@@ -111,6 +114,9 @@ const char *    uri_get_opt(struct martel_uri *su,const char *key);
 
 #define USB_READ_BUFSIZE        USB_BULK_IN_EP_SIZE
 
+#define MEM_DEFSIZE             4096    /*bytes, like a tty output buffer*/
+#define MEM_REPLY_MAX           16      /*status bytes waiting to be read*/
+
 typedef union {
         struct {
                 char    device[DEVICE_MAX+1];
@@ -135,19 +141,119 @@ typedef union {
                 int             read_pos;
                 int             read_len;
         } usb;
+        struct {
+                char    device[DEVICE_MAX+1];   /*path, descriptor for fd*/
+                int     fd;
+                int     flags;                  /*status flags of fd to restore*/
+        } file;
+        struct {
+                char    name[DEVICE_MAX+1];
+                unsigned char * buf;            /*ring, allocated on open*/
+                int     size;                   /*bytes*/
+                int     bandwidth;              /*bytes/s, 0 for unlimited*/
+                long long       head;           /*bytes written*/
+                long long       tail;           /*bytes taken by printer*/
+                long long       drained;        /*time tail was updated, us*/
+
+                /*answers to status requests*/
+                unsigned char   reply[MEM_REPLY_MAX];
+                int             reply_len;
+        } mem;
 } martel_settings_t;
 
+/*real-time I/O mode, see rt.c*/
+#define RT_MINPRIORITY          1
+#define RT_MAXPRIORITY          99
+#define RT_DEFPRIORITY          40      /*below threaded interrupt handlers*/
+#define RT_CPU_MAX              1024    /*CPUs in a cpu_set_t*/
+
+#define RT_LATE_US              1000    /*gap counted as late, microseconds*/
+
+/*write-combining output buffer, see martel.c*/
+#define OUTBUF_MAX              (1024*1024)     /*bytes*/
+
 typedef struct {
+        int             priority;       /*SCHED_FIFO priority, 0 if off*/
+        int             cpu;            /*CPU to pin I/O thread to, -1 if any*/
+        int             mode;           /*MARTEL_RT_* flags in effect*/
+        int             tid;            /*thread raised by rt_enter()*/
+        int             saved_policy;
+        int             saved_priority;
+        unsigned long   saved_cpus[RT_CPU_MAX/(8*sizeof(unsigned long))];
+
+        /*jitter statistics: gaps between consecutive port accesses*/
+        long long       last;           /*end of last access (us), 0 if none*/
+        unsigned long   samples;
+        unsigned long long total;       /*microseconds*/
+        unsigned long   max;            /*microseconds*/
+        unsigned long   late;           /*gaps over RT_LATE_US*/
+} martel_rt_t;
+
+struct martel_port;
+
+/*port operations, one table per port type*/
+typedef struct {
+        int             type;                   /*martel_port_type_t*/
+        const char *    name;                   /*"type" URI option*/
+
+        int     (*get_uri)(struct martel_port *p,char *uri,int size);
+        int     (*create_from_uri)(struct martel_port *p,struct martel_uri *su);
+        int     (*open)(struct martel_port *p);
+        int     (*close)(struct martel_port *p);
+        int     (*write)(struct martel_port *p,const void *buf,int size);
+        int     (*writev)(struct martel_port *p,const struct iovec *iov,int n);
+        int     (*write_rt)(struct martel_port *p,const void *buf,int size);
+        int     (*read)(struct martel_port *p,void *buf,int size);
+        int     (*sync)(struct martel_port *p);
+        int     (*flush)(struct martel_port *p);
+        int     (*get_pending)(struct martel_port *p);
+        int     (*get_fd)(struct martel_port *p);
+} martel_ops_t;
+
+typedef struct martel_port {
+        const martel_ops_t *ops;
         int             type;
         int             errnum;
         int             open;
         int             write_timeout;          /*milliseconds*/
+        int             written;                /*bytes accepted by last write*/
         int             read_timeout;           /*milliseconds*/
+        long long       deadline;               /*end of timed operation
+                                                  (us, monotonic), 0 if none*/
+        martel_rt_t     rt;
+        unsigned char * out_buf;                /*write-combining buffer,
+                                                  NULL if none*/
+        int             out_size;               /*bytes*/
+        int             out_len;                /*bytes held*/
+        struct reactor_port *reactor;           /*reactor registration,
+                                                  NULL if none*/
+        struct engine_port *engine;             /*engine operations queued,
+                                                  NULL if none*/
         martel_settings_t  set;
 } martel_port_t;
 
+/* Timeout routines ---------------------------------------------------------*/
+
+long long       timeout_now(void);
+void    deadline_start(martel_port_t *p,int ms);
+int     deadline_expired(martel_port_t *p);
+int     deadline_left(martel_port_t *p);
+int     wait_fd(int fd,int events,int ms);
+int     wait_drain(martel_port_t *p,int fd,int cps);
+int     writev_fd(martel_port_t *p,int fd,const struct iovec *iov,int n);
+
+/* Real-time I/O routines ---------------------------------------------------*/
+
+void    rt_enter(martel_port_t *p);
+void    rt_leave(martel_port_t *p);
+void    rt_io_begin(martel_port_t *p);
+void    rt_io_end(martel_port_t *p);
+void    rt_io_reset(martel_port_t *p);
+
 /* Serial port routines -----------------------------------------------------*/
 
+extern const martel_ops_t       serial_ops;
+
 int     serial_get_uri(martel_port_t *p,char *uri,int size);
 int     serial_create(martel_port_t *p,const char *device);
 int     serial_create_from_uri(martel_port_t *p,struct martel_uri *su);
@@ -157,13 +263,18 @@ int     serial_close(martel_port_t *p);
 int     serial_set_baudrate(martel_port_t *p,int baudrate);
 int     serial_set_handshake(martel_port_t *p,int handshake);
 int     serial_write(martel_port_t *p,const void *buf,int size);
+int     serial_writev(martel_port_t *p,const struct iovec *iov,int n);
 int     serial_write_rt(martel_port_t *p,const void *buf,int size);
 int     serial_read(martel_port_t *p,void *buf,int size);
 int     serial_sync(martel_port_t *p);
 int     serial_flush(martel_port_t *p);
+int     serial_get_pending(martel_port_t *p);
+int     serial_get_fd(martel_port_t *p);
 
 /* Parallel port routines ---------------------------------------------------*/
 
+extern const martel_ops_t       par_ops;
+
 int     par_get_uri(martel_port_t *p,char *uri,int size);
 int     par_create(martel_port_t *p,const char *device);
 int     par_create_from_uri(martel_port_t *p,struct martel_uri *su);
@@ -173,13 +284,19 @@ int     par_close(martel_port_t *p);
 int     par_reset(martel_port_t *p);
 int     par_set_mode(martel_port_t *p,int mode);
 int     par_write(martel_port_t *p,const void *buf,int size);
+int     par_writev(martel_port_t *p,const struct iovec *iov,int n);
 int     par_write_rt(martel_port_t *p,const void *buf,int size);
 int     par_read(martel_port_t *p,void *buf,int size);
 int     par_sync(martel_port_t *p);
 int     par_flush(martel_port_t *p);
+int     par_get_pending(martel_port_t *p);
+int     par_get_fd(martel_port_t *p);
+int     par_probe(martel_port_t *p);
 
 /* USB port routines --------------------------------------------------------*/
 
+extern const martel_ops_t       usb_ops;
+
 int     usb_get_uri(martel_port_t *p,char *uri,int size);
 int     usb_create(martel_port_t *p,const char *device);
 int     usb_create_from_address(martel_port_t *p,const char *usbfs,int busnum,int devnum);
@@ -191,9 +308,24 @@ int     usb_open(martel_port_t *p);
 int     usb_close(martel_port_t *p);
 int     usb_control(martel_port_t *p,martel_usb_ctrltransfer_t *ctrl);
 int     usb_write(martel_port_t *p,const void *buf,int size);
+int     usb_writev(martel_port_t *p,const struct iovec *iov,int n);
+int     usb_write_rt(martel_port_t *p,const void *buf,int size);
 int     usb_read(martel_port_t *p,void *buf,int size);
 int     usb_sync(martel_port_t *p);
 int     usb_flush(martel_port_t *p);
+int     usb_get_pending(martel_port_t *p);
+int     usb_get_fd(martel_port_t *p);
+
+/* File and descriptor port routines ----------------------------------------*/
+
+extern const martel_ops_t       file_ops;
+extern const martel_ops_t       fd_ops;
+
+int     file_splice(martel_port_t *p,int fd,int size);
+
+/* Memory port routines -----------------------------------------------------*/
+
+extern const martel_ops_t       mem_ops;
 
 #ifdef __cplusplus
 }
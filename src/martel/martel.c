@@ -38,8 +38,90 @@
 /* PRIVATE DEFINITIONS ------------------------------------------------------*/
 static const char id_str[] = "$Id: martel.c,v 1.1 2006/08/01 09:12:03 chris Exp $";
 
+/*serial baudrate detection*/
+#define DETECT_TIMEOUT          200     /*ms, status answer*/
+#define DETECT_ROUNDS           3       /*status round trips per baudrate*/
+
+static  int     invalid_get_uri(martel_port_t *,char *,int);
+static  int     invalid_create_from_uri(martel_port_t *,struct martel_uri *);
+static  int     invalid_port(martel_port_t *);
+static  int     invalid_write(martel_port_t *,const void *,int);
+static  int     invalid_writev(martel_port_t *,const struct iovec *,int);
+static  int     invalid_read(martel_port_t *,void *,int);
+
+static  int     set_output_buffer(martel_port_t *,int);
+static  int     flush_output(martel_port_t *);
+static  int     write_combined(martel_port_t *,const void *,int);
+
+/*operations of port without a valid type*/
+static const martel_ops_t invalid_ops = {
+        -1,
+        "",
+        invalid_get_uri,
+        invalid_create_from_uri,
+        invalid_port,
+        invalid_port,
+        invalid_write,
+        invalid_writev,
+        invalid_write,
+        invalid_read,
+        invalid_port,
+        invalid_port,
+        invalid_port,
+        invalid_port
+};
+
+/*port types selectable with "type" URI option*/
+static const martel_ops_t *port_ops[] = {
+        &serial_ops,
+        &par_ops,
+        &usb_ops,
+        &file_ops,
+        &fd_ops,
+        &mem_ops
+};
+
+#define NUM_PORT_OPS    (sizeof(port_ops)/sizeof(port_ops[0]))
+
 /* PRIVATE FUNCTIONS --------------------------------------------------------*/
 
+/*-----------------------------------------------------------------------------
+Name      :  invalid_xxx
+Purpose   :  Operations of port without a valid type
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_INVALID_PORT
+-----------------------------------------------------------------------------*/
+static int invalid_get_uri(martel_port_t *p,char *uri,int size)
+{
+        return MARTEL_INVALID_PORT;
+}
+
+static int invalid_create_from_uri(martel_port_t *p,struct martel_uri *su)
+{
+        return MARTEL_INVALID_PORT;
+}
+
+static int invalid_port(martel_port_t *p)
+{
+        return MARTEL_INVALID_PORT;
+}
+
+static int invalid_write(martel_port_t *p,const void *buf,int size)
+{
+        return MARTEL_INVALID_PORT;
+}
+
+static int invalid_writev(martel_port_t *p,const struct iovec *iov,int n)
+{
+        return MARTEL_INVALID_PORT;
+}
+
+static int invalid_read(martel_port_t *p,void *buf,int size)
+{
+        return MARTEL_INVALID_PORT;
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  build_port
 Purpose   :  Build port structure
@@ -59,9 +141,208 @@ static martel_port_t *build_port(void)
         /*zero out structure*/
         memset(p,0,sizeof(martel_port_t));
 
+        p->rt.cpu = -1;
+        p->ops = &invalid_ops;
+
         return p;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  get_rt_uri
+Purpose   :  Append real-time I/O options to URI string built by port type
+Inputs    :  p    : port structure
+             uri  : URI string buffer holding port type URI
+             size : URI string buffer size (includes trailing zero)
+Outputs   :  URI string buffer is modified
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int get_rt_uri(martel_port_t *p,char *uri,int size)
+{
+        int len;
+
+        len = strlen(uri);
+
+        if (p->rt.priority>0) {
+                len += snprintf(uri+len,size-len,"+realtime=%d",
+                                p->rt.priority);
+
+                if (len>=size) {
+                        return MARTEL_INVALID_URI;
+                }
+        }
+
+        if (p->rt.cpu>=0) {
+                len += snprintf(uri+len,size-len,"+cpu=%d",p->rt.cpu);
+
+                if (len>=size) {
+                        return MARTEL_INVALID_URI;
+                }
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  get_buffer_uri
+Purpose   :  Append write-combining buffer option to URI string
+Inputs    :  p    : port structure
+             uri  : URI string buffer
+             size : URI string buffer size (includes trailing zero)
+Outputs   :  URI string buffer is modified
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int get_buffer_uri(martel_port_t *p,char *uri,int size)
+{
+        int len;
+
+        len = strlen(uri);
+
+        if (p->out_size>0) {
+                len += snprintf(uri+len,size-len,"+buffer=%d",p->out_size);
+
+                if (len>=size) {
+                        return MARTEL_INVALID_URI;
+                }
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  set_output_buffer
+Purpose   :  Resize write-combining buffer of port, which must be empty
+Inputs    :  p    : port structure
+             size : buffer size in bytes, 0 to write data at once
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int set_output_buffer(martel_port_t *p,int size)
+{
+        unsigned char *buf;
+
+        if (size<0 || size>OUTBUF_MAX) {
+                return MARTEL_INVALID_BUFFER_SIZE;
+        }
+
+        if (size==0) {
+                free(p->out_buf);
+                buf = NULL;
+        }
+        else {
+                buf = realloc(p->out_buf,size);
+
+                if (buf==NULL) {
+                        return MARTEL_INVALID_BUFFER_SIZE;
+                }
+        }
+
+        p->out_buf = buf;
+        p->out_size = size;
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  flush_output
+Purpose   :  Write data held in write-combining buffer of port
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code, data the port did not take stays in
+             buffer
+-----------------------------------------------------------------------------*/
+static int flush_output(martel_port_t *p)
+{
+        martel_error_t errnum;
+
+        if (p->out_len==0) {
+                return MARTEL_OK;
+        }
+
+        errnum = p->ops->write(p,p->out_buf,p->out_len);
+
+        p->out_len -= p->written;
+        memmove(p->out_buf,p->out_buf+p->written,p->out_len);
+
+        return errnum;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  write_combined
+Purpose   :  Write data buffer through write-combining buffer of port
+             Data is held until the buffer would fill up, then buffered data
+             and data buffer are written together with a single writev
+             operation
+Inputs    :  p    : port structure
+             buf  : data buffer
+             size : data buffer size in bytes
+Outputs   :  p->written : bytes of data buffer accepted
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int write_combined(martel_port_t *p,const void *buf,int size)
+{
+        martel_error_t errnum;
+        struct iovec iov[2];
+        int held = p->out_len;
+
+        if (held+size<p->out_size) {
+                memcpy(p->out_buf+held,buf,size);
+                p->out_len += size;
+                p->written = size;
+
+                return MARTEL_OK;
+        }
+
+        iov[0].iov_base = p->out_buf;
+        iov[0].iov_len = held;
+        iov[1].iov_base = (void *)buf;
+        iov[1].iov_len = size;
+
+        errnum = p->ops->writev(p,iov,2);
+
+        if (p->written<held) {
+                /*keep buffered data the port did not take*/
+                p->out_len = held-p->written;
+                memmove(p->out_buf,p->out_buf+p->written,p->out_len);
+                p->written = 0;
+        }
+        else {
+                p->out_len = 0;
+                p->written -= held;
+        }
+
+        return errnum;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  probe_baudrate
+Purpose   :  Check whether printer answers status requests at baudrate
+             Port baudrate is changed, port structure is not updated
+Inputs    :  p        : port structure
+             type     : printer model type
+             baudrate : baudrate setting
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int probe_baudrate(martel_port_t *p,int type,int baudrate)
+{
+        martel_error_t errnum;
+        martel_status_t status;
+        int i;
+
+        if ((errnum = serial_set_baudrate(p,baudrate))<0) {
+                return errnum;
+        }
+
+        /*a single answer could be garbage that looks like status*/
+        for (i=0; i<DETECT_ROUNDS; i++) {
+                if ((errnum = martel_get_status(p,type,&status))<0) {
+                        return errnum;
+                }
+        }
+
+        return MARTEL_OK;
+}
+
 /* PUBLIC FUNCTIONS ---------------------------------------------------------*/
 
 /*-----------------------------------------------------------------------------
@@ -175,6 +456,55 @@ int martel_get_model_width(int model)
         return errnum;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  martel_decode_status
+Purpose   :  Decode printer status bytes
+             Status is made of the answers to real-time status requests
+             DLE EOT 1 (printer), 2 (offline cause), 3 (error cause) and
+             4 (paper sensors), in this order. Each answer has bits 1 and 4
+             set and bits 0 and 7 clear.
+Inputs    :  type   : printer model type
+             buf    : status bytes
+             size   : number of status bytes (MARTEL_STATUS_SIZE)
+Outputs   :  status : decoded status
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_decode_status(int type,const void *buf,int size,martel_status_t *status)
+{
+        const unsigned char *b = buf;
+        int i;
+
+        switch (type) {
+        case MARTEL_MPP:
+        case MARTEL_MCP:
+                break;
+        default:
+                return MARTEL_INVALID_MODEL_TYPE;
+        }
+
+        if (size!=MARTEL_STATUS_SIZE) {
+                return MARTEL_INVALID_STATUS;
+        }
+
+        for (i=0; i<MARTEL_STATUS_SIZE; i++) {
+                if ((b[i]&0x93)!=0x12) {
+                        return MARTEL_INVALID_STATUS;
+                }
+        }
+
+        memset(status,0,sizeof(martel_status_t));
+
+        status->online                  = (b[0]&0x08)==0;
+        status->cover_open              = (b[1]&0x04)!=0;
+        status->end_of_paper            = (b[1]&0x20)!=0 || (b[3]&0x60)!=0;
+        status->cutter_error            = (b[2]&0x08)!=0;
+        status->mechanical_error        = (b[2]&0x20)!=0;
+        status->temp_error              = (b[2]&0x40)!=0;
+        status->near_end_of_paper       = (b[3]&0x0c)!=0;
+
+        return MARTEL_OK;
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  martel_create_port
 Purpose   :  Create port structure from URI
@@ -187,6 +517,8 @@ void *martel_create_port(const char *uri)
         martel_port_t *p;
         struct martel_uri su;
         const char *value;
+        int size;
+        int i;
 
         /*build port structure*/
         p = build_port();
@@ -211,22 +543,37 @@ void *martel_create_port(const char *uri)
                 return p;
         }
 
-        /*setup port settings according to type*/
-        if (strcmp(value,"serial")==0) {
-                p->type = MARTEL_SERIAL;
-                p->errnum = serial_create_from_uri(p,&su);
+        /*get real-time I/O options, common to all types*/
+        if (uri_get_realtime(&su,&p->rt.priority,&p->rt.cpu)<0) {
+                p->errnum = MARTEL_INVALID_URI;
+                return p;
         }
-        else if (strcmp(value,"parallel")==0) {
-                p->type = MARTEL_PARALLEL;
-                p->errnum = par_create_from_uri(p,&su);
+
+        /*get write-combining buffer option, common to all types*/
+        if (uri_get_buffer(&su,&size)<0) {
+                p->errnum = MARTEL_INVALID_URI;
+                return p;
         }
-        else if (strcmp(value,"usb")==0) {
-                p->type = MARTEL_USB;
-                p->errnum = usb_create_from_uri(p,&su);
+
+        if ((p->errnum = set_output_buffer(p,size))<0) {
+                return p;
         }
-        else {
+
+        /*setup port settings according to type*/
+        for (i=0; i<NUM_PORT_OPS; i++) {
+                if (strcmp(value,port_ops[i]->name)==0) {
+                        break;
+                }
+        }
+
+        if (i==NUM_PORT_OPS) {
                 p->errnum = MARTEL_INVALID_PORT_TYPE;
         }
+        else {
+                p->ops = port_ops[i];
+                p->type = p->ops->type;
+                p->errnum = p->ops->create_from_uri(p,&su);
+        }
 
         return p;
 }
@@ -250,6 +597,7 @@ void *martel_create_serial_port(const char *device)
         }
 
         p->type = MARTEL_SERIAL;
+        p->ops = &serial_ops;
 
         /*setup port settings*/
         p->errnum = serial_create(p,device);
@@ -276,6 +624,7 @@ void *martel_create_parallel_port(const char *device)
         }
 
         p->type = MARTEL_PARALLEL;
+        p->ops = &par_ops;
 
         /*setup port settings*/
         p->errnum = par_create(p,device);
@@ -302,6 +651,7 @@ void *martel_create_usb_port(const char *device)
         }
 
         p->type = MARTEL_USB;
+        p->ops = &usb_ops;
 
         /*setup port settings*/
         p->errnum = usb_create(p,device);
@@ -333,6 +683,7 @@ int martel_destroy_port(void *port)
                 }
                 
                 if (errnum==MARTEL_OK) {
+                        free(p->out_buf);
                         free(p);
                 }
         }
@@ -380,19 +731,14 @@ int martel_get_port_uri(void *port,char *uri,int size)
                 errnum = MARTEL_INVALID_PORT;
         }
         else {
-                switch (p->type) {
-                case MARTEL_SERIAL:
-                        errnum = serial_get_uri(p,uri,size);
-                        break;
-                case MARTEL_PARALLEL:
-                        errnum = par_get_uri(p,uri,size);
-                        break;
-                case MARTEL_USB:
-                        errnum = usb_get_uri(p,uri,size);
-                        break;
-                default:
-                        errnum = MARTEL_INVALID_PORT;
-                        break;
+                errnum = p->ops->get_uri(p,uri,size);
+
+                if (errnum==MARTEL_OK) {
+                        errnum = get_rt_uri(p,uri,size);
+                }
+
+                if (errnum==MARTEL_OK) {
+                        errnum = get_buffer_uri(p,uri,size);
                 }
                 
                 p->errnum = errnum;
@@ -421,23 +767,11 @@ int martel_open(void *port)
                         errnum = MARTEL_PORT_ALREADY_OPEN;
                 }
                 else {
-                        switch (p->type) {
-                        case MARTEL_SERIAL:
-                                errnum = serial_open(p);
-                                break;
-                        case MARTEL_PARALLEL:
-                                errnum = par_open(p);
-                                break;
-                        case MARTEL_USB:
-                                errnum = usb_open(p);
-                                break;
-                        default:
-                                errnum = MARTEL_INVALID_PORT;
-                                break;
-                        }
+                        errnum = p->ops->open(p);
 
                         if (errnum==MARTEL_OK) {
                                 p->open = 1;
+                                rt_enter(p);
                         }
                 }
 
@@ -466,24 +800,29 @@ int martel_close(void *port)
                 if (!p->open) {
                         errnum = MARTEL_PORT_NOT_OPEN;
                 }
+                else if (p->reactor!=NULL) {
+                        /*reactor still watches port descriptor*/
+                        errnum = MARTEL_PORT_IN_REACTOR;
+                }
+                else if (p->engine!=NULL) {
+                        errnum = MARTEL_PORT_BUSY;
+                }
                 else {
-                        switch (p->type) {
-                        case MARTEL_SERIAL:
-                                errnum = serial_close(p);
-                                break;
-                        case MARTEL_PARALLEL:
-                                errnum = par_close(p);
-                                break;
-                        case MARTEL_USB:
-                                errnum = usb_close(p);
-                                break;
-                        default:
-                                errnum = MARTEL_INVALID_PORT;
-                                break;
-                        }
+                        martel_error_t flushed;
+
+                        /*buffered data the port does not take is dropped*/
+                        rt_io_reset(p);
+
+                        flushed = flush_output(p);
+                        p->out_len = 0;
+
+                        rt_leave(p);
+
+                        errnum = p->ops->close(p);
 
                         if (errnum==MARTEL_OK) {
                                 p->open = 0;
+                                errnum = flushed;
                         }
                 }
 
@@ -515,19 +854,81 @@ int martel_write(void *port,const void *buf,int size)
                         errnum = MARTEL_PORT_NOT_OPEN;
                 }
                 else {
-                        switch (p->type) {
-                        case MARTEL_SERIAL:
-                                errnum = serial_write(p,buf,size);
-                                break;
-                        case MARTEL_PARALLEL:
-                                errnum = par_write(p,buf,size);
-                                break;
-                        case MARTEL_USB:
-                                errnum = usb_write(p,buf,size);
-                                break;
-                        default:
-                                errnum = MARTEL_INVALID_PORT;
-                                break;
+                        rt_io_reset(p);
+
+                        /*reactor and engine transfers go straight to the
+                         *port, data written meanwhile must not wait*/
+                        if (p->out_size>0 && p->reactor==NULL
+                            && p->engine==NULL) {
+                                errnum = write_combined(p,buf,size);
+                        }
+                        else {
+                                errnum = p->ops->write(p,buf,size);
+                        }
+                }
+
+                p->errnum = errnum;
+        }
+
+        return errnum;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_write_some
+Purpose   :  Write data buffer to port until it is written or write timeout
+             expires
+Inputs    :  port : port structure
+             buf  : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  number of bytes written (less than size on timeout) or error code
+-----------------------------------------------------------------------------*/
+int martel_write_some(void *port,const void *buf,int size)
+{
+        martel_error_t errnum;
+        martel_port_t *p = port;
+
+        errnum = martel_write(port,buf,size);
+
+        if (errnum==MARTEL_OK || errnum==MARTEL_WRITE_TIMEOUT) {
+                return p->written;
+        }
+        else {
+                return errnum;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_writev
+Purpose   :  Write data fragments to port, as one buffer would be written.
+             Serial, USB and descriptor ports gather them with writev()
+Inputs    :  port : port structure
+             iov  : data fragments
+             n    : number of fragments
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_writev(void *port,const struct iovec *iov,int n)
+{
+        martel_error_t errnum;
+        martel_port_t *p = port;
+
+        if (p==NULL) {
+                errnum = MARTEL_INVALID_PORT;
+        }
+        else {
+                if (!p->open) {
+                        errnum = MARTEL_PORT_NOT_OPEN;
+                }
+                else {
+                        rt_io_reset(p);
+
+                        if ((errnum = flush_output(p))==MARTEL_OK) {
+                                errnum = p->ops->writev(p,iov,n);
+                        }
+                        else {
+                                /*none of the fragments were written*/
+                                p->written = 0;
                         }
                 }
 
@@ -537,6 +938,79 @@ int martel_write(void *port,const void *buf,int size)
         return errnum;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  martel_writev_some
+Purpose   :  Write data fragments to port until they are written or write
+             timeout expires
+Inputs    :  port : port structure
+             iov  : data fragments
+             n    : number of fragments
+Outputs   :  <>
+Return    :  number of bytes written (less than total on timeout) or error
+             code
+-----------------------------------------------------------------------------*/
+int martel_writev_some(void *port,const struct iovec *iov,int n)
+{
+        martel_error_t errnum;
+        martel_port_t *p = port;
+
+        errnum = martel_writev(port,iov,n);
+
+        if (errnum==MARTEL_OK || errnum==MARTEL_WRITE_TIMEOUT) {
+                return p->written;
+        }
+        else {
+                return errnum;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_splice
+Purpose   :  Move data from descriptor to file or descriptor port without
+             copying it to user space
+Inputs    :  port : port structure
+             fd   : input descriptor, readable
+             size : maximum number of bytes to move
+Outputs   :  <>
+Return    :  number of bytes moved (0 at end of input), MARTEL_NOT_IMPLEMENTED
+             if port type or descriptors do not allow it (no data was taken
+             from input), or error code
+-----------------------------------------------------------------------------*/
+int martel_splice(void *port,int fd,int size)
+{
+        martel_error_t errnum;
+        martel_port_t *p = port;
+        int n;
+
+        if (p==NULL) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        if (!p->open) {
+                n = MARTEL_PORT_NOT_OPEN;
+        }
+        else if ((p->ops->type!=MARTEL_FILE && p->ops->type!=MARTEL_FD)
+                 || p->reactor!=NULL || p->engine!=NULL) {
+                /*data would pass transfers queued on port*/
+                n = MARTEL_NOT_IMPLEMENTED;
+        }
+        else {
+                rt_io_reset(p);
+
+                if ((errnum = flush_output(p))==MARTEL_OK) {
+                        n = file_splice(p,fd,size);
+                }
+                else {
+                        p->written = 0;
+                        n = errnum;
+                }
+        }
+
+        p->errnum = n<0 ? n : MARTEL_OK;
+
+        return n;
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  martel_write_rt
 Purpose   :  Write data buffer to port in real-time (ignore handshake signals)
@@ -560,19 +1034,10 @@ int martel_write_rt(void *port,const void *buf,int size)
                         errnum = MARTEL_PORT_NOT_OPEN;
                 }
                 else {
-                        switch (p->type) {
-                        case MARTEL_SERIAL:
-                                errnum = serial_write_rt(p,buf,size);
-                                break;
-                        case MARTEL_PARALLEL:
-                                errnum = par_write_rt(p,buf,size);
-                                break;
-                        case MARTEL_USB:
-                                errnum = usb_write_rt(p,buf,size);
-                                break;
-                        default:
-                                errnum = MARTEL_INVALID_PORT_TYPE;
-                                break;
+                        rt_io_reset(p);
+
+                        if ((errnum = flush_output(p))==MARTEL_OK) {
+                                errnum = p->ops->write_rt(p,buf,size);
                         }
                 }
 
@@ -604,19 +1069,10 @@ int martel_read(void *port,void *buf,int size)
                         errnum = MARTEL_PORT_NOT_OPEN;
                 }
                 else {
-                        switch (p->type) {
-                        case MARTEL_SERIAL:
-                                errnum = serial_read(p,buf,size);
-                                break;
-                        case MARTEL_PARALLEL:
-                                errnum = par_read(p,buf,size);
-                                break;
-                        case MARTEL_USB:
-                                errnum = usb_read(p,buf,size);
-                                break;
-                        default:
-                                errnum = MARTEL_INVALID_PORT;
-                                break;
+                        rt_io_reset(p);
+
+                        if ((errnum = flush_output(p))==MARTEL_OK) {
+                                errnum = p->ops->read(p,buf,size);
                         }
                 }
 
@@ -646,19 +1102,10 @@ int martel_sync(void *port)
                         errnum = MARTEL_PORT_NOT_OPEN;
                 }
                 else {
-                        switch (p->type) {
-                        case MARTEL_SERIAL:
-                                errnum = serial_sync(p);
-                                break;
-                        case MARTEL_PARALLEL:
-                                errnum = par_sync(p);
-                                break;
-                        case MARTEL_USB:
-                                errnum = usb_sync(p);
-                                break;
-                        default:
-                                errnum = MARTEL_INVALID_PORT;
-                                break;
+                        rt_io_reset(p);
+
+                        if ((errnum = flush_output(p))==MARTEL_OK) {
+                                errnum = p->ops->sync(p);
                         }
                 }
 
@@ -688,20 +1135,9 @@ int martel_flush(void *port)
                         errnum = MARTEL_PORT_NOT_OPEN;
                 }
                 else {
-                        switch (p->type) {
-                        case MARTEL_SERIAL:
-                                errnum = serial_flush(p);
-                                break;
-                        case MARTEL_PARALLEL:
-                                errnum = par_flush(p);
-                                break;
-                        case MARTEL_USB:
-                                errnum = usb_flush(p);
-                                break;
-                        default:
-                                errnum = MARTEL_INVALID_PORT;
-                                break;
-                        }
+                        p->out_len = 0;
+
+                        errnum = p->ops->flush(p);
                 }
 
                 p->errnum = errnum;
@@ -710,6 +1146,39 @@ int martel_flush(void *port)
         return errnum;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  martel_get_pending
+Purpose   :  Get number of bytes written but still waiting in kernel buffers
+Inputs    :  port : port structure
+Outputs   :  <>
+Return    :  number of bytes or error code
+-----------------------------------------------------------------------------*/
+int martel_get_pending(void *port)
+{
+        martel_error_t errnum;
+        martel_port_t *p = port;
+
+        if (p==NULL) {
+                errnum = MARTEL_INVALID_PORT;
+        }
+        else {
+                if (!p->open) {
+                        errnum = MARTEL_PORT_NOT_OPEN;
+                }
+                else {
+                        errnum = p->ops->get_pending(p);
+
+                        if (errnum>=0) {
+                                errnum += p->out_len;
+                        }
+                }
+
+                p->errnum = errnum<0 ? errnum : MARTEL_OK;
+        }
+
+        return errnum;
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  martel_gets
 Purpose   :  Read a null-terminated string
@@ -751,6 +1220,37 @@ int martel_gets(void *port,void *s,int size)
         return errnum;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  martel_get_status
+Purpose   :  Request printer status with real-time commands and decode it
+             Real-time commands bypass handshaking but clear data pending in
+             output buffers (see martel_get_pending)
+Inputs    :  port   : port structure
+             type   : printer model type
+Outputs   :  status : decoded status
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_get_status(void *port,int type,martel_status_t *status)
+{
+        martel_error_t errnum;
+        unsigned char buf[MARTEL_STATUS_SIZE];
+        int i;
+
+        for (i=0; i<MARTEL_STATUS_SIZE; i++) {
+                unsigned char cmd[3] = {DLE,EOT,i+1};
+
+                if ((errnum = martel_write_rt(port,cmd,sizeof(cmd)))<0) {
+                        return errnum;
+                }
+
+                if ((errnum = martel_read(port,&buf[i],1))<0) {
+                        return errnum;
+                }
+        }
+
+        return martel_decode_status(type,buf,sizeof(buf),status);
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  martel_serial_set_baudrate
 Purpose   :  Set port baudrate. Only available on serial type ports
@@ -875,6 +1375,85 @@ int martel_serial_get_handshake(void *port)
         return errnum;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  martel_serial_detect_baudrate
+Purpose   :  Find baudrate printer is set to and switch port to it. Only
+             available on serial type ports
+             Each baudrate is checked with status round trips. Requests
+             sent at a wrong baudrate reach the printer as garbage, so the
+             hint and current port baudrate are tried first, then the
+             other ones from the fastest. Port keeps its baudrate if the
+             printer does not answer at any of them.
+Inputs    :  port : port structure
+             type : printer model type
+             hint : baudrate tried first (e.g. previous result) or -1
+Outputs   :  <>
+Return    :  baudrate (martel_baudrate_t) or error code
+-----------------------------------------------------------------------------*/
+int martel_serial_detect_baudrate(void *port,int type,int hint)
+{
+        martel_error_t errnum;
+        martel_port_t *p = port;
+        int candidates[MARTEL_B115200+3];
+        int tried = 0;
+        int read_timeout;
+        int n = 0;
+        int i;
+
+        if (p==NULL) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        if (!p->open) {
+                errnum = MARTEL_PORT_NOT_OPEN;
+        }
+        else if (p->type!=MARTEL_SERIAL) {
+                errnum = MARTEL_INVALID_PORT_TYPE;
+        }
+        else if (type!=MARTEL_MPP && type!=MARTEL_MCP) {
+                errnum = MARTEL_INVALID_MODEL_TYPE;
+        }
+        else {
+                /*candidate order*/
+                if (hint>=MARTEL_B1200 && hint<=MARTEL_B115200) {
+                        candidates[n++] = hint;
+                }
+                candidates[n++] = p->set.serial.baudrate;
+                for (i=MARTEL_B115200; i>=MARTEL_B1200; i--) {
+                        candidates[n++] = i;
+                }
+
+                read_timeout = p->read_timeout;
+                p->read_timeout = DETECT_TIMEOUT;
+
+                errnum = MARTEL_BAUDRATE_NOT_DETECTED;
+
+                for (i=0; i<n; i++) {
+                        if (tried & (1<<candidates[i])) {
+                                continue;
+                        }
+                        tried |= 1<<candidates[i];
+
+                        if (probe_baudrate(p,type,candidates[i])>=0) {
+                                p->set.serial.baudrate = candidates[i];
+                                errnum = candidates[i];
+                                break;
+                        }
+                }
+
+                p->read_timeout = read_timeout;
+
+                /*revert to port baudrate*/
+                if (errnum<0) {
+                        serial_set_baudrate(p,p->set.serial.baudrate);
+                }
+        }
+
+        p->errnum = errnum<0 ? errnum : MARTEL_OK;
+
+        return errnum;
+}
+
 
 /*-----------------------------------------------------------------------------
 Name      :  martel_parallel_reset
@@ -1027,6 +1606,88 @@ int martel_set_read_timeout(void *port,int ms)
         return errnum;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  martel_set_output_buffer
+Purpose   :  Set size of write-combining buffer. Writes smaller than the
+             buffer are held in it until it fills up or martel_flush_output,
+             martel_sync, martel_read or martel_write_rt is called. Data held
+             when buffer is resized is written first
+Inputs    :  port : port structure
+             size : buffer size in bytes, 0 to write data at once
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_set_output_buffer(void *port,int size)
+{
+        martel_error_t errnum;
+        martel_port_t *p = port;
+
+        if (p==NULL) {
+                errnum = MARTEL_INVALID_PORT;
+        }
+        else {
+                rt_io_reset(p);
+
+                if ((errnum = flush_output(p))==MARTEL_OK) {
+                        errnum = set_output_buffer(p,size);
+                }
+
+                p->errnum = errnum;
+        }
+
+        return errnum;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_get_output_buffer
+Purpose   :  Get size of write-combining buffer
+Inputs    :  port : port structure
+Outputs   :  <>
+Return    :  buffer size in bytes (0 if writes are not combined) or error
+             code
+-----------------------------------------------------------------------------*/
+int martel_get_output_buffer(void *port)
+{
+        martel_port_t *p = port;
+
+        if (p==NULL) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        return p->out_size;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_flush_output
+Purpose   :  Write data held in write-combining buffer
+Inputs    :  port : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_flush_output(void *port)
+{
+        martel_error_t errnum;
+        martel_port_t *p = port;
+
+        if (p==NULL) {
+                errnum = MARTEL_INVALID_PORT;
+        }
+        else {
+                if (!p->open) {
+                        errnum = MARTEL_PORT_NOT_OPEN;
+                }
+                else {
+                        rt_io_reset(p);
+
+                        errnum = flush_output(p);
+                }
+
+                p->errnum = errnum;
+        }
+
+        return errnum;
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  martel_get_error
 Purpose   :  Get last error on port
@@ -1049,6 +1710,55 @@ int martel_get_error(void *port)
         return errnum;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  martel_get_jitter
+Purpose   :  Retrieve real-time mode in effect and jitter statistics of port
+             Jitter is measured as the gaps between consecutive port system
+             calls of a read or write operation
+Inputs    :  port   : port structure
+Outputs   :  jitter : jitter statistics
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_get_jitter(void *port,martel_jitter_t *jitter)
+{
+        martel_port_t *p = port;
+
+        if (p==NULL) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        jitter->mode = p->rt.mode;
+        jitter->samples = p->rt.samples;
+        jitter->mean = p->rt.samples ? p->rt.total/p->rt.samples : 0;
+        jitter->max = p->rt.max;
+        jitter->late = p->rt.late;
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_reset_jitter
+Purpose   :  Clear jitter statistics of port
+Inputs    :  port : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_reset_jitter(void *port)
+{
+        martel_port_t *p = port;
+
+        if (p==NULL) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        p->rt.samples = 0;
+        p->rt.total = 0;
+        p->rt.max = 0;
+        p->rt.late = 0;
+
+        return MARTEL_OK;
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  martel_strerror
 Purpose   :  Convert error code in printable string
@@ -1142,6 +1852,18 @@ const char *martel_strerror(int errnum)
         case MARTEL_USB_DEVICE_BUSY:
                 s = "USB device busy (cannot unregister current driver)";
                 break;
+        case MARTEL_BAUDRATE_NOT_DETECTED:
+                s = "Printer does not answer at any baudrate";
+                break;
+        case MARTEL_PORT_IN_REACTOR:
+                s = "Port is registered in a reactor";
+                break;
+        case MARTEL_PORT_BUSY:
+                s = "Port has operations in flight";
+                break;
+        case MARTEL_INVALID_BUFFER_SIZE:
+                s = "Invalid output buffer size";
+                break;
         default:
                 s = "Unknown error";
                 break;
@@ -31,6 +31,8 @@
 #ifndef _MARTEL_H
 #define _MARTEL_H
 
+#include <sys/uio.h>
+
 #include <martel/version.h>
 
 #ifdef __cplusplus
@@ -66,7 +68,11 @@ typedef enum {
         MARTEL_INVALID_PARALLEL_MODE       = -23,
         MARTEL_INVALID_USB_PATH            = -24,
         MARTEL_USB_DEVICE_NOT_FOUND        = -25,
-        MARTEL_USB_DEVICE_BUSY             = -26
+        MARTEL_USB_DEVICE_BUSY             = -26,
+        MARTEL_BAUDRATE_NOT_DETECTED       = -27,
+        MARTEL_PORT_IN_REACTOR             = -28,
+        MARTEL_PORT_BUSY                   = -29,
+        MARTEL_INVALID_BUFFER_SIZE         = -30
 } martel_error_t;
 
 typedef struct {
@@ -115,7 +121,10 @@ typedef enum {
 typedef enum {
         MARTEL_SERIAL      = 0,
         MARTEL_PARALLEL    = 1,
-        MARTEL_USB         = 2
+        MARTEL_USB         = 2,
+        MARTEL_FILE        = 3,
+        MARTEL_FD          = 4,
+        MARTEL_MEMORY      = 5
 } martel_port_type_t;
 
 #define MARTEL_IDENTITY_MAX        31      /*characters*/
@@ -158,11 +167,44 @@ typedef struct {
         void *          data;
 } martel_usb_ctrltransfer_t;
 
+typedef enum {
+        MARTEL_RT_FIFO     = 1,            /*I/O thread runs SCHED_FIFO*/
+        MARTEL_RT_MLOCK    = 2,            /*process memory is locked*/
+        MARTEL_RT_PINNED   = 4             /*I/O thread is pinned to a CPU*/
+} martel_rt_mode_t;
+
+typedef struct {
+        int             mode;           /*MARTEL_RT_* flags in effect*/
+        unsigned long   samples;        /*gaps between port accesses*/
+        unsigned long   mean;           /*microseconds*/
+        unsigned long   max;            /*microseconds*/
+        unsigned long   late;           /*gaps over 1 ms*/
+} martel_jitter_t;
+
+/*output function of command stream optimizer*/
+typedef int (*martel_output_t)(void *ctx,const void *buf,int size);
+
+typedef enum {
+        MARTEL_EVENT_WRITE = 0,            /*queued buffer written*/
+        MARTEL_EVENT_READ  = 1             /*queued buffer filled*/
+} martel_event_t;
+
+/*completion function of reactor and engine operations*/
+typedef void (*martel_done_t)(void *ctx,void *port,int event,
+                              const void *buf,int done,int errnum);
+
+typedef enum {
+        MARTEL_ENGINE_BLOCKING = 0,        /*martel_reap runs blocking calls*/
+        MARTEL_ENGINE_URING    = 1         /*operations go through io_uring*/
+} martel_engine_mode_t;
+
 const char *    martel_get_model_name(int model);
 
 int     martel_get_model_type(int model);
 int     martel_get_model_width(int model);
 
+#define MARTEL_STATUS_SIZE         4       /*bytes*/
+
 int     martel_decode_status(int type,const void *buf,int size,martel_status_t *status);
 
 int     martel_detect_printers(martel_printer_t *printers,int max);
@@ -181,17 +223,25 @@ int     martel_get_port_uri(void *port,char *uri,int size);
 int     martel_open(void *port);
 int     martel_close(void *port);
 int     martel_write(void *port,const void *buf,int size);
+int     martel_write_some(void *port,const void *buf,int size);
+int     martel_writev(void *port,const struct iovec *iov,int n);
+int     martel_writev_some(void *port,const struct iovec *iov,int n);
+int     martel_splice(void *port,int fd,int size);
 int     martel_write_rt(void *port,const void *buf,int size);
 int     martel_read(void *port,void *buf,int size);
 int     martel_sync(void *port);
 int     martel_flush(void *port);
 
+int     martel_get_pending(void *port);
+int     martel_get_status(void *port,int type,martel_status_t *status);
+
 int     martel_gets(void *port,void *s,int size);
 
 int     martel_serial_set_baudrate(void *port,int baudrate);
 int     martel_serial_set_handshake(void *port,int handshake);
 int     martel_serial_get_baudrate(void *port);
 int     martel_serial_get_handshake(void *port);
+int     martel_serial_detect_baudrate(void *port,int type,int hint);
 
 int     martel_parallel_reset(void *port);
 int     martel_parallel_set_mode(void *port,int mode);
@@ -202,8 +252,38 @@ int     martel_usb_control(void *port,martel_usb_ctrltransfer_t *ctrl);
 int     martel_set_write_timeout(void *port,int ms);
 int     martel_set_read_timeout(void *port,int ms);
 
+int     martel_set_output_buffer(void *port,int size);
+int     martel_get_output_buffer(void *port);
+int     martel_flush_output(void *port);
+
 int     martel_get_error(void *port);
 
+int     martel_get_jitter(void *port,martel_jitter_t *jitter);
+int     martel_reset_jitter(void *port);
+
+int     martel_command_length(const void *buf,int size);
+
+void *  martel_create_optimizer(martel_output_t output,void *ctx);
+int     martel_destroy_optimizer(void *optimizer);
+int     martel_optimizer_write(void *optimizer,const void *buf,int size);
+int     martel_optimizer_flush(void *optimizer);
+int     martel_optimizer_sync(void *optimizer);
+
+void *  martel_create_reactor(void);
+int     martel_destroy_reactor(void *reactor);
+int     martel_reactor_add(void *reactor,void *port,martel_done_t done,void *ctx);
+int     martel_reactor_remove(void *reactor,void *port);
+int     martel_reactor_write(void *reactor,void *port,const void *buf,int size);
+int     martel_reactor_read(void *reactor,void *port,void *buf,int size);
+int     martel_reactor_run(void *reactor,int ms);
+
+void *  martel_create_engine(int depth);
+int     martel_destroy_engine(void *engine);
+int     martel_get_engine_mode(void *engine);
+int     martel_submit_write(void *engine,void *port,const void *buf,int size,martel_done_t done,void *ctx);
+int     martel_submit_read(void *engine,void *port,void *buf,int size,martel_done_t done,void *ctx);
+int     martel_reap(void *engine,int min,int ms);
+
 const char *    martel_strerror(int errnum);
 
 #ifdef __cplusplus
@@ -0,0 +1,474 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : memory.c
+* DESCRIPTION   : MARTEL library - simulated printer port in memory
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of libmartel.
+*
+*   libmartel is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   libmartel is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with libmartel; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+/* Memory ports stand for a printer behind a ring buffer, in the way a tty
+ * output buffer sits in front of a serial printer:
+ *
+ *      martel:<name>?type=memory+size=<bytes>+bandwidth=<bytes per second>
+ *
+ * Writes fill the ring and wait for room when it is full. The simulated
+ * printer takes data out of the ring at the given bandwidth (at once when
+ * bandwidth is 0) and drops it. Real-time status requests (DLE EOT n) are
+ * answered with a ready printer status, so that status polling and
+ * martel_get_pending() work as with real hardware.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <martel/martel.h>
+#include <martel/martel-private.h>
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+#define MEM_STATUS_READY        0x12    /*online, no error*/
+#define MEM_WAIT_MAX            10      /*ms, longest sleep waiting for room*/
+
+static  int     mem_get_uri(martel_port_t *,char *,int);
+static  int     mem_create_from_uri(martel_port_t *,struct martel_uri *);
+static  int     mem_open(martel_port_t *);
+static  int     mem_close(martel_port_t *);
+static  int     mem_write(martel_port_t *,const void *,int);
+static  int     mem_writev(martel_port_t *,const struct iovec *,int);
+static  int     mem_write_rt(martel_port_t *,const void *,int);
+static  int     mem_read(martel_port_t *,void *,int);
+static  int     mem_sync(martel_port_t *);
+static  int     mem_flush(martel_port_t *);
+static  int     mem_get_pending(martel_port_t *);
+static  int     mem_get_fd(martel_port_t *);
+
+/* PUBLIC DEFINITIONS -------------------------------------------------------*/
+
+const martel_ops_t mem_ops = {
+        MARTEL_MEMORY,
+        "memory",
+        mem_get_uri,
+        mem_create_from_uri,
+        mem_open,
+        mem_close,
+        mem_write,
+        mem_writev,
+        mem_write_rt,
+        mem_read,
+        mem_sync,
+        mem_flush,
+        mem_get_pending,
+        mem_get_fd
+};
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_drain
+Purpose   :  Let simulated printer take data out of ring up to now
+Inputs    :  p : port structure
+Outputs   :  Ring tail is updated
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void mem_drain(martel_port_t *p)
+{
+        long long now = timeout_now();
+        long long n;
+
+        if (p->set.mem.bandwidth==0 || p->set.mem.tail==p->set.mem.head) {
+                p->set.mem.tail = p->set.mem.head;
+                p->set.mem.drained = now;
+                return;
+        }
+
+        n = (now-p->set.mem.drained)*p->set.mem.bandwidth/1000000;
+
+        if (n>=p->set.mem.head-p->set.mem.tail) {
+                p->set.mem.tail = p->set.mem.head;
+                p->set.mem.drained = now;
+        }
+        else if (n>0) {
+                /*keep the fraction of a byte already elapsed*/
+                p->set.mem.tail += n;
+                p->set.mem.drained += n*1000000/p->set.mem.bandwidth;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_wait
+Purpose   :  Sleep until bytes have been taken by simulated printer or
+             deadline is reached
+Inputs    :  p        : port structure
+             bytes    : number of bytes to wait for
+             deadline : time limit in microseconds, 0 for none
+Outputs   :  <>
+Return    :  MARTEL_OK or MARTEL_WRITE_TIMEOUT
+-----------------------------------------------------------------------------*/
+static int mem_wait(martel_port_t *p,long long bytes,long long deadline)
+{
+        struct timespec ts;
+        long long now = timeout_now();
+        long long us;
+
+        if (deadline!=0 && now>=deadline) {
+                return MARTEL_WRITE_TIMEOUT;
+        }
+
+        us = bytes*1000000/p->set.mem.bandwidth+1;
+
+        if (us>MEM_WAIT_MAX*1000) {
+                us = MEM_WAIT_MAX*1000;
+        }
+        if (deadline!=0 && now+us>deadline) {
+                us = deadline-now;
+        }
+
+        ts.tv_sec = us/1000000;
+        ts.tv_nsec = (us%1000000)*1000;
+        nanosleep(&ts,NULL);
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_get_uri
+Purpose   :  Get URI string defining memory port
+Inputs    :  p    : port structure
+             uri  : URI string buffer
+             size : URI string buffer size (includes trailing zero)
+Outputs   :  Fills URI string buffer
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int mem_get_uri(martel_port_t *p,char *uri,int size)
+{
+        if (snprintf(uri,size,"martel:%s?type=memory+size=%d+bandwidth=%d",
+                        p->set.mem.name,
+                        p->set.mem.size,
+                        p->set.mem.bandwidth)>=size) {
+                return MARTEL_INVALID_URI;
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_create_from_uri
+Purpose   :  Create memory port from URI string
+Inputs    :  p  : port structure
+             su : URI structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int mem_create_from_uri(martel_port_t *p,struct martel_uri *su)
+{
+        const char *device;
+        const char *value;
+        char *end;
+        long n;
+
+        if ((device = uri_get_device(su))==NULL) {
+                return MARTEL_INVALID_URI;
+        }
+
+        if (strlen(device)>sizeof(p->set.mem.name)-1) {
+                return MARTEL_NAME_TOO_LONG;
+        }
+
+        strcpy(p->set.mem.name,device);
+
+        p->set.mem.size = MEM_DEFSIZE;
+        p->set.mem.bandwidth = 0;
+
+        /*set ring size parameter (if it exists)*/
+        if ((value = uri_get_opt(su,"size"))!=NULL) {
+                n = strtol(value,&end,10);
+
+                if (*end!=0 || n<=0 || n>0x10000000) {
+                        return MARTEL_INVALID_URI;
+                }
+
+                p->set.mem.size = n;
+        }
+
+        /*set bandwidth parameter (if it exists)*/
+        if ((value = uri_get_opt(su,"bandwidth"))!=NULL) {
+                n = strtol(value,&end,10);
+
+                if (*end!=0 || n<0 || n>0x40000000) {
+                        return MARTEL_INVALID_URI;
+                }
+
+                p->set.mem.bandwidth = n;
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_open
+Purpose   :  Open memory port, allocating an empty ring
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int mem_open(martel_port_t *p)
+{
+        if ((p->set.mem.buf = malloc(p->set.mem.size))==NULL) {
+                return MARTEL_OPEN_FAILED;
+        }
+
+        p->set.mem.head = 0;
+        p->set.mem.tail = 0;
+        p->set.mem.drained = timeout_now();
+        p->set.mem.reply_len = 0;
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_close
+Purpose   :  Close memory port
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int mem_close(martel_port_t *p)
+{
+        free(p->set.mem.buf);
+        p->set.mem.buf = NULL;
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_write
+Purpose   :  Write data buffer to ring, waiting for room when it is full
+Inputs    :  p    : port structure
+             buf  : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int mem_write(martel_port_t *p,const void *buf,int size)
+{
+        martel_error_t errnum = MARTEL_OK;
+        long long deadline;
+
+        p->written = 0;
+
+        deadline = p->write_timeout==0 ? 0 : timeout_now()+p->write_timeout*1000LL;
+
+        while (size) {
+                int pos;
+                int n;
+
+                mem_drain(p);
+
+                n = p->set.mem.size-(p->set.mem.head-p->set.mem.tail);
+
+                if (n==0) {
+                        if ((errnum = mem_wait(p,1,deadline))<0) {
+                                break;
+                        }
+                        continue;
+                }
+
+                /*copy up to end of ring at most*/
+                pos = p->set.mem.head%p->set.mem.size;
+
+                if (n>p->set.mem.size-pos) {
+                        n = p->set.mem.size-pos;
+                }
+                if (n>size) {
+                        n = size;
+                }
+
+                memcpy(p->set.mem.buf+pos,buf,n);
+
+                p->set.mem.head += n;
+                buf += n;
+                size -= n;
+                p->written += n;
+        }
+
+        return errnum;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_writev
+Purpose   :  Write data fragments to ring, one after the other
+Inputs    :  p   : port structure
+             iov : data fragments
+             n   : number of fragments
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int mem_writev(martel_port_t *p,const struct iovec *iov,int n)
+{
+        martel_error_t errnum = MARTEL_OK;
+        int written = 0;
+
+        while (n--) {
+                errnum = mem_write(p,iov->iov_base,iov->iov_len);
+                written += p->written;
+
+                if (errnum<0) {
+                        break;
+                }
+                iov++;
+        }
+
+        p->written = written;
+
+        return errnum;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_write_rt
+Purpose   :  Write real-time commands: ring is flushed like output buffers
+             of a real port, status requests are answered
+Inputs    :  p    : port structure
+             buf  : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int mem_write_rt(martel_port_t *p,const void *buf,int size)
+{
+        const unsigned char *b = buf;
+        int i;
+
+        mem_flush(p);
+
+        for (i=0; i+2<size; i++) {
+                if (b[i]==DLE && b[i+1]==EOT
+                    && p->set.mem.reply_len<MEM_REPLY_MAX) {
+                        p->set.mem.reply[p->set.mem.reply_len++] = MEM_STATUS_READY;
+                }
+        }
+
+        p->written = size;
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_read
+Purpose   :  Read answers to status requests. Without any, read times out
+             after read timeout (at once if there is no read timeout)
+Inputs    :  p    : port structure
+             buf  : data buffer
+             size : data buffer size in bytes
+Outputs   :  Fills data buffer
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int mem_read(martel_port_t *p,void *buf,int size)
+{
+        struct timespec ts;
+
+        if (size>p->set.mem.reply_len) {
+                ts.tv_sec = p->read_timeout/1000;
+                ts.tv_nsec = (p->read_timeout%1000)*1000000;
+                nanosleep(&ts,NULL);
+
+                return MARTEL_READ_TIMEOUT;
+        }
+
+        memcpy(buf,p->set.mem.reply,size);
+
+        p->set.mem.reply_len -= size;
+        memmove(p->set.mem.reply,p->set.mem.reply+size,p->set.mem.reply_len);
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_sync
+Purpose   :  Block until simulated printer has taken all data
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int mem_sync(martel_port_t *p)
+{
+        martel_error_t errnum = MARTEL_OK;
+        long long deadline;
+
+        deadline = p->write_timeout==0 ? 0 : timeout_now()+p->write_timeout*1000LL;
+
+        while (mem_drain(p),p->set.mem.tail!=p->set.mem.head) {
+                if ((errnum = mem_wait(p,p->set.mem.head-p->set.mem.tail,deadline))<0) {
+                        break;
+                }
+        }
+
+        return errnum;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_flush
+Purpose   :  Discard data in ring and pending status answers
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int mem_flush(martel_port_t *p)
+{
+        p->set.mem.tail = p->set.mem.head;
+        p->set.mem.drained = timeout_now();
+        p->set.mem.reply_len = 0;
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_get_pending
+Purpose   :  Get number of bytes in ring not taken by simulated printer yet
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  number of bytes
+-----------------------------------------------------------------------------*/
+static int mem_get_pending(martel_port_t *p)
+{
+        mem_drain(p);
+
+        return p->set.mem.head-p->set.mem.tail;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  mem_get_fd
+Purpose   :  Get descriptor of memory port for event loops
+             The simulated printer drains with time, not with events
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_NOT_IMPLEMENTED
+-----------------------------------------------------------------------------*/
+static int mem_get_fd(martel_port_t *p)
+{
+        return MARTEL_NOT_IMPLEMENTED;
+}
@@ -0,0 +1,491 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments Ltd.
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : optimize.c
+* DESCRIPTION   : MARTEL library - command stream optimizer
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of libmartel.
+*
+*   libmartel is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   libmartel is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with libmartel; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <martel/martel.h>
+#include <martel/martel-private.h>
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+/*graphics band: ESC Z, BAND_HEIGHT x (count, count bytes), LF*/
+#define BAND_HEIGHT             24      /*dotlines*/
+#define BAND_SIZE_MAX           (2+BAND_HEIGHT*256+1)
+
+#define FEED_MAX                255     /*dotlines*/
+
+#define OUT_BUFSIZE             4096    /*bytes*/
+
+/*bytes starting commands, other bytes are text or single byte controls*/
+#define IS_COMMAND(c)           ((c)==ESC || (c)==GS || (c)==FS || (c)==DLE)
+
+typedef struct {
+        martel_output_t output;
+        void *          ctx;
+
+        /*command being received*/
+        unsigned char   cmd[BAND_SIZE_MAX];
+        int             cmd_len;
+
+        /*printer state, -1 if unknown*/
+        int             font;
+
+        /*commands held back until something else is received*/
+        int             pending_font;           /*-1 if none*/
+        int             feed_cmd;               /*'J', 'j' or 0 if none*/
+        int             feed;                   /*dotlines*/
+
+        /*unknown command received, rest of stream is copied*/
+        int             passthrough;
+
+        unsigned char   out[OUT_BUFSIZE];
+        int             out_len;
+
+        int             errnum;
+} martel_optimizer_t;
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  out_flush
+Purpose   :  Hand optimized data to output function
+Inputs    :  o : optimizer structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int out_flush(martel_optimizer_t *o)
+{
+        if (o->out_len!=0 && o->errnum==MARTEL_OK) {
+                o->errnum = o->output(o->ctx,o->out,o->out_len);
+        }
+
+        o->out_len = 0;
+
+        return o->errnum;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  out_write
+Purpose   :  Append data to output buffer
+Inputs    :  o : optimizer structure
+             buf : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void out_write(martel_optimizer_t *o,const unsigned char *buf,int size)
+{
+        while (size) {
+                int n = OUT_BUFSIZE-o->out_len;
+
+                if (n>size)
+                        n = size;
+
+                memcpy(o->out+o->out_len,buf,n);
+                o->out_len += n;
+                buf += n;
+                size -= n;
+
+                if (o->out_len==OUT_BUFSIZE)
+                        out_flush(o);
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  emit_pending
+Purpose   :  Write commands held back
+Inputs    :  o : optimizer structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void emit_pending(martel_optimizer_t *o)
+{
+        if (o->feed_cmd!=0) {
+                unsigned char cmd[3] = {ESC,o->feed_cmd,o->feed};
+
+                out_write(o,cmd,sizeof(cmd));
+                o->feed_cmd = 0;
+        }
+
+        if (o->pending_font!=-1) {
+                unsigned char cmd[3] = {ESC,'!',o->pending_font};
+
+                out_write(o,cmd,sizeof(cmd));
+                o->font = o->pending_font;
+                o->pending_font = -1;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  write_band
+Purpose   :  Write graphics band, trailing white pixels of each dotline are
+             dropped (dotlines shorter than printer width are completed with
+             white pixels, a blank dotline is sent as a single empty run)
+Inputs    :  o : optimizer structure
+             band : graphics band
+             size : graphics band size in bytes
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void write_band(martel_optimizer_t *o,const unsigned char *band,int size)
+{
+        const unsigned char *p = band+2;
+        int line;
+
+        /*band is copied unchanged if it is not terminated as expected*/
+        if (band[size-1]!=LF) {
+                out_write(o,band,size);
+                return;
+        }
+
+        out_write(o,band,2);
+
+        for (line=0; line<BAND_HEIGHT; line++) {
+                int count = p[0];
+                unsigned char c;
+
+                /*white runs (00xxxxxx) and white 7 pixel images (10000000)*/
+                while (count>0 && ((p[count]&0xc0)==0x00 || p[count]==0x80))
+                        count--;
+
+                if (count==0) {
+                        static const unsigned char blank[2] = {1,0x00};
+
+                        out_write(o,blank,sizeof(blank));
+                }
+                else {
+                        c = count;
+                        out_write(o,&c,1);
+                        out_write(o,p+1,count);
+                }
+
+                p += p[0]+1;
+        }
+
+        out_write(o,band+size-1,1);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  process_command
+Purpose   :  Optimize one complete command (or character)
+Inputs    :  o : optimizer structure
+             cmd : command buffer
+             size : command size in bytes
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void process_command(martel_optimizer_t *o,const unsigned char *cmd,int size)
+{
+        if (cmd[0]!=ESC) {
+                /*text and single byte controls*/
+                if (IS_COMMAND(cmd[0])) {
+                        o->passthrough = 1;
+                        o->font = -1;
+                }
+                emit_pending(o);
+                out_write(o,cmd,size);
+                return;
+        }
+
+        switch (cmd[1]) {
+        case '!':
+                /*font change, superseded by next one, no-op if already set*/
+                if (cmd[2]==o->font && o->pending_font==-1)
+                        break;
+                o->pending_font = (cmd[2]==o->font) ? -1 : cmd[2];
+                break;
+
+        case 'J':
+        case 'j':
+                /*feeds in same direction are merged (each one prints
+                 *the line buffer first, which is empty after the first)*/
+                if (o->feed_cmd==cmd[1] && o->feed+cmd[2]<=FEED_MAX) {
+                        o->feed += cmd[2];
+                }
+                else {
+                        if (o->feed_cmd!=0) {
+                                unsigned char feed[3] = {ESC,o->feed_cmd,o->feed};
+                                out_write(o,feed,sizeof(feed));
+                        }
+                        o->feed_cmd = cmd[1];
+                        o->feed = cmd[2];
+                }
+                break;
+
+        case '@':
+                /*reset discards pending font change*/
+                o->pending_font = -1;
+                emit_pending(o);
+                out_write(o,cmd,size);
+                o->font = -1;
+                break;
+
+        case 'Z':
+                emit_pending(o);
+                write_band(o,cmd,size);
+                break;
+
+        default:
+                /*parameters of unknown commands cannot be told from
+                 *commands, so nothing is changed from here on*/
+                emit_pending(o);
+                out_write(o,cmd,size);
+                o->passthrough = 1;
+                o->font = -1;
+                break;
+        }
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_command_length
+Purpose   :  Get length of command or character at start of buffer
+             Unknown ESC sequences are counted as 2 bytes
+Inputs    :  buf  : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  length in bytes, 0 if buffer ends inside the command
+-----------------------------------------------------------------------------*/
+int martel_command_length(const void *buf,int size)
+{
+        const unsigned char *p = buf;
+        int len;
+        int line;
+
+        if (size<1)
+                return 0;
+
+        if (p[0]!=ESC)
+                return 1;
+
+        if (size<2)
+                return 0;
+
+        switch (p[1]) {
+        case '!':
+        case 'J':
+        case 'j':
+                len = 3;
+                break;
+        case 'Z':
+                for (len=2, line=0; line<BAND_HEIGHT; line++) {
+                        if (len>=size)
+                                return 0;
+                        len += p[len]+1;
+                }
+                len++;
+                break;
+        default:
+                len = 2;
+                break;
+        }
+
+        return (len<=size) ? len : 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_create_optimizer
+Purpose   :  Create command stream optimizer
+             Commands are parsed as they are written. Font changes which do
+             not change anything are dropped, adjacent feeds are merged and
+             trailing white pixels of graphics dotlines are removed. Memory
+             used is bounded by one graphics band.
+             Optimization stops at the first command unknown to the
+             optimizer, the rest of the stream is copied unchanged.
+Inputs    :  output : function receiving optimized data
+             ctx : context pointer passed to output function
+Outputs   :  <>
+Return    :  optimizer structure or NULL on error
+-----------------------------------------------------------------------------*/
+void *martel_create_optimizer(martel_output_t output,void *ctx)
+{
+        martel_optimizer_t *o;
+
+        if (output==NULL) {
+                return NULL;
+        }
+
+        if ((o = malloc(sizeof(martel_optimizer_t)))==NULL) {
+                return NULL;
+        }
+
+        o->output = output;
+        o->ctx = ctx;
+        o->cmd_len = 0;
+        o->font = -1;
+        o->pending_font = -1;
+        o->feed_cmd = 0;
+        o->feed = 0;
+        o->passthrough = 0;
+        o->out_len = 0;
+        o->errnum = MARTEL_OK;
+
+        return o;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_destroy_optimizer
+Purpose   :  Destroy command stream optimizer (data held back is lost, see
+             martel_optimizer_flush)
+Inputs    :  optimizer : optimizer structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_destroy_optimizer(void *optimizer)
+{
+        if (optimizer==NULL) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        free(optimizer);
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_optimizer_write
+Purpose   :  Write data to command stream optimizer
+Inputs    :  optimizer : optimizer structure
+             buf  : data buffer
+             size : data buffer size in bytes
+Outputs   :  <>
+Return    :  MARTEL_OK or error code returned by output function
+-----------------------------------------------------------------------------*/
+int martel_optimizer_write(void *optimizer,const void *buf,int size)
+{
+        martel_optimizer_t *o = optimizer;
+        const unsigned char *p = buf;
+
+        if (o==NULL) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        while (size && o->errnum==MARTEL_OK) {
+                int len;
+
+                if (o->passthrough) {
+                        emit_pending(o);
+                        if (o->cmd_len) {
+                                out_write(o,o->cmd,o->cmd_len);
+                                o->cmd_len = 0;
+                        }
+                        out_write(o,p,size);
+                        break;
+                }
+
+                if (o->cmd_len==0) {
+                        /*fast path, text is copied in one go*/
+                        for (len=0; len<size && !IS_COMMAND(p[len]); len++)
+                                ;
+
+                        if (len!=0) {
+                                emit_pending(o);
+                                out_write(o,p,len);
+                                p += len;
+                                size -= len;
+                                continue;
+                        }
+
+                        /*command is complete in caller buffer*/
+                        len = martel_command_length(p,size);
+
+                        if (len!=0) {
+                                process_command(o,p,len);
+                                p += len;
+                                size -= len;
+                                continue;
+                        }
+                }
+
+                /*command is split across writes, collect it*/
+                o->cmd[o->cmd_len++] = *p++;
+                size--;
+
+                len = martel_command_length(o->cmd,o->cmd_len);
+
+                if (len!=0) {
+                        process_command(o,o->cmd,len);
+                        o->cmd_len = 0;
+                }
+        }
+
+        return o->errnum;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_optimizer_flush
+Purpose   :  Write all data held back by optimizer (end of stream)
+Inputs    :  optimizer : optimizer structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code returned by output function
+-----------------------------------------------------------------------------*/
+int martel_optimizer_flush(void *optimizer)
+{
+        martel_optimizer_t *o = optimizer;
+
+        if (o==NULL) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        emit_pending(o);
+
+        /*incomplete command is sent as received*/
+        if (o->cmd_len) {
+                out_write(o,o->cmd,o->cmd_len);
+                o->cmd_len = 0;
+        }
+
+        return out_flush(o);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_optimizer_sync
+Purpose   :  Write data held back by optimizer up to last complete command
+             Incomplete command is kept, stream goes on after this call
+Inputs    :  optimizer : optimizer structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code returned by output function
+-----------------------------------------------------------------------------*/
+int martel_optimizer_sync(void *optimizer)
+{
+        martel_optimizer_t *o = optimizer;
+
+        if (o==NULL) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        emit_pending(o);
+
+        return out_flush(o);
+}
@@ -34,6 +34,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <time.h>
 #include <sys/ioctl.h>
@@ -47,15 +48,8 @@
 
 /* PRIVATE DEFINITIONS ------------------------------------------------------*/
 static const char id_str[] = "$Id: parallel.c,v 1.1 2006/08/01 09:12:21 chris Exp $";
-/*timeout flag*/
-static  sig_atomic_t    par_timeout;
-
-/*old SIGALRM signal handler*/
-static  struct sigaction        par_old_sa;
-
-static  void    par_timer(int);
-static  void    par_start_timer(int);
-static  void    par_stop_timer(void);
+/*pause while nothing could be written in interrupt mode*/
+#define PAR_RETRY_DELAY         1       /*ms*/
 
 static  int     par_clear_irq(martel_port_t *);
 static  int     par_wait_irq(martel_port_t *);
@@ -66,6 +60,7 @@ static  int     par_control_clear(martel_port_t *,unsigned char);
 static  int     par_get_status(martel_port_t *,unsigned char *);
 
 static  int     par_write_byte(martel_port_t *,const void *);
+static  int     par_write_data(martel_port_t *,const void *,int);
 static  int     par_read_byte(martel_port_t *,void *);
 
 static  const char *    mode_to_string(int);
@@ -91,67 +86,26 @@ static  int     string_to_mode(const char *);
 #define IS_ACK_ASSERTED(s)      (((s)&PARPORT_STATUS_ACK)==0)
 #define IS_ACK_DEASSERTED(s)    (((s)&PARPORT_STATUS_ACK)!=0)
 
-/* PRIVATE FUNCTIONS --------------------------------------------------------*/
-
-/*-----------------------------------------------------------------------------
-Name      :  par_timer
-Purpose   :  Custom signal handler for SIGALRM signals
-Inputs    :  signum : signal number
-Outputs   :  <>
-Return    :  <>
------------------------------------------------------------------------------*/
-static void par_timer(int signum)
-{
-        par_timeout = 1;
-}
-
-/*-----------------------------------------------------------------------------
-Name      :  par_start_timer
-Purpose   :  Start operation timer
-Inputs    :  timeout : timeout in milliseconds
-Outputs   :  <>
-Return    :  <>
------------------------------------------------------------------------------*/
-static void par_start_timer(int timeout)
-{
-        struct sigaction sa;
-        struct itimerval timer;
-        
-        /*clear timeout flag*/
-        par_timeout = 0;
-
-        /*install signal handler*/
-        memset(&sa,0,sizeof(sa));
-        sa.sa_handler = &par_timer;
-        sigaction(SIGALRM,&sa,&par_old_sa);
-
-        /*start timer*/
-        timer.it_interval.tv_sec = 0;
-        timer.it_interval.tv_usec = 0;
-        timer.it_value.tv_sec = timeout/1000;
-        timer.it_value.tv_usec = (timeout%1000)*1000;
-
-        setitimer(ITIMER_REAL,&timer,NULL);
-}
-
-/*-----------------------------------------------------------------------------
-Name      :  par_stop_timer
-Purpose   :  Stop operation timer
-Inputs    :  <>
-Outputs   :  <>
-Return    :  <>
------------------------------------------------------------------------------*/
-static void par_stop_timer(void)
-{
-        struct itimerval timer;
+/* PUBLIC DEFINITIONS -------------------------------------------------------*/
+
+const martel_ops_t par_ops = {
+        MARTEL_PARALLEL,
+        "parallel",
+        par_get_uri,
+        par_create_from_uri,
+        par_open,
+        par_close,
+        par_write,
+        par_writev,
+        par_write_rt,
+        par_read,
+        par_sync,
+        par_flush,
+        par_get_pending,
+        par_get_fd
+};
 
-        /*stop timer*/
-        memset(&timer,0,sizeof(timer));
-        setitimer(ITIMER_REAL,&timer,NULL);
-
-        /*uninstall signal handler*/
-        sigaction(SIGALRM,&par_old_sa,NULL);
-}
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
 
 /*-----------------------------------------------------------------------------
 Name      :  par_clear_irq
@@ -183,25 +137,29 @@ Return    :  MARTEL_OK or error code
 -----------------------------------------------------------------------------*/
 static int par_wait_irq(martel_port_t *p)
 {
-        fd_set fds;
         int irq_count;
+        int left;
+        int n;
 
         /*if no IRQ are left, there is nothing to wait for*/
         if (p->set.par.irq_left==0) {
                 return MARTEL_OK;
         }
 
-        FD_ZERO(&fds);
-        FD_SET(p->set.par.fd,&fds);
+        /*wait IRQ until deadline of operation*/
+        if ((left = deadline_left(p))==0) {
+                return MARTEL_WRITE_TIMEOUT;
+        }
 
-        /*wait IRQ*/
-        if (select(p->set.par.fd+1,&fds,NULL,NULL,NULL)<0) {
-                if (par_timeout) {
-                        return MARTEL_WRITE_TIMEOUT;
-                }
-                else {
-                        return MARTEL_IO_ERROR;
-                }
+        rt_io_begin(p);
+        n = wait_fd(p->set.par.fd,POLLIN,left<0 ? 0 : left);
+        rt_io_end(p);
+
+        if (n==0) {
+                return MARTEL_WRITE_TIMEOUT;
+        }
+        else if (n<0) {
+                return MARTEL_IO_ERROR;
         }
         
         /*update IRQ counter*/
@@ -231,11 +189,16 @@ Return    :  MARTEL_OK or error code
 static int par_control_set(martel_port_t *p,unsigned char mask)
 {
         struct ppdev_frob_struct fs;
+        int n;
 
         fs.mask = mask;
         fs.val = mask;
 
-        if (ioctl(p->set.par.fd,PPFCONTROL,&fs)<0) {
+        rt_io_begin(p);
+        n = ioctl(p->set.par.fd,PPFCONTROL,&fs);
+        rt_io_end(p);
+
+        if (n<0) {
                 return MARTEL_IO_ERROR;
         }
         else {
@@ -254,11 +217,16 @@ Return    :  MARTEL_OK or error code
 static int par_control_clear(martel_port_t *p,unsigned char mask)
 {
         struct ppdev_frob_struct fs;
+        int n;
 
         fs.mask = mask;
         fs.val = 0;
 
-        if (ioctl(p->set.par.fd,PPFCONTROL,&fs)<0) {
+        rt_io_begin(p);
+        n = ioctl(p->set.par.fd,PPFCONTROL,&fs);
+        rt_io_end(p);
+
+        if (n<0) {
                 return MARTEL_IO_ERROR;
         }
         else {
@@ -300,7 +268,13 @@ Return    :  MARTEL_OK or error code
 -----------------------------------------------------------------------------*/
 static int par_get_status(martel_port_t *p,unsigned char *status)
 {
-        if (ioctl(p->set.par.fd,PPRSTATUS,status)<0) {
+        int n;
+
+        rt_io_begin(p);
+        n = ioctl(p->set.par.fd,PPRSTATUS,status);
+        rt_io_end(p);
+
+        if (n<0) {
                 return MARTEL_IO_ERROR;
         }
         else {
@@ -321,6 +295,7 @@ static int par_write_byte(martel_port_t *p,const void *buf)
 {
         martel_error_t errnum;
         unsigned char status;
+        int n;
 
         /*wait until BUSY is deasserted*/
         if ((errnum = par_get_status(p,&status))<0) {
@@ -331,13 +306,17 @@ static int par_write_byte(martel_port_t *p,const void *buf)
                 if ((errnum = par_get_status(p,&status))<0) {
                         return errnum;
                 }
-                if (par_timeout) {
+                if (deadline_expired(p)) {
                         return MARTEL_WRITE_TIMEOUT;
                 }
         }
 
         /*write data*/
-        if (ioctl(p->set.par.fd,PPWDATA,buf)<0) {
+        rt_io_begin(p);
+        n = ioctl(p->set.par.fd,PPWDATA,buf);
+        rt_io_end(p);
+
+        if (n<0) {
                 return MARTEL_IO_ERROR;
         }
 
@@ -355,7 +334,7 @@ static int par_write_byte(martel_port_t *p,const void *buf)
                 if ((errnum = par_get_status(p,&status))<0) {
                         return errnum;
                 }
-                if (par_timeout) {
+                if (deadline_expired(p)) {
                         return MARTEL_WRITE_TIMEOUT;
                 }
         }
@@ -382,7 +361,7 @@ static int par_write_byte(martel_port_t *p,const void *buf)
                 if ((errnum = par_get_status(p,&status))<0) {
                         return errnum;
                 }
-                if (par_timeout) {
+                if (deadline_expired(p)) {
                         return MARTEL_WRITE_TIMEOUT;
                 }
         }
@@ -397,7 +376,7 @@ static int par_write_byte(martel_port_t *p,const void *buf)
                 if ((errnum = par_get_status(p,&status))<0) {
                         return errnum;
                 }
-                if (par_timeout) {
+                if (deadline_expired(p)) {
                         return MARTEL_WRITE_TIMEOUT;
                 }
         }
@@ -405,6 +384,81 @@ static int par_write_byte(martel_port_t *p,const void *buf)
         return MARTEL_OK;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  par_write_data
+Purpose   :  Write data buffer to parallel port, within deadline of current
+             write operation
+Inputs    :  p    : port structure
+             buf  : data buffer
+             size : data buffer size in bytes
+Outputs   :  p->written : incremented by bytes written
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int par_write_data(martel_port_t *p,const void *buf,int size)
+{
+        martel_error_t errnum = MARTEL_OK;
+
+        if (p->set.par.mode==MARTEL_POLL) {
+                /*polling mode*/
+                while (size) {
+                        if ((errnum = par_write_byte(p,buf))<0) {
+                                break;
+                        }
+                        else {
+                                buf++;
+                                size--;
+                                p->written++;
+                        }
+                }
+
+                if (errnum!=MARTEL_OK) {
+                        par_control_idle(p);
+                }
+        }
+        else {
+                /*interrupt mode*/
+                while (size) {
+                        int n;
+
+                        /*wait for IRQ, freeing some space in kernel buffer*/
+                        if ((errnum = par_wait_irq(p))<0) {
+                                break;
+                        }
+
+                        /*write some bytes*/
+                        rt_io_begin(p);
+                        n = write(p->set.par.fd,buf,size);
+                        rt_io_end(p);
+
+                        if (n<0 && errno==EAGAIN) {
+                                n = 0;
+                        }
+
+                        if (n<0) {
+                                errnum = MARTEL_WRITE_FAILED;
+                                break;
+                        }
+
+                        buf += n;
+                        size -= n;
+                        p->set.par.irq_left += n;
+                        p->written += n;
+
+                        if (size && deadline_expired(p)) {
+                                errnum = MARTEL_WRITE_TIMEOUT;
+                                break;
+                        }
+
+                        /*printer busy and no IRQ to wait for*/
+                        if (n==0 && p->set.par.irq_left==0) {
+                                poll(NULL,0,PAR_RETRY_DELAY);
+                        }
+                }
+        }
+
+        return errnum;
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  par_read_byte
 Purpose   :  Read one byte from parallel port using MARTEL printers timing
@@ -428,7 +482,7 @@ static int par_read_byte(martel_port_t *p,void *buf)
                 if ((errnum = par_get_status(p,&status))<0) {
                         return errnum;
                 }
-                if (par_timeout) {
+                if (deadline_expired(p)) {
                         return MARTEL_READ_TIMEOUT;
                 }
         }
@@ -447,7 +501,7 @@ static int par_read_byte(martel_port_t *p,void *buf)
                 if ((errnum = par_get_status(p,&status))<0) {
                         return errnum;
                 }
-                if (par_timeout) {
+                if (deadline_expired(p)) {
                         return MARTEL_READ_TIMEOUT;
                 }
         }
@@ -476,7 +530,7 @@ static int par_read_byte(martel_port_t *p,void *buf)
                 if ((errnum = par_get_status(p,&status))<0) {
                         return errnum;
                 }
-                if (par_timeout) {
+                if (deadline_expired(p)) {
                         return MARTEL_READ_TIMEOUT;
                 }
         }
@@ -657,6 +711,7 @@ int par_open(martel_port_t *p)
 
         /*register device behind parallel port*/
         if (ioctl(fd,PPCLAIM)<0) {
+                close(fd);
                 return MARTEL_IO_ERROR;
         }
 
@@ -664,6 +719,7 @@ int par_open(martel_port_t *p)
         mode = IEEE1284_MODE_COMPAT;
 
         if (ioctl(fd,PPSETMODE,&mode)<0) {
+                close(fd);
                 return MARTEL_IO_ERROR;
         }
 
@@ -764,62 +820,36 @@ Return    :  MARTEL_OK or error code
 -----------------------------------------------------------------------------*/
 int par_write(martel_port_t *p,const void *buf,int size)
 {
-        martel_error_t errnum = MARTEL_OK;
+        p->written = 0;
 
-        if (p->write_timeout!=0) {
-                par_start_timer(p->write_timeout);
-        }
-        else {
-                par_timeout = 0;
-        }
+        deadline_start(p,p->write_timeout);
 
-        if (p->set.par.mode==MARTEL_POLL) {
-                /*polling mode*/
-                while (size) {
-                        if ((errnum = par_write_byte(p,buf))<0) {
-                                break;
-                        }
-                        else {
-                                buf++;
-                                size--;
-                        }
-                }
+        return par_write_data(p,buf,size);
+}
 
-                if (errnum!=MARTEL_OK) {
-                        par_control_idle(p);
-                }
-        }
-        else {
-                /*interrupt mode*/
-                while (size) {
-                        int n;
+/*-----------------------------------------------------------------------------
+Name      :  par_writev
+Purpose   :  Write data fragments to parallel port. Fragments are sent by the
+             same byte loop as one buffer, within one write timeout
+Inputs    :  p   : port structure
+             iov : data fragments
+             n   : number of fragments
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int par_writev(martel_port_t *p,const struct iovec *iov,int n)
+{
+        martel_error_t errnum = MARTEL_OK;
 
-                        /*wait for IRQ, freeing some space in kernel buffer*/
-                        if ((errnum = par_wait_irq(p))<0) {
-                                break;
-                        }
+        p->written = 0;
 
-                        /*write some bytes*/
-                        n = write(p->set.par.fd,buf,size);
+        deadline_start(p,p->write_timeout);
 
-                        if (par_timeout) {
-                                errnum = MARTEL_WRITE_TIMEOUT;
-                                break;
-                        }
-                        else if (n<0) {
-                                errnum = MARTEL_WRITE_FAILED;
-                                break;
-                        }
-                        else {
-                                buf += n;
-                                size -= n;
-                                p->set.par.irq_left += n;
-                        }
+        while (n--) {
+                if ((errnum = par_write_data(p,iov->iov_base,iov->iov_len))<0) {
+                        break;
                 }
-        }
-
-        if (p->write_timeout!=0) {
-                par_stop_timer();
+                iov++;
         }
 
         return errnum;
@@ -865,12 +895,7 @@ int par_read(martel_port_t *p,void *buf,int size)
                 return MARTEL_IO_ERROR;
         }
 
-        if (p->read_timeout!=0) {
-                par_start_timer(p->read_timeout);
-        }
-        else {
-                par_timeout = 0;
-        }
+        deadline_start(p,p->read_timeout);
         
         while (size) {
                 if ((errnum = par_read_byte(p,buf))<0) {
@@ -885,10 +910,6 @@ int par_read(martel_port_t *p,void *buf,int size)
         if (errnum!=MARTEL_OK) {
                 par_control_idle(p);
         }
-
-        if (p->read_timeout!=0) {
-                par_stop_timer();
-        }
         
         /*set parallel port drivers as output*/
         dir = 0;
@@ -915,27 +936,31 @@ int par_sync(martel_port_t *p)
                 /*output buffer is always empty in polling mode*/
         }
         else {
-                if (p->write_timeout!=0) {
-                        par_start_timer(p->write_timeout);
-                }
-                else {
-                        par_timeout = 0;
-                }
+                deadline_start(p,p->write_timeout);
                 
                 while (p->set.par.irq_left) {
                         if ((errnum = par_wait_irq(p))<0) {
                                 break;
                         }
                 }
-
-                if (p->write_timeout!=0) {
-                        par_stop_timer();
-                }
         }
 
         return errnum;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  par_get_pending
+Purpose   :  Get number of bytes waiting in kernel output buffer
+             Parallel port writes are not buffered by the kernel
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  number of bytes or error code
+-----------------------------------------------------------------------------*/
+int par_get_pending(martel_port_t *p)
+{
+        return 0;
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  par_flush
 Purpose   :  Clear input and output buffers
@@ -958,3 +983,43 @@ int par_flush(martel_port_t *p)
         return MARTEL_OK;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  par_probe
+Purpose   :  Check whether a printer is connected to parallel port
+             A printer on line drives SELECT high, ERROR (active low) and
+             PAPEROUT inactive; open ports read them floating or low
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK if a printer is connected or error code
+-----------------------------------------------------------------------------*/
+int par_probe(martel_port_t *p)
+{
+        martel_error_t errnum;
+        unsigned char status;
+
+        if ((errnum = par_get_status(p,&status))<0) {
+                return errnum;
+        }
+
+        if ((status&PARPORT_STATUS_SELECT)==0
+            || (status&PARPORT_STATUS_ERROR)==0
+            || (status&PARPORT_STATUS_PAPEROUT)!=0) {
+                return MARTEL_INVALID_STATUS;
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  par_get_fd
+Purpose   :  Get descriptor of parallel port for event loops
+             Handshake lines are polled, the descriptor never signals room
+             for data
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  MARTEL_NOT_IMPLEMENTED
+-----------------------------------------------------------------------------*/
+int par_get_fd(martel_port_t *p)
+{
+        return MARTEL_NOT_IMPLEMENTED;
+}
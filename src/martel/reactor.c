@@ -0,0 +1,714 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : reactor.c
+* DESCRIPTION   : MARTEL library - event loop driving several ports
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of libmartel.
+*
+*   libmartel is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   libmartel is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with libmartel; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+/* A reactor lets one thread drive many printers. Ports are registered with
+ * a completion function, buffers to write and read are queued per port, and
+ * martel_reactor_run() moves data on every port whose descriptor is ready,
+ * one system call per port and direction in turn, so that a fast printer
+ * does not hold back slow ones.
+ *
+ * Descriptors are watched edge-triggered: a port is known ready from the
+ * event until a transfer returns EAGAIN, and new operations are attempted
+ * at once without another epoll_ctl() call.
+ *
+ * Write and read timeouts of each port apply as they do to blocking calls:
+ * an operation fails once no byte moved for that long. A failure ends every
+ * operation queued in the same direction, so that a stream never goes on
+ * after a missing part.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <martel/martel.h>
+#include <martel/martel-private.h>
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+#define REACTOR_EVENTS          64      /*events fetched per epoll_wait()*/
+
+typedef struct reactor_op {
+        struct reactor_op *     next;
+        unsigned char * buf;
+        int             size;           /*bytes*/
+        int             done;           /*bytes transferred so far*/
+        long long       deadline;       /*us, monotonic, 0 if none*/
+} reactor_op_t;
+
+typedef struct {
+        reactor_op_t *  head;
+        reactor_op_t *  tail;
+        int             event;          /*martel_event_t*/
+        int             ready;          /*no EAGAIN since last event*/
+} reactor_queue_t;
+
+struct reactor_port {
+        struct reactor_port *   next;
+        struct martel_reactor * reactor;
+        martel_port_t * port;
+        int             fd;
+        martel_done_t   done;
+        void *          ctx;
+        int             removed;        /*freed when run returns*/
+        reactor_queue_t writes;
+        reactor_queue_t reads;
+};
+
+typedef struct martel_reactor {
+        int             epfd;
+        struct reactor_port *   ports;
+        int             queued;         /*operations not completed*/
+        int             running;        /*inside martel_reactor_run()*/
+} martel_reactor_t;
+
+static  void    queue_drop(struct reactor_port *,reactor_queue_t *);
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  get_reactor_port
+Purpose   :  Get registration of port in reactor
+Inputs    :  r    : reactor structure
+             port : port structure
+Outputs   :  <>
+Return    :  registration or NULL if port is not registered in reactor
+-----------------------------------------------------------------------------*/
+static struct reactor_port *get_reactor_port(martel_reactor_t *r,void *port)
+{
+        martel_port_t *p = port;
+
+        if (r==NULL || p==NULL || p->reactor==NULL || p->reactor->reactor!=r) {
+                return NULL;
+        }
+
+        return p->reactor;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_timeout
+Purpose   :  Get timeout of port operations queued in one direction
+Inputs    :  rp : port registration
+             q  : operation queue
+Outputs   :  <>
+Return    :  timeout in milliseconds, 0 for none
+-----------------------------------------------------------------------------*/
+static int queue_timeout(struct reactor_port *rp,reactor_queue_t *q)
+{
+        if (q->event==MARTEL_EVENT_WRITE) {
+                return rp->port->write_timeout;
+        }
+        else {
+                return rp->port->read_timeout;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_arm
+Purpose   :  Start timeout of first operation in queue
+Inputs    :  rp : port registration
+             q  : operation queue
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void queue_arm(struct reactor_port *rp,reactor_queue_t *q)
+{
+        int ms;
+
+        if (q->head==NULL) {
+                return;
+        }
+
+        if ((ms = queue_timeout(rp,q))==0) {
+                q->head->deadline = 0;
+        }
+        else {
+                q->head->deadline = timeout_now()+ms*1000LL;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_complete
+Purpose   :  Remove first operation from queue and report it
+Inputs    :  rp     : port registration
+             q      : operation queue
+             errnum : operation result
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void queue_complete(struct reactor_port *rp,reactor_queue_t *q,int errnum)
+{
+        reactor_op_t *op = q->head;
+
+        q->head = op->next;
+        if (q->head==NULL) {
+                q->tail = NULL;
+        }
+
+        queue_arm(rp,q);
+
+        rp->reactor->queued--;
+        rp->port->errnum = errnum;
+
+        rp->done(rp->ctx,rp->port,q->event,op->buf,op->done,errnum);
+
+        free(op);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_fail
+Purpose   :  End every operation queued in one direction with an error
+             Operations queued by the completion function are kept
+Inputs    :  rp     : port registration
+             q      : operation queue
+             errnum : error code
+Outputs   :  <>
+Return    :  number of operations ended
+-----------------------------------------------------------------------------*/
+static int queue_fail(struct reactor_port *rp,reactor_queue_t *q,int errnum)
+{
+        reactor_queue_t failed = *q;
+        int n = 0;
+
+        q->head = NULL;
+        q->tail = NULL;
+
+        while (failed.head!=NULL && !rp->removed) {
+                queue_complete(rp,&failed,errnum);
+                n++;
+        }
+
+        /*port removed by completion function*/
+        queue_drop(rp,&failed);
+
+        return n;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_transfer
+Purpose   :  Move data of first operation in queue with one system call
+Inputs    :  rp : port registration
+             q  : operation queue
+Outputs   :  <>
+Return    :  number of operations completed
+-----------------------------------------------------------------------------*/
+static int queue_transfer(struct reactor_port *rp,reactor_queue_t *q)
+{
+        reactor_op_t *op = q->head;
+        int n;
+
+        if (q->event==MARTEL_EVENT_WRITE) {
+                n = write(rp->fd,op->buf+op->done,op->size-op->done);
+        }
+        else {
+                n = read(rp->fd,op->buf+op->done,op->size-op->done);
+        }
+
+        if (n<0) {
+                if (errno==EAGAIN) {
+                        /*wait for next edge*/
+                        q->ready = 0;
+                        return 0;
+                }
+                else if (errno==EINTR) {
+                        return 0;
+                }
+        }
+
+        if (n<0 || (n==0 && op->size>0 && q->event==MARTEL_EVENT_READ)) {
+                /*end of file is a failure, as for blocking reads*/
+                if (q->event==MARTEL_EVENT_WRITE) {
+                        return queue_fail(rp,q,MARTEL_WRITE_FAILED);
+                }
+                else {
+                        return queue_fail(rp,q,MARTEL_READ_FAILED);
+                }
+        }
+
+        op->done += n;
+
+        if (op->done<op->size) {
+                queue_arm(rp,q);
+                return 0;
+        }
+
+        queue_complete(rp,q,MARTEL_OK);
+
+        return 1;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_expire
+Purpose   :  End queued operations of one direction if first one timed out
+Inputs    :  rp   : port registration
+             q    : operation queue
+             now  : monotonic time in microseconds
+             wait : milliseconds until next deadline, -1 if none
+Outputs   :  Lowers wait to time left before deadline of queue
+Return    :  number of operations ended
+-----------------------------------------------------------------------------*/
+static int queue_expire(struct reactor_port *rp,reactor_queue_t *q,
+                        long long now,int *wait)
+{
+        long long left;
+
+        if (q->head==NULL || q->head->deadline==0) {
+                return 0;
+        }
+
+        left = q->head->deadline-now;
+
+        if (left<=0) {
+                if (q->event==MARTEL_EVENT_WRITE) {
+                        return queue_fail(rp,q,MARTEL_WRITE_TIMEOUT);
+                }
+                else {
+                        return queue_fail(rp,q,MARTEL_READ_TIMEOUT);
+                }
+        }
+
+        left = (left+999)/1000;
+
+        if (*wait<0 || left<*wait) {
+                *wait = left;
+        }
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_add
+Purpose   :  Queue operation on port
+Inputs    :  reactor : reactor structure
+             port    : port structure
+             event   : MARTEL_EVENT_WRITE or MARTEL_EVENT_READ
+             buf     : data buffer
+             size    : data buffer size in bytes
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+static int queue_add(void *reactor,void *port,int event,void *buf,int size)
+{
+        struct reactor_port *rp;
+        reactor_queue_t *q;
+        reactor_op_t *op;
+
+        if ((rp = get_reactor_port(reactor,port))==NULL) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        if (buf==NULL || size<0) {
+                return MARTEL_IO_ERROR;
+        }
+
+        if ((op = malloc(sizeof(reactor_op_t)))==NULL) {
+                return MARTEL_IO_ERROR;
+        }
+
+        op->next = NULL;
+        op->buf = buf;
+        op->size = size;
+        op->done = 0;
+
+        q = event==MARTEL_EVENT_WRITE ? &rp->writes : &rp->reads;
+
+        if (q->tail==NULL) {
+                q->head = op;
+                queue_arm(rp,q);
+        }
+        else {
+                q->tail->next = op;
+        }
+        q->tail = op;
+
+        rp->reactor->queued++;
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  queue_drop
+Purpose   :  Forget operations queued in one direction, without reporting them
+Inputs    :  rp : port registration
+             q  : operation queue
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void queue_drop(struct reactor_port *rp,reactor_queue_t *q)
+{
+        while (q->head!=NULL) {
+                reactor_op_t *op = q->head;
+
+                q->head = op->next;
+                rp->reactor->queued--;
+                free(op);
+        }
+
+        q->tail = NULL;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  reap_ports
+Purpose   :  Free registrations of ports removed from reactor
+Inputs    :  r : reactor structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+static void reap_ports(martel_reactor_t *r)
+{
+        struct reactor_port **prp = &r->ports;
+
+        while (*prp!=NULL) {
+                struct reactor_port *rp = *prp;
+
+                if (rp->removed) {
+                        *prp = rp->next;
+                        free(rp);
+                }
+                else {
+                        prp = &rp->next;
+                }
+        }
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_create_reactor
+Purpose   :  Create event loop driving several ports from one thread
+Inputs    :  <>
+Outputs   :  <>
+Return    :  reactor structure or NULL on error
+-----------------------------------------------------------------------------*/
+void *martel_create_reactor(void)
+{
+        martel_reactor_t *r;
+
+        if ((r = malloc(sizeof(martel_reactor_t)))==NULL) {
+                return NULL;
+        }
+
+        if ((r->epfd = epoll_create1(EPOLL_CLOEXEC))<0) {
+                free(r);
+                return NULL;
+        }
+
+        r->ports = NULL;
+        r->queued = 0;
+        r->running = 0;
+
+        return r;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_destroy_reactor
+Purpose   :  Destroy reactor, removing ports still registered
+             Queued operations are dropped without being reported
+Inputs    :  reactor : reactor structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_destroy_reactor(void *reactor)
+{
+        martel_reactor_t *r = reactor;
+
+        if (r==NULL || r->running) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        /*outside a run, removed ports are freed at once*/
+        while (r->ports!=NULL) {
+                martel_reactor_remove(r,r->ports->port);
+        }
+
+        close(r->epfd);
+        free(r);
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_reactor_add
+Purpose   :  Register open port in reactor
+             The port descriptor is switched to non-blocking mode; it stays
+             so after removal. Regular files cannot be watched and parallel
+             and memory ports have no descriptor to watch
+Inputs    :  reactor : reactor structure
+             port    : port structure
+             done    : completion function of port operations
+             ctx     : completion function context
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_reactor_add(void *reactor,void *port,martel_done_t done,void *ctx)
+{
+        martel_reactor_t *r = reactor;
+        martel_port_t *p = port;
+        struct reactor_port *rp;
+        struct epoll_event ev;
+        martel_error_t errnum;
+        int flags;
+        int fd;
+
+        if (r==NULL || p==NULL || done==NULL) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        if (!p->open) {
+                return MARTEL_PORT_NOT_OPEN;
+        }
+
+        if (p->reactor!=NULL) {
+                return MARTEL_PORT_IN_REACTOR;
+        }
+
+        if ((fd = p->ops->get_fd(p))<0) {
+                return fd;
+        }
+
+        /*queued writes must follow data held in write-combining buffer*/
+        if ((errnum = martel_flush_output(p))<0) {
+                return errnum;
+        }
+
+        if ((flags = fcntl(fd,F_GETFL))<0
+            || fcntl(fd,F_SETFL,flags|O_NONBLOCK)<0) {
+                return MARTEL_IO_ERROR;
+        }
+
+        if ((rp = calloc(1,sizeof(struct reactor_port)))==NULL) {
+                return MARTEL_IO_ERROR;
+        }
+
+        rp->reactor = r;
+        rp->port = p;
+        rp->fd = fd;
+        rp->done = done;
+        rp->ctx = ctx;
+        rp->writes.event = MARTEL_EVENT_WRITE;
+        rp->writes.ready = 1;
+        rp->reads.event = MARTEL_EVENT_READ;
+        rp->reads.ready = 1;
+
+        memset(&ev,0,sizeof(ev));
+        ev.events = EPOLLIN|EPOLLOUT|EPOLLET;
+        ev.data.ptr = rp;
+
+        if (epoll_ctl(r->epfd,EPOLL_CTL_ADD,fd,&ev)<0) {
+                free(rp);
+                return errno==EPERM ? MARTEL_NOT_IMPLEMENTED : MARTEL_IO_ERROR;
+        }
+
+        rp->next = r->ports;
+        r->ports = rp;
+        p->reactor = rp;
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_reactor_remove
+Purpose   :  Unregister port from reactor, possibly from a completion
+             function. Queued operations are dropped without being reported,
+             their buffers are no longer used
+Inputs    :  reactor : reactor structure
+             port    : port structure
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_reactor_remove(void *reactor,void *port)
+{
+        martel_reactor_t *r = reactor;
+        struct reactor_port *rp;
+
+        if ((rp = get_reactor_port(r,port))==NULL) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        epoll_ctl(r->epfd,EPOLL_CTL_DEL,rp->fd,NULL);
+
+        queue_drop(rp,&rp->writes);
+        queue_drop(rp,&rp->reads);
+
+        rp->port->reactor = NULL;
+        rp->removed = 1;
+
+        if (!r->running) {
+                reap_ports(r);
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_reactor_write
+Purpose   :  Queue data buffer to write to port
+             Buffer must stay valid until completion function is called
+Inputs    :  reactor : reactor structure
+             port    : port structure
+             buf     : data buffer
+             size    : data buffer size in bytes
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_reactor_write(void *reactor,void *port,const void *buf,int size)
+{
+        return queue_add(reactor,port,MARTEL_EVENT_WRITE,(void *)buf,size);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_reactor_read
+Purpose   :  Queue data buffer to fill with data read from port
+             Buffer must stay valid until completion function is called
+Inputs    :  reactor : reactor structure
+             port    : port structure
+             buf     : data buffer
+             size    : data buffer size in bytes
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int martel_reactor_read(void *reactor,void *port,void *buf,int size)
+{
+        return queue_add(reactor,port,MARTEL_EVENT_READ,buf,size);
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  martel_reactor_run
+Purpose   :  Move data on registered ports until no operation is queued
+             Completion functions may queue further operations
+Inputs    :  reactor : reactor structure
+             ms      : longest run in milliseconds, 0 for no limit
+Outputs   :  <>
+Return    :  number of operations completed (less than queued if time ran
+             out or a signal interrupted the wait) or error code
+-----------------------------------------------------------------------------*/
+int martel_reactor_run(void *reactor,int ms)
+{
+        martel_reactor_t *r = reactor;
+        struct epoll_event events[REACTOR_EVENTS];
+        long long end = 0;
+        int completed = 0;
+
+        if (r==NULL || r->running) {
+                return MARTEL_INVALID_PORT;
+        }
+
+        if (ms!=0) {
+                end = timeout_now()+ms*1000LL;
+        }
+
+        r->running = 1;
+
+        while (r->queued>0) {
+                struct reactor_port *rp;
+                long long now;
+                int busy = 0;
+                int wait = -1;
+                int n;
+                int i;
+
+                /*one transfer per ready port and direction in turn*/
+                for (rp=r->ports; rp!=NULL; rp=rp->next) {
+                        if (!rp->removed && rp->writes.ready && rp->writes.head) {
+                                completed += queue_transfer(rp,&rp->writes);
+                        }
+                        if (!rp->removed && rp->reads.ready && rp->reads.head) {
+                                completed += queue_transfer(rp,&rp->reads);
+                        }
+                        if (!rp->removed
+                            && ((rp->writes.ready && rp->writes.head)
+                                || (rp->reads.ready && rp->reads.head))) {
+                                busy = 1;
+                        }
+                }
+
+                now = timeout_now();
+
+                for (rp=r->ports; rp!=NULL; rp=rp->next) {
+                        if (!rp->removed) {
+                                completed += queue_expire(rp,&rp->writes,now,&wait);
+                        }
+                        if (!rp->removed) {
+                                completed += queue_expire(rp,&rp->reads,now,&wait);
+                        }
+                }
+
+                if (r->queued==0) {
+                        break;
+                }
+
+                if (end!=0) {
+                        long long left = (end-now+999)/1000;
+
+                        if (left<=0) {
+                                break;
+                        }
+                        if (wait<0 || left<wait) {
+                                wait = left;
+                        }
+                }
+
+                /*ready ports keep going, only collect new events*/
+                if (busy) {
+                        wait = 0;
+                }
+
+                if ((n = epoll_wait(r->epfd,events,REACTOR_EVENTS,wait))<0) {
+                        if (errno==EINTR) {
+                                break;
+                        }
+                        completed = MARTEL_IO_ERROR;
+                        break;
+                }
+
+                for (i=0; i<n; i++) {
+                        rp = events[i].data.ptr;
+
+                        /*errors and hangups show up at next transfer*/
+                        if (events[i].events & (EPOLLOUT|EPOLLERR|EPOLLHUP)) {
+                                rp->writes.ready = 1;
+                        }
+                        if (events[i].events & (EPOLLIN|EPOLLERR|EPOLLHUP)) {
+                                rp->reads.ready = 1;
+                        }
+                }
+        }
+
+        r->running = 0;
+
+        reap_ports(r);
+
+        return completed;
+}
@@ -0,0 +1,228 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : rt.c
+* DESCRIPTION   : MARTEL library - real-time I/O mode and jitter statistics
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of libmartel.
+*
+*   libmartel is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   libmartel is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with libmartel; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <martel/martel.h>
+#include <martel/martel-private.h>
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+/*ports holding the memory lock, memory is unlocked when last one leaves*/
+static  int             rt_locked;
+static  pthread_mutex_t rt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  rt_app_locked
+Purpose   :  Tell whether the process already holds locked memory
+Inputs    :  <>
+Outputs   :  <>
+Return    :  1 if some memory is locked, 0 if not or unknown
+-----------------------------------------------------------------------------*/
+static int rt_app_locked(void)
+{
+        char line[128];
+        long kb = 0;
+        FILE *f;
+
+        if ((f = fopen("/proc/self/status","r"))==NULL)
+                return 0;
+
+        while (fgets(line,sizeof(line),f)!=NULL) {
+                if (sscanf(line,"VmLck: %ld",&kb)==1)
+                        break;
+        }
+
+        fclose(f);
+
+        return kb>0;
+}
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  rt_enter
+Purpose   :  Switch calling thread to real-time mode requested in URI
+             Each step is optional: without privileges the thread keeps its
+             normal scheduling and port->rt.mode tells what was applied.
+             Only memory mapped so far is locked (no MCL_FUTURE), so large
+             buffers mapped later cannot make allocations fail.
+             Memory is left alone if the application locked some itself:
+             mlockall() would drop its MCL_FUTURE and munlockall() its locks.
+             Locks the application takes while a port holds the memory lock
+             are dropped when the last port leaves real-time mode.
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void rt_enter(martel_port_t *p)
+{
+        struct sched_param param;
+        cpu_set_t cpus;
+
+        assert(sizeof(cpus)<=sizeof(p->rt.saved_cpus));
+
+        p->rt.mode = 0;
+
+        if (p->rt.priority==0 && p->rt.cpu<0)
+                return;
+
+        p->rt.tid = syscall(SYS_gettid);
+
+        if (p->rt.priority>0) {
+                p->rt.saved_policy = sched_getscheduler(p->rt.tid);
+
+                if (p->rt.saved_policy>=0
+                    && sched_getparam(p->rt.tid,&param)==0) {
+                        p->rt.saved_priority = param.sched_priority;
+
+                        param.sched_priority = p->rt.priority;
+
+                        if (sched_setscheduler(p->rt.tid,SCHED_FIFO,&param)==0)
+                                p->rt.mode |= MARTEL_RT_FIFO;
+                }
+
+                pthread_mutex_lock(&rt_lock);
+                if (rt_locked>0
+                    || (!rt_app_locked() && mlockall(MCL_CURRENT)==0)) {
+                        rt_locked++;
+                        p->rt.mode |= MARTEL_RT_MLOCK;
+                }
+                pthread_mutex_unlock(&rt_lock);
+        }
+
+        if (p->rt.cpu>=0
+            && sched_getaffinity(p->rt.tid,sizeof(cpus),&cpus)==0) {
+                memcpy(p->rt.saved_cpus,&cpus,sizeof(cpus));
+
+                CPU_ZERO(&cpus);
+                CPU_SET(p->rt.cpu,&cpus);
+
+                if (sched_setaffinity(p->rt.tid,sizeof(cpus),&cpus)==0)
+                        p->rt.mode |= MARTEL_RT_PINNED;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  rt_leave
+Purpose   :  Give back settings changed by rt_enter()
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void rt_leave(martel_port_t *p)
+{
+        struct sched_param param;
+
+        if (p->rt.mode & MARTEL_RT_FIFO) {
+                param.sched_priority = p->rt.saved_priority;
+                sched_setscheduler(p->rt.tid,p->rt.saved_policy,&param);
+        }
+
+        if (p->rt.mode & MARTEL_RT_MLOCK) {
+                pthread_mutex_lock(&rt_lock);
+                if (--rt_locked==0)
+                        munlockall();
+                pthread_mutex_unlock(&rt_lock);
+        }
+
+        if (p->rt.mode & MARTEL_RT_PINNED) {
+                sched_setaffinity(p->rt.tid,sizeof(cpu_set_t),
+                                (cpu_set_t *)p->rt.saved_cpus);
+        }
+
+        p->rt.mode = 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  rt_io_begin
+Purpose   :  Account gap since end of previous port access of operation
+             A gap is time spent running driver code between two port
+             system calls; preemption of the I/O thread shows up here.
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void rt_io_begin(martel_port_t *p)
+{
+        unsigned long gap;
+
+        if (p->rt.last==0)
+                return;
+
+        gap = timeout_now()-p->rt.last;
+
+        p->rt.samples++;
+        p->rt.total += gap;
+
+        if (gap>p->rt.max)
+                p->rt.max = gap;
+
+        if (gap>RT_LATE_US)
+                p->rt.late++;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  rt_io_end
+Purpose   :  Mark end of a port access
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void rt_io_end(martel_port_t *p)
+{
+        p->rt.last = timeout_now();
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  rt_io_reset
+Purpose   :  Start a new operation. Time between operations is up to the
+             caller and is not accounted as jitter
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void rt_io_reset(martel_port_t *p)
+{
+        p->rt.last = 0;
+}
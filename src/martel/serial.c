@@ -34,6 +34,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <termios.h>
 #include <sys/ioctl.h>
@@ -51,7 +52,6 @@ static const char id_str[] = "$Id: serial.c,v 1.1 2006/08/01 09:12:23 chris Exp
 #define SERIAL_DEFBAUDRATE      MARTEL_B9600
 #define SERIAL_DEFHANDSHAKE     MARTEL_RTSCTS
 
-static  void    serial_timer(int);
 
 static  const char *    baudrate_to_string(int);
 static  const char *    handshake_to_string(int);
@@ -59,21 +59,26 @@ static  const char *    handshake_to_string(int);
 static  int     string_to_baudrate(const char *);
 static  int     string_to_handshake(const char *);
 
-/* PRIVATE FUNCTIONS --------------------------------------------------------*/
+/* PUBLIC DEFINITIONS -------------------------------------------------------*/
+
+const martel_ops_t serial_ops = {
+        MARTEL_SERIAL,
+        "serial",
+        serial_get_uri,
+        serial_create_from_uri,
+        serial_open,
+        serial_close,
+        serial_write,
+        serial_writev,
+        serial_write_rt,
+        serial_read,
+        serial_sync,
+        serial_flush,
+        serial_get_pending,
+        serial_get_fd
+};
 
-/*-----------------------------------------------------------------------------
-Name      :  serial_timer
-Purpose   :  Custom signal handler for SIGALRM signals
-Inputs    :  signum : signal number
-Outputs   :  <>
-Return    :  <>
------------------------------------------------------------------------------*/
-static void serial_timer(int signum)
-{
-        /* this function trmartel SIGALRM signals
-         * this function does nothing
-         */
-}
+/* PRIVATE FUNCTIONS --------------------------------------------------------*/
 
 /*-----------------------------------------------------------------------------
 Name      :  baudrate_to_string
@@ -350,6 +355,7 @@ int serial_open(martel_port_t *p)
 
         /*setup default serial settings*/
         if (tcgetattr(fd,&set)<0) {
+                close(fd);
                 return MARTEL_IO_ERROR;
         }
 
@@ -363,14 +369,17 @@ int serial_open(martel_port_t *p)
         set.c_cflag |= CLOCAL|CREAD;
 
         if (tcsetattr(fd,TCSANOW,&set)<0) {
+                close(fd);
                 return MARTEL_IO_ERROR;
         }
 
         if ((errnum = serial_set_baudrate(p,p->set.serial.baudrate))<0) {
+                close(fd);
                 return errnum;
         }
 
         if ((errnum = serial_set_handshake(p,p->set.serial.handshake))<0) {
+                close(fd);
                 return errnum;
         }
 
@@ -514,26 +523,15 @@ Return    :  MARTEL_OK or error code
 int serial_write(martel_port_t *p,const void *buf,int size)
 {
         martel_error_t errnum = MARTEL_OK;
-        fd_set fds;
-
-        FD_ZERO(&fds);
-        FD_SET(p->set.serial.fd,&fds);
+        p->written = 0;
 
         while (size) {
                 int n;
 
                 /*wait until some room is available in kernel write buffer*/
-                if (p->write_timeout==0) {
-                        n = select(p->set.serial.fd+1,NULL,&fds,NULL,NULL);
-                }
-                else {
-                        struct timeval tv;
-
-                        tv.tv_sec = p->write_timeout/1000;
-                        tv.tv_usec = (p->write_timeout%1000)*1000;
-
-                        n = select(p->set.serial.fd+1,NULL,&fds,NULL,&tv);
-                }
+                rt_io_begin(p);
+                n = wait_fd(p->set.serial.fd,POLLOUT,p->write_timeout);
+                rt_io_end(p);
 
                 if (n<0) {
                         errnum = MARTEL_WRITE_FAILED;
@@ -545,7 +543,9 @@ int serial_write(martel_port_t *p,const void *buf,int size)
                 }
 
                 /*write some bytes*/
+                rt_io_begin(p);
                 n = write(p->set.serial.fd,buf,size);
+                rt_io_end(p);
 
                 if (n<0) {
                         errnum = MARTEL_WRITE_FAILED;
@@ -554,12 +554,27 @@ int serial_write(martel_port_t *p,const void *buf,int size)
                 else {
                         buf += n;
                         size -= n;
+                        p->written += n;
                 }
         }
 
         return errnum;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  serial_writev
+Purpose   :  Write data fragments to serial port
+Inputs    :  p   : port structure
+             iov : data fragments
+             n   : number of fragments
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int serial_writev(martel_port_t *p,const struct iovec *iov,int n)
+{
+        return writev_fd(p,p->set.serial.fd,iov,n);
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  serial_write_rt
 Purpose   :  Write data buffer to serial port with handshaking disabled
@@ -614,26 +629,13 @@ Return    :  MARTEL_OK or error code
 int serial_read(martel_port_t *p,void *buf,int size)
 {
         martel_error_t errnum = MARTEL_OK;
-        fd_set fds;
-
-        FD_ZERO(&fds);
-        FD_SET(p->set.serial.fd,&fds);
-
         while (size) {
                 int n;
 
                 /*wait until some bytes are available in kernel read buffer*/
-                if (p->read_timeout==0) {
-                        n = select(p->set.serial.fd+1,&fds,NULL,NULL,NULL);
-                }
-                else {
-                        struct timeval tv;
-
-                        tv.tv_sec = p->read_timeout/1000;
-                        tv.tv_usec = (p->read_timeout%1000)*1000;
-
-                        n = select(p->set.serial.fd+1,&fds,NULL,NULL,&tv);
-                }
+                rt_io_begin(p);
+                n = wait_fd(p->set.serial.fd,POLLIN,p->read_timeout);
+                rt_io_end(p);
 
                 if (n<0) {
                         errnum = MARTEL_READ_FAILED;
@@ -645,7 +647,9 @@ int serial_read(martel_port_t *p,void *buf,int size)
                 }
 
                 /*read some bytes*/
+                rt_io_begin(p);
                 n = read(p->set.serial.fd,buf,size);
+                rt_io_end(p);
 
                 if (n<0) {
                         errnum = MARTEL_READ_FAILED;
@@ -669,47 +673,30 @@ Return    :  MARTEL_OK or error code
 -----------------------------------------------------------------------------*/
 int serial_sync(martel_port_t *p)
 {
-        martel_error_t errnum;
-        struct sigaction sa,old_sa;
-        struct itimerval timer;
+        int cps;
 
-        if (p->write_timeout!=0) {
-                /*install signal handler*/
-                memset(&sa,0,sizeof(sa));
-                sa.sa_handler = &serial_timer;
-                sigaction(SIGALRM,&sa,&old_sa);
+        /*10 bits per character (8N1)*/
+        cps = atoi(baudrate_to_string(p->set.serial.baudrate))/10;
 
-                /*start timer*/
-                timer.it_interval.tv_sec = 0;
-                timer.it_interval.tv_usec = 0;
-                timer.it_value.tv_sec = p->write_timeout/1000;
-                timer.it_value.tv_usec = (p->write_timeout%1000)*1000;
-
-                setitimer(ITIMER_REAL,&timer,NULL);
-        }
-
-        if (tcdrain(p->set.serial.fd)<0) {
-                if (errno==EINTR) {
-                        errnum = MARTEL_WRITE_TIMEOUT;
-                }
-                else {
-                        errnum = MARTEL_SYNC_FAILED;
-                }
-        }
-        else {
-                errnum = MARTEL_OK;
-        }
+        return wait_drain(p,p->set.serial.fd,cps);
+}
 
-        if (p->write_timeout!=0) {
-                /*stop timer*/
-                memset(&timer,0,sizeof(timer));
-                setitimer(ITIMER_REAL,&timer,NULL);
+/*-----------------------------------------------------------------------------
+Name      :  serial_get_pending
+Purpose   :  Get number of bytes waiting in kernel output buffer
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  number of bytes or error code
+-----------------------------------------------------------------------------*/
+int serial_get_pending(martel_port_t *p)
+{
+        int n;
 
-                /*uninstall signal handler*/
-                sigaction(SIGALRM,&old_sa,NULL);
+        if (ioctl(p->set.serial.fd,TIOCOUTQ,&n)<0) {
+                return MARTEL_IO_ERROR;
         }
 
-        return errnum;
+        return n;
 }
 
 /*-----------------------------------------------------------------------------
@@ -733,3 +720,14 @@ int serial_flush(martel_port_t *p)
         return errnum;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  serial_get_fd
+Purpose   :  Get descriptor of serial port for event loops
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  descriptor
+-----------------------------------------------------------------------------*/
+int serial_get_fd(martel_port_t *p)
+{
+        return p->set.serial.fd;
+}
@@ -174,6 +174,15 @@ static void test_common(void *port)
                 sprintf(line,"line %d: ABCDEFGHIJKLMNO\n",i);
                 check(martel_write(port,line,strlen(line)));
         }
+
+        /*same lines combined into a few writes*/
+        check(martel_set_output_buffer(port,256));
+        for (i=0; i<20; i++) {
+                sprintf(line,"line %d: ABCDEFGHIJKLMNO\n",i);
+                check(martel_write(port,line,strlen(line)));
+        }
+        check(martel_flush_output(port));
+        check(martel_set_output_buffer(port,0));
 }
 
 /*-----------------------------------------------------------------------------
@@ -274,6 +283,11 @@ int main(int argc,char **argv)
         case MARTEL_USB:
                 test_usb(port);
                 break;
+        case MARTEL_FILE:
+        case MARTEL_FD:
+        case MARTEL_MEMORY:
+                /*no type specific features*/
+                break;
         default:
                 fprintf(stderr,"main: unknown printer port type\n");
                 exit(1);
@@ -0,0 +1,292 @@
+/******************************************************************************
+* COMPANY       : MARTEL Instruments
+* PROJECT       : LINUX DRIVER
+*******************************************************************************
+* NAME          : timeout.c
+* DESCRIPTION   : MARTEL library - per-port deadlines and timed waits
+* CVS           : $Id$
+*******************************************************************************
+*   Copyright (C) 2026  MARTEL Instruments Ltd.
+*
+*   This file is part of libmartel.
+*
+*   libmartel is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   libmartel is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with libmartel; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*******************************************************************************
+* HISTORY       :
+*   19-Oct-26   AGT     Initial revision
+******************************************************************************/
+
+/* Timed operations never use signals or process-wide timers: waits on a
+ * descriptor are poll() timeouts, busy loops compare the monotonic clock
+ * with a deadline kept in the port structure. Any number of ports can
+ * then have timed operations in flight, from any number of threads, and
+ * SIGALRM is left to the application.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#include <martel/martel.h>
+#include <martel/martel-private.h>
+
+/* PRIVATE DEFINITIONS ------------------------------------------------------*/
+static const char id_str[] = "$Id$";
+
+#define DRAIN_STEP_MIN          1       /*ms*/
+#define DRAIN_STEP_MAX          50      /*ms*/
+
+#define WRITEV_CHUNK            64      /*fragments per writev() call*/
+
+/* PUBLIC FUNCTIONS ---------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+Name      :  timeout_now
+Purpose   :  Get monotonic time
+Inputs    :  <>
+Outputs   :  <>
+Return    :  time in microseconds
+-----------------------------------------------------------------------------*/
+long long timeout_now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC,&ts);
+
+        return (long long)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  deadline_start
+Purpose   :  Set deadline of port operation
+Inputs    :  p  : port structure
+             ms : timeout in milliseconds, 0 for none
+Outputs   :  <>
+Return    :  <>
+-----------------------------------------------------------------------------*/
+void deadline_start(martel_port_t *p,int ms)
+{
+        if (ms==0) {
+                p->deadline = 0;
+        }
+        else {
+                p->deadline = timeout_now()+ms*1000LL;
+        }
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  deadline_expired
+Purpose   :  Check whether deadline of port operation is reached
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  1 if reached, 0 otherwise or if there is no deadline
+-----------------------------------------------------------------------------*/
+int deadline_expired(martel_port_t *p)
+{
+        return p->deadline!=0 && timeout_now()>=p->deadline;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  deadline_left
+Purpose   :  Get time left before deadline of port operation
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  milliseconds (rounded up), -1 if there is no deadline
+-----------------------------------------------------------------------------*/
+int deadline_left(martel_port_t *p)
+{
+        long long left;
+
+        if (p->deadline==0) {
+                return -1;
+        }
+
+        left = p->deadline-timeout_now();
+
+        if (left<=0) {
+                return 0;
+        }
+
+        return (left+999)/1000;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  wait_fd
+Purpose   :  Wait until descriptor is ready
+Inputs    :  fd     : file descriptor
+             events : poll() events (POLLIN, POLLOUT)
+             ms     : timeout in milliseconds, 0 to wait forever
+Outputs   :  <>
+Return    :  1 if ready, 0 on timeout, -1 on error (errno is set)
+-----------------------------------------------------------------------------*/
+int wait_fd(int fd,int events,int ms)
+{
+        struct pollfd pfd;
+        int n;
+
+        pfd.fd = fd;
+        pfd.events = events;
+
+        n = poll(&pfd,1,ms==0 ? -1 : ms);
+
+        if (n>0 && (pfd.revents & POLLNVAL)) {
+                errno = EBADF;
+                return -1;
+        }
+
+        return n;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  wait_drain
+Purpose   :  Wait until terminal output queue is transmitted, within port
+             write timeout. The queue is watched with TIOCOUTQ, sleeping
+             about the time pending bytes take at line speed, then tcdrain()
+             waits for the last characters held by the UART
+Inputs    :  p   : port structure
+             fd  : terminal descriptor
+             cps : line speed in characters per second, 0 if unknown
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int wait_drain(martel_port_t *p,int fd,int cps)
+{
+        deadline_start(p,p->write_timeout);
+
+        for (;;) {
+                int pending;
+                int step;
+                int left;
+
+                if (ioctl(fd,TIOCOUTQ,&pending)<0) {
+                        return MARTEL_SYNC_FAILED;
+                }
+
+                if (pending==0) {
+                        break;
+                }
+
+                if ((left = deadline_left(p))==0) {
+                        return MARTEL_WRITE_TIMEOUT;
+                }
+
+                step = cps>0 ? pending*1000/cps : DRAIN_STEP_MIN;
+
+                if (step<DRAIN_STEP_MIN) {
+                        step = DRAIN_STEP_MIN;
+                }
+                if (step>DRAIN_STEP_MAX) {
+                        step = DRAIN_STEP_MAX;
+                }
+                if (left>0 && step>left) {
+                        step = left;
+                }
+
+                /*interrupted waits end the operation, as they always did*/
+                if (poll(NULL,0,step)<0) {
+                        return MARTEL_WRITE_TIMEOUT;
+                }
+        }
+
+        if (tcdrain(fd)<0) {
+                if (errno==EINTR) {
+                        return MARTEL_WRITE_TIMEOUT;
+                }
+                return MARTEL_SYNC_FAILED;
+        }
+
+        return MARTEL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  writev_fd
+Purpose   :  Write data fragments to descriptor with as few writev() calls
+             as the kernel accepts. Like the write routines of descriptor
+             ports, each wait for room is bounded by port write timeout
+Inputs    :  p   : port structure
+             fd  : descriptor
+             iov : data fragments
+             n   : number of fragments
+Outputs   :  p->written : bytes written
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int writev_fd(martel_port_t *p,int fd,const struct iovec *iov,int n)
+{
+        martel_error_t errnum = MARTEL_OK;
+        size_t skip = 0;
+
+        p->written = 0;
+
+        for (;;) {
+                struct iovec vec[WRITEV_CHUNK];
+                ssize_t done;
+                int count;
+
+                /*pass fragments already written (skip bytes into first one)*/
+                while (n && skip>=iov->iov_len) {
+                        skip -= iov->iov_len;
+                        iov++;
+                        n--;
+                }
+
+                if (n==0) {
+                        break;
+                }
+
+                count = n<WRITEV_CHUNK ? n : WRITEV_CHUNK;
+
+                memcpy(vec,iov,count*sizeof(struct iovec));
+                vec[0].iov_base = (char *)vec[0].iov_base+skip;
+                vec[0].iov_len -= skip;
+
+                /*wait until some room is available*/
+                rt_io_begin(p);
+                done = wait_fd(fd,POLLOUT,p->write_timeout);
+                rt_io_end(p);
+
+                if (done<0) {
+                        errnum = MARTEL_WRITE_FAILED;
+                        break;
+                }
+                else if (done==0) {
+                        errnum = MARTEL_WRITE_TIMEOUT;
+                        break;
+                }
+
+                /*write some bytes*/
+                rt_io_begin(p);
+                done = writev(fd,vec,count);
+                rt_io_end(p);
+
+                if (done<0) {
+                        if (errno==EAGAIN) {
+                                continue;
+                        }
+                        errnum = MARTEL_WRITE_FAILED;
+                        break;
+                }
+
+                skip += done;
+                p->written += done;
+        }
+
+        return errnum;
+}
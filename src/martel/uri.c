@@ -363,3 +363,92 @@ const char *uri_get_opt(struct martel_uri *su,const char *key)
 }
 
 
+
+/*-----------------------------------------------------------------------------
+Name      :  uri_get_realtime
+Purpose   :  Get real-time I/O options from URI structure
+             realtime=no|yes|<priority> selects SCHED_FIFO priority
+             cpu=<n> pins the I/O thread to CPU n
+Inputs    :  su       : URI structure
+Outputs   :  priority : SCHED_FIFO priority, 0 if real-time mode is off
+             cpu      : CPU number, -1 if thread is not pinned
+Return    :  0 on success, -1 if an option is not valid
+-----------------------------------------------------------------------------*/
+int uri_get_realtime(struct martel_uri *su,int *priority,int *cpu)
+{
+        const char *value;
+        char *end;
+        long n;
+
+        assert(su!=NULL);
+
+        *priority = 0;
+        *cpu = -1;
+
+        value = uri_get_opt(su,"realtime");
+
+        if (value==NULL || strcmp(value,"no")==0) {
+                *priority = 0;
+        }
+        else if (strcmp(value,"yes")==0) {
+                *priority = RT_DEFPRIORITY;
+        }
+        else {
+                n = strtol(value,&end,10);
+
+                if (*end!=0 || n<RT_MINPRIORITY || n>RT_MAXPRIORITY) {
+                        return -1;
+                }
+
+                *priority = n;
+        }
+
+        value = uri_get_opt(su,"cpu");
+
+        if (value!=NULL) {
+                n = strtol(value,&end,10);
+
+                if (*end!=0 || n<0 || n>=RT_CPU_MAX) {
+                        return -1;
+                }
+
+                *cpu = n;
+        }
+
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Name      :  uri_get_buffer
+Purpose   :  Get write-combining buffer option from URI structure
+             buffer=no|<bytes> sets size of port output buffer
+Inputs    :  su   : URI structure
+Outputs   :  size : buffer size in bytes, 0 if writes are not combined
+Return    :  0 on success, -1 if option is not valid
+-----------------------------------------------------------------------------*/
+int uri_get_buffer(struct martel_uri *su,int *size)
+{
+        const char *value;
+        char *end;
+        long n;
+
+        assert(su!=NULL);
+
+        *size = 0;
+
+        value = uri_get_opt(su,"buffer");
+
+        if (value==NULL || strcmp(value,"no")==0) {
+                return 0;
+        }
+
+        n = strtol(value,&end,10);
+
+        if (*end!=0 || n<0 || n>OUTBUF_MAX) {
+                return -1;
+        }
+
+        *size = n;
+
+        return 0;
+}
@@ -35,6 +35,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <termios.h>
 #include <sys/ioctl.h>
@@ -49,23 +50,24 @@
 /* PRIVATE DEFINITIONS ------------------------------------------------------*/
 static const char id_str[] = "$Id: usb.c,v 1.1 2006/08/01 09:12:23 chris Exp $";
 
-static  void    usb_timer(int);
-
-/* PRIVATE FUNCTIONS --------------------------------------------------------*/
-
-/*-----------------------------------------------------------------------------
-Name      :  usb_timer
-Purpose   :  Custom signal handler for SIGALRM signals
-Inputs    :  signum : signal number
-Outputs   :  <>
-Return    :  <>
------------------------------------------------------------------------------*/
-static void usb_timer(int signum)
-{
-        /* this function trmartel SIGALRM signals
-         * this function does nothing
-         */
-}
+/* PUBLIC DEFINITIONS -------------------------------------------------------*/
+
+const martel_ops_t usb_ops = {
+        MARTEL_USB,
+        "usb",
+        usb_get_uri,
+        usb_create_from_uri,
+        usb_open,
+        usb_close,
+        usb_write,
+        usb_writev,
+        usb_write_rt,
+        usb_read,
+        usb_sync,
+        usb_flush,
+        usb_get_pending,
+        usb_get_fd
+};
 
 /* PUBLIC FUNCTIONS ---------------------------------------------------------*/
 
@@ -170,6 +172,7 @@ int usb_open(martel_port_t *p)
 
         /*setup default usb settings*/
         if (tcgetattr(fd,&set)<0) {
+                close(fd);
                 return MARTEL_IO_ERROR;
         }
 
@@ -183,6 +186,7 @@ int usb_open(martel_port_t *p)
         set.c_cflag |= CLOCAL|CREAD;
 
         if (tcsetattr(fd,TCSANOW,&set)<0) {
+                close(fd);
                 return MARTEL_IO_ERROR;
         }
 
@@ -223,26 +227,15 @@ Return    :  MARTEL_OK or error code
 int usb_write(martel_port_t *p,const void *buf,int size)
 {
         martel_error_t errnum = MARTEL_OK;
-        fd_set fds;
-
-        FD_ZERO(&fds);
-        FD_SET(p->set.serial.fd,&fds);
+        p->written = 0;
 
         while (size) {
                 int n;
 
                 /*wait until some room is available in kernel write buffer*/
-                if (p->write_timeout==0) {
-                        n = select(p->set.serial.fd+1,NULL,&fds,NULL,NULL);
-                }
-                else {
-                        struct timeval tv;
-
-                        tv.tv_sec = p->write_timeout/1000;
-                        tv.tv_usec = (p->write_timeout%1000)*1000;
-
-                        n = select(p->set.serial.fd+1,NULL,&fds,NULL,&tv);
-                }
+                rt_io_begin(p);
+                n = wait_fd(p->set.serial.fd,POLLOUT,p->write_timeout);
+                rt_io_end(p);
 
                 if (n<0) {
                         errnum = MARTEL_WRITE_FAILED;
@@ -254,7 +247,9 @@ int usb_write(martel_port_t *p,const void *buf,int size)
                 }
 
                 /*write some bytes*/
+                rt_io_begin(p);
                 n = write(p->set.serial.fd,buf,size);
+                rt_io_end(p);
 
                 if (n<0) {
                         errnum = MARTEL_WRITE_FAILED;
@@ -263,12 +258,27 @@ int usb_write(martel_port_t *p,const void *buf,int size)
                 else {
                         buf += n;
                         size -= n;
+                        p->written += n;
                 }
         }
 
         return errnum;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  usb_writev
+Purpose   :  Write data fragments to usb port
+Inputs    :  p   : port structure
+             iov : data fragments
+             n   : number of fragments
+Outputs   :  <>
+Return    :  MARTEL_OK or error code
+-----------------------------------------------------------------------------*/
+int usb_writev(martel_port_t *p,const struct iovec *iov,int n)
+{
+        return writev_fd(p,p->set.serial.fd,iov,n);
+}
+
 /*-----------------------------------------------------------------------------
 Name      :  usb_write_rt
 Purpose   :  Write data buffer to serial port with handshaking disabled
@@ -313,26 +323,13 @@ Return    :  MARTEL_OK or error code
 int usb_read(martel_port_t *p,void *buf,int size)
 {
         martel_error_t errnum = MARTEL_OK;
-        fd_set fds;
-
-        FD_ZERO(&fds);
-        FD_SET(p->set.serial.fd,&fds);
-
         while (size) {
                 int n;
 
                 /*wait until some bytes are available in kernel read buffer*/
-                if (p->read_timeout==0) {
-                        n = select(p->set.serial.fd+1,&fds,NULL,NULL,NULL);
-                }
-                else {
-                        struct timeval tv;
-
-                        tv.tv_sec = p->read_timeout/1000;
-                        tv.tv_usec = (p->read_timeout%1000)*1000;
-
-                        n = select(p->set.serial.fd+1,&fds,NULL,NULL,&tv);
-                }
+                rt_io_begin(p);
+                n = wait_fd(p->set.serial.fd,POLLIN,p->read_timeout);
+                rt_io_end(p);
 
                 if (n<0) {
                         errnum = MARTEL_READ_FAILED;
@@ -344,7 +341,9 @@ int usb_read(martel_port_t *p,void *buf,int size)
                 }
 
                 /*read some bytes*/
+                rt_io_begin(p);
                 n = read(p->set.serial.fd,buf,size);
+                rt_io_end(p);
 
                 if (n<0) {
                         errnum = MARTEL_READ_FAILED;
@@ -368,47 +367,25 @@ Return    :  MARTEL_OK or error code
 -----------------------------------------------------------------------------*/
 int usb_sync(martel_port_t *p)
 {
-        martel_error_t errnum;
-        struct sigaction sa,old_sa;
-        struct itimerval timer;
-
-        if (p->write_timeout!=0) {
-                /*install signal handler*/
-                memset(&sa,0,sizeof(sa));
-                sa.sa_handler = &usb_timer;
-                sigaction(SIGALRM,&sa,&old_sa);
-
-                /*start timer*/
-                timer.it_interval.tv_sec = 0;
-                timer.it_interval.tv_usec = 0;
-                timer.it_value.tv_sec = p->write_timeout/1000;
-                timer.it_value.tv_usec = (p->write_timeout%1000)*1000;
-
-                setitimer(ITIMER_REAL,&timer,NULL);
-        }
-
-        if (tcdrain(p->set.serial.fd)<0) {
-                if (errno==EINTR) {
-                        errnum = MARTEL_WRITE_TIMEOUT;
-                }
-                else {
-                        errnum = MARTEL_SYNC_FAILED;
-                }
-        }
-        else {
-                errnum = MARTEL_OK;
-        }
+        return wait_drain(p,p->set.serial.fd,0);
+}
 
-        if (p->write_timeout!=0) {
-                /*stop timer*/
-                memset(&timer,0,sizeof(timer));
-                setitimer(ITIMER_REAL,&timer,NULL);
+/*-----------------------------------------------------------------------------
+Name      :  usb_get_pending
+Purpose   :  Get number of bytes waiting in kernel output buffer
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  number of bytes or error code
+-----------------------------------------------------------------------------*/
+int usb_get_pending(martel_port_t *p)
+{
+        int n;
 
-                /*uninstall signal handler*/
-                sigaction(SIGALRM,&old_sa,NULL);
+        if (ioctl(p->set.serial.fd,TIOCOUTQ,&n)<0) {
+                return MARTEL_IO_ERROR;
         }
 
-        return errnum;
+        return n;
 }
 
 /*-----------------------------------------------------------------------------
@@ -432,3 +409,14 @@ int usb_flush(martel_port_t *p)
         return errnum;
 }
 
+/*-----------------------------------------------------------------------------
+Name      :  usb_get_fd
+Purpose   :  Get descriptor of USB port for event loops
+Inputs    :  p : port structure
+Outputs   :  <>
+Return    :  descriptor
+-----------------------------------------------------------------------------*/
+int usb_get_fd(martel_port_t *p)
+{
+        return p->set.serial.fd;
+}